@@ -9,10 +9,16 @@ gcc main.c																\
 	./core/ssl.c														\
 	./core/socket.c														\
 	./core/server.c														\
+	./core/reactor.c													\
+	./core/timer.c														\
+	./core/affinity.c													\
+	./core/overload.c													\
 	./core/jobinternal.c												\
 	./core/connection.c													\
 	./core/fdevent.c													\
 	./core/request.c													\
+	./core/scan.c														\
+	./core/multipart.c													\
 	./core/response.c													\
 	./core/threads.c													\
 	./core/joblist.c													\
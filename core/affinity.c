@@ -0,0 +1,232 @@
+/***********************************************************************
+ * XG SERVER
+ * core/affinity.c
+ * Привязка потоков сервера к процессорам и узлам NUMA
+ *
+ * Copyright (с) 2014-2015 Stanislav V. Tretyakov, svtrostov@yandex.ru
+ **********************************************************************/
+
+#define _GNU_SOURCE
+
+#include "core.h"
+#include "server.h"
+#include "globals.h"
+
+#include <dirent.h>
+#include <sys/syscall.h>
+
+
+/*
+ * Наборы процессоров задаются для каждой роли потоков в формате cpulist ("0-3,8,10-11"):
+ * реактор закрепляется за одним процессором набора (реактор i - за i-м процессором по кругу),
+ * рабочие потоки и поток внутренних заданий - за всем набором.
+ * Пустая строка - поток не закрепляется.
+ *
+ * При включенном numa_local поток, закрепленный за процессорами одного узла NUMA, устанавливает
+ * для себя политику выделения памяти MPOL_PREFERRED для этого узла: буферы и структуры, которые
+ * поток выделяет после запуска, размещаются в локальной памяти узла.
+ */
+
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+//Максимальное количество узлов NUMA, учитываемых при определении узла процессора
+#define AFFINITY_MAX_NODES 64
+
+static const char * affinity_role_names[AFFINITY_ROLES] = {"reactor", "worker", "internal"};
+
+static cpu_set_t	affinity_sets[AFFINITY_ROLES];		//Наборы процессоров ролей
+static int			affinity_counts[AFFINITY_ROLES];	//Количество процессоров в наборах, 0 - поток не закрепляется
+static bool			affinity_numa_local = false;		//Выделять память потоков в локальном узле NUMA
+
+
+
+/***********************************************************************
+ * Вспомогательные функции
+ **********************************************************************/
+
+
+/*
+ * Разбор списка процессоров в формате cpulist ("0-3,8,10-11")
+ */
+static result_e
+_affinityParse(const char * list, cpu_set_t * set){
+	const char * ptr = list;
+	char * end;
+	long from, to;
+
+	CPU_ZERO(set);
+	if(!list) return RESULT_OK;
+
+	while(*ptr){
+		while(*ptr == ' ' || *ptr == ',') ptr++;
+		if(!*ptr) break;
+
+		from = strtol(ptr, &end, 10);
+		if(end == ptr || from < 0) return RESULT_ERROR;
+		to = from;
+		ptr = end;
+
+		if(*ptr == '-'){
+			ptr++;
+			to = strtol(ptr, &end, 10);
+			if(end == ptr || to < from) return RESULT_ERROR;
+			ptr = end;
+		}
+
+		if(to >= CPU_SETSIZE) return RESULT_ERROR;
+		for(; from <= to; from++) CPU_SET((int)from, set);
+
+		if(*ptr && *ptr != ',' && *ptr != ' ') return RESULT_ERROR;
+	}
+
+	return RESULT_OK;
+}//END: _affinityParse
+
+
+
+/*
+ * Формирует строку cpulist из набора процессоров
+ */
+static const char *
+_affinityFormat(const cpu_set_t * set, char * buf, size_t size){
+	size_t len = 0;
+	int cpu, last;
+
+	buf[0] = '\0';
+	for(cpu = 0; cpu < CPU_SETSIZE && len < size; cpu++){
+		if(!CPU_ISSET(cpu, set)) continue;
+		last = cpu;
+		while(last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set)) last++;
+		if(last > cpu){
+			len += snprintf(buf + len, size - len, "%s%d-%d", (len ? "," : ""), cpu, last);
+		}else{
+			len += snprintf(buf + len, size - len, "%s%d", (len ? "," : ""), cpu);
+		}
+		cpu = last;
+	}
+	return buf;
+}//END: _affinityFormat
+
+
+
+/*
+ * Возвращает узел NUMA, к которому относится процессор, или -1, если узел не определен
+ */
+static int
+_affinityCpuNode(int cpu){
+	char path[64];
+	struct dirent * entry;
+	DIR * dir;
+	int node = -1;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	if((dir = opendir(path)) == NULL) return -1;
+	while((entry = readdir(dir)) != NULL){
+		if(strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9'){
+			node = atoi(entry->d_name + 4);
+			break;
+		}
+	}
+	closedir(dir);
+	return node;
+}//END: _affinityCpuNode
+
+
+
+/*
+ * Устанавливает для текущего потока предпочтительный узел NUMA, если все процессоры набора относятся к одному узлу
+ * Возвращает номер узла или -1, если политика не установлена
+ */
+static int
+_affinityNumaLocal(const cpu_set_t * set){
+	unsigned long nodemask;
+	int cpu, node = -1, cpu_node;
+
+	for(cpu = 0; cpu < CPU_SETSIZE; cpu++){
+		if(!CPU_ISSET(cpu, set)) continue;
+		cpu_node = _affinityCpuNode(cpu);
+		if(cpu_node < 0 || cpu_node >= AFFINITY_MAX_NODES) return -1;
+		if(node >= 0 && cpu_node != node) return -1;
+		node = cpu_node;
+	}
+	if(node < 0) return -1;
+
+	nodemask = 1UL << node;
+	if(syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nodemask, (unsigned long)AFFINITY_MAX_NODES + 1) != 0){
+		RETURN_ERROR(-1, "set_mempolicy(MPOL_PREFERRED, node %d) failed: %s", node, strerror(errno));
+	}
+	return node;
+}//END: _affinityNumaLocal
+
+
+
+/***********************************************************************
+ * Функции
+ **********************************************************************/
+
+
+/*
+ * Разбор наборов процессоров из конфигурации сервера и вывод настроек привязки потоков
+ * Функция вызывается при старте сервера до создания реакторов и рабочих потоков
+ */
+void
+affinityInit(server_s * srv){
+	const char * lists[AFFINITY_ROLES] = {srv->config.reactor_cpus, srv->config.worker_cpus, srv->config.internal_cpus};
+	char buf[256];
+	int role;
+
+	for(role = 0; role < AFFINITY_ROLES; role++){
+		if(_affinityParse(lists[role], &affinity_sets[role]) != RESULT_OK){
+			FATAL_ERROR("Invalid CPU list [/webserver/%s_cpus]: \"%s\"", affinity_role_names[role], lists[role]);
+		}
+		affinity_counts[role] = CPU_COUNT(&affinity_sets[role]);
+		printf("CPU affinity: %s threads -> %s\n", affinity_role_names[role], (affinity_counts[role] ? _affinityFormat(&affinity_sets[role], buf, sizeof(buf)) : "not pinned"));
+	}
+
+	affinity_numa_local = srv->config.numa_local;
+	if(affinity_numa_local) printf("CPU affinity: NUMA-local allocation for pinned threads\n");
+}//END: affinityInit
+
+
+
+/*
+ * Закрепление потока thread роли role с порядковым номером index за процессорами роли
+ * Политика NUMA устанавливается, только если thread - текущий поток
+ */
+void
+affinityApply(affinity_role_e role, size_t index, pthread_t thread){
+	cpu_set_t set;
+	char buf[256];
+	int cpu, n, node = -1;
+
+	if(role >= AFFINITY_ROLES || !affinity_counts[role]) return;
+
+	if(role == AFFINITY_REACTOR){
+		//Реактор закрепляется за одним процессором набора
+		n = (int)(index % (size_t)affinity_counts[role]);
+		CPU_ZERO(&set);
+		for(cpu = 0; cpu < CPU_SETSIZE; cpu++){
+			if(!CPU_ISSET(cpu, &affinity_sets[role])) continue;
+			if(n-- == 0){ CPU_SET(cpu, &set); break; }
+		}
+	}else{
+		memcpy(&set, &affinity_sets[role], sizeof(cpu_set_t));
+	}
+
+	if((errno = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &set)) != 0){
+		ERROR_MSG("%s thread %u: pthread_setaffinity_np(%s) failed: %s", affinity_role_names[role], (uint32_t)index, _affinityFormat(&set, buf, sizeof(buf)), strerror(errno));
+		return;
+	}
+
+	if(affinity_numa_local && pthread_equal(thread, pthread_self())) node = _affinityNumaLocal(&set);
+
+	if(node >= 0){
+		printf("CPU affinity: %s thread %u pinned to CPUs %s, NUMA node %d\n", affinity_role_names[role], (uint32_t)index, _affinityFormat(&set, buf, sizeof(buf)), node);
+	}else{
+		printf("CPU affinity: %s thread %u pinned to CPUs %s\n", affinity_role_names[role], (uint32_t)index, _affinityFormat(&set, buf, sizeof(buf)));
+	}
+}//END: affinityApply
+
@@ -316,6 +316,17 @@ chunkqueueRead(chunkqueue_s * cq, const char ** pointer, uint32_t * length){
 
 		//Контент из файла
 		case CHUNK_FILE:
+			//Данные из файла будут переданы в сокет напрямую через chunkqueueSendFile(),
+			//возвращаем только количество оставшихся для отправки байт без указателя на данные
+			if(cq->zero_copy){
+				if(cq->current.written_n >= chunk->length){
+					send_len = 0;
+					goto label_chunk;
+				}
+				send_ptr = NULL;
+				send_len = chunk->length - cq->current.written_n;
+				break;
+			}
 			if(!cq->temp){
 				cq->temp = mNew(chunkqueue_internal_buffer_size + 1);
 				cq->temp[chunkqueue_internal_buffer_size] = '\0';
@@ -410,12 +421,138 @@ chunkqueueRead(chunkqueue_s * cq, const char ** pointer, uint32_t * length){
 void
 chunkqueueCommit(chunkqueue_s * cq, uint32_t length){
 	if(!cq) return;
+	chunk_s * chunk = cq->current.chunk;
+	uint32_t left;
+	//Отправленные данные могут охватывать несколько частей контента (writev),
+	//полностью отправленные части пропускаются
+	while(chunk){
+		left = (chunk->type != CHUNK_NONE && chunk->length > cq->current.written_n ? chunk->length - cq->current.written_n : 0);
+		if(length <= left) break;
+		length -= left;
+		cq->current.chunk = chunk = chunk->next;
+		cq->current.written_n = 0;
+		cq->temp_size = 0;
+		cq->temp_n = 0;
+	}
 	cq->current.written_n += length;
 	cq->temp_n += length;
 }//END: chunkqueueCommit
 
 
 
+/*
+ * Заполняет массив iov указателями на идущие подряд (начиная с текущей позиции) части контента, находящиеся в памяти,
+ * не более iov_max элементов и не более max_length байт. На части контента из файла заполнение останавливается.
+ * Возвращает количество заполненных элементов iov, общий объем данных записывается в length
+ * Отправленный объем данных передается в chunkqueueCommit(), который корректно переходит через границы частей контента
+ */
+int
+chunkqueueReadVector(chunkqueue_s * cq, struct iovec * iov, int iov_max, uint32_t max_length, uint32_t * length){
+	int count = 0;
+	uint32_t total = 0;
+	uint32_t written_n, left;
+	const char * ptr;
+	chunk_s * chunk;
+
+	if(cq){
+		for(chunk = cq->current.chunk, written_n = cq->current.written_n; chunk && count < iov_max && total < max_length; chunk = chunk->next, written_n = 0){
+			left = (chunk->length > written_n ? chunk->length - written_n : 0);
+			if(!left || chunk->type == CHUNK_NONE) continue;
+			switch(chunk->type){
+				case CHUNK_BUFFER:	ptr = (const char *)&chunk->buffer->buffer[chunk->offset + written_n]; break;
+				case CHUNK_STRING:	ptr = (const char *)&chunk->string->ptr[chunk->offset + written_n]; break;
+				case CHUNK_HEAP:	ptr = (const char *)&chunk->heap[chunk->offset + written_n]; break;
+				//Часть контента из файла
+				default: goto label_end;
+			}
+			if(left > max_length - total) left = max_length - total;
+			iov[count].iov_base	= (void *)ptr;
+			iov[count].iov_len	= left;
+			total += left;
+			count++;
+		}
+	}
+
+	label_end:
+	if(length) *length = total;
+	return count;
+}//END: chunkqueueReadVector
+
+
+
+/*
+ * Читает из очереди очередную порцию контента для отправки клиенту,
+ * идущие подряд небольшие части контента из памяти объединяются во внутреннем буфере в один блок размером не более max_length байт
+ * (используется при SSL, чтобы несколько частей контента уходили одной SSL записью)
+ */
+result_e
+chunkqueueReadCoalesced(chunkqueue_s * cq, const char ** pointer, uint32_t * length, uint32_t max_length){
+	struct iovec iov[CHUNKQUEUE_IOVEC_MAX];
+	uint32_t total, n = 0;
+	int i, count;
+
+	max_length = min(max_length, chunkqueue_internal_buffer_size);
+
+	//Объединять нечего - обычное чтение
+	if((count = chunkqueueReadVector(cq, iov, CHUNKQUEUE_IOVEC_MAX, max_length, &total)) < 2) return chunkqueueRead(cq, pointer, length);
+
+	if(!cq->temp){
+		cq->temp = mNew(chunkqueue_internal_buffer_size + 1);
+		cq->temp[chunkqueue_internal_buffer_size] = '\0';
+	}
+	for(i = 0; i < count; i++){
+		memcpy(&cq->temp[n], iov[i].iov_base, iov[i].iov_len);
+		n += iov[i].iov_len;
+	}
+
+	if(length) *length = total;
+	if(pointer)*pointer = cq->temp;
+	return RESULT_OK;
+}//END: chunkqueueReadCoalesced
+
+
+
+/*
+ * Отправляет в сокет данные текущей части контента из файла через sendfile(),
+ * данные передаются из page cache в сокет без копирования в пространство пользователя.
+ * Вызывается после chunkqueueRead(), вернувшей для CHUNK_FILE пустой указатель,
+ * возвращает результат в формате write(): количество отправленных байт или -1
+ */
+ssize_t
+chunkqueueSendFile(chunkqueue_s * cq, socket_t sock_fd, uint32_t length){
+	chunk_s * chunk = cq->current.chunk;
+	if(!chunk || chunk->type != CHUNK_FILE){
+		errno = EINVAL;
+		return -1;
+	}
+	off_t offset = (off_t)chunk->offset + cq->current.written_n;
+	return sendfile(sock_fd, chunk->file->fd, &offset, min(length, chunkqueue_sendfile_max));
+}//END: chunkqueueSendFile
+
+
+
+/*
+ * Отправляет в SSL соединение данные текущей части контента из файла через SSL_sendfile()
+ * Используется только если шифрование передано ядру (kTLS), данные шифруются ядром без копирования в пространство пользователя.
+ * Возвращает результат в формате SSL_write(): количество отправленных байт или <= 0 (ошибка проверяется через SSL_get_error)
+ */
+ssize_t
+chunkqueueSendFileSSL(chunkqueue_s * cq, SSL * ssl, uint32_t length){
+#ifdef XG_SSL_KTLS
+	chunk_s * chunk = cq->current.chunk;
+	if(!chunk || chunk->type != CHUNK_FILE){
+		errno = EINVAL;
+		return -1;
+	}
+	return SSL_sendfile(ssl, chunk->file->fd, (off_t)chunk->offset + cq->current.written_n, min(length, chunkqueue_sendfile_max), 0);
+#else
+	errno = ENOTSUP;
+	return -1;
+#endif
+}//END: chunkqueueSendFileSSL
+
+
+
 
 
 /*
@@ -15,9 +15,6 @@
 //static char trash_buffer[1024 * 16];
 
 
-//Мьютекс синхронизации в момент изменения состояния соединения
-static pthread_mutex_t connection_stage_mutex = PTHREAD_MUTEX_INITIALIZER;
-
 //Инкрементальный ID соединения
 static uint64_t connection_unique_id = 0;
 
@@ -42,6 +39,7 @@ connectionStageAsString(connection_stage_e s){
 		case CON_STAGE_ACCEPTING: return "CON_STAGE_ACCEPTING";
 		case CON_STAGE_HANDSTAKE: return "CON_STAGE_HANDSTAKE";
 		case CON_STAGE_CONNECTED: return "CON_STAGE_CONNECTED";
+		case CON_STAGE_KEEPALIVE: return "CON_STAGE_KEEPALIVE";
 
 		//Чтение данных запроса
 		case CON_STAGE_READ: return "CON_STAGE_READ";
@@ -107,14 +105,14 @@ connectionErrorAsString(connection_error_e e){
  */
 connection_stage_e
 connectionSetStage(connection_s * con, connection_stage_e new_stage){
-	//При изменении состояния соединения используются мьютексы,
-	//поскольку сосотояние соединения может быть изменено помимо основного потока также рабочими потоками
-	pthread_mutex_lock(&connection_stage_mutex);
+	//Состояние соединения может быть изменено помимо основного потока также рабочими потоками,
+	//поэтому оно изменяется атомарно (CAS)
 	//Жизненный цикл соединения устанавливается только в сторону увеличения
-	if(con->stage < new_stage) con->stage = new_stage;
-	new_stage = con->stage;
-	pthread_mutex_unlock(&connection_stage_mutex);
-	return new_stage;
+	connection_stage_e stage = __atomic_load_n(&con->stage, __ATOMIC_SEQ_CST);
+	while(stage < new_stage){
+		if(__atomic_compare_exchange_n(&con->stage, &stage, new_stage, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) return new_stage;
+	}
+	return stage;
 }//END: connectionSetStage
 
 
@@ -124,32 +122,22 @@ connectionSetStage(connection_s * con, connection_stage_e new_stage){
  */
 job_stage_e
 connectionSetJobStage(connection_s * con, job_stage_e new_stage, bool necessarily){
-	job_stage_e result;
-	//При изменении состояния соединения используются мьютексы,
-	//поскольку сосотояние соединения может быть изменено помимо основного потока также 
-	pthread_mutex_lock(&connection_stage_mutex);
+	job_stage_e expected;
+	//Состояние может быть изменено помимо основного потока также рабочими потоками,
+	//переход выполняется атомарно (CAS) только из предшествующего состояния
 	if(necessarily){
-		con->job_stage = new_stage;
-	}else{
-		switch(new_stage){
-			case JOB_STAGE_NONE:
-				if(con->job_stage == JOB_STAGE_WAITMAIN) con->job_stage = new_stage;
-			break;
-			case JOB_STAGE_WAITING:
-				if(con->job_stage == JOB_STAGE_NONE) con->job_stage = new_stage;
-			break;
-			case JOB_STAGE_WORKING:
-				if(con->job_stage == JOB_STAGE_WAITING) con->job_stage = new_stage;
-			break;
-			case JOB_STAGE_WAITMAIN:
-				if(con->job_stage == JOB_STAGE_WORKING) con->job_stage = new_stage;
-			break;
-		}
+		__atomic_store_n(&con->job_stage, new_stage, __ATOMIC_SEQ_CST);
+		return new_stage;
 	}
-	result = con->job_stage;
-	pthread_mutex_unlock(&connection_stage_mutex);
-
-	return result;
+	switch(new_stage){
+		case JOB_STAGE_NONE:		expected = JOB_STAGE_WAITMAIN; break;
+		case JOB_STAGE_WAITING:		expected = JOB_STAGE_NONE; break;
+		case JOB_STAGE_WORKING:		expected = JOB_STAGE_WAITING; break;
+		case JOB_STAGE_WAITMAIN:	expected = JOB_STAGE_WORKING; break;
+		default: return __atomic_load_n(&con->job_stage, __ATOMIC_SEQ_CST);
+	}
+	if(__atomic_compare_exchange_n(&con->job_stage, &expected, new_stage, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) return new_stage;
+	return expected;
 }//END: connectionSetJobStage
 
 
@@ -157,17 +145,18 @@ connectionSetJobStage(connection_s * con, job_stage_e new_stage, bool necessaril
 
 /*
  * Создание структуры клиентского соединения
+ * Структура выравнивается по кеш-линии, чтобы горячие поля соединения занимали отдельные кеш-линии
  */
 static connection_s *
-connectionStructureCreate(server_s * srv){
-	connection_s * con = (connection_s *) mNewZ(sizeof(connection_s));
+connectionStructureCreate(reactor_s * reactor){
+	connection_s * con = (connection_s *) mNewAlignedZ(XG_CACHE_LINE, sizeof(connection_s));
 	con->fd			= -1;	//Дескриптор соединения
 	con->index		= -1;	//Индекс в массиве fds
 	con->stage		= CON_STAGE_NONE;
-	con->server		= srv;	//Ссылка на структуру сервера
+	con->server		= reactor->server;	//Ссылка на структуру сервера
+	con->reactor	= reactor;	//Ссылка на реактор, владеющий соединением
 	con->http_code	= 200;	//HTTP статус обработки запроса (код ответа)
 	con->job_stage	= JOB_STAGE_NONE;
-	con->job_item	= NULL;
 	return con;
 }//END: connectionStructureCreate
 
@@ -175,16 +164,16 @@ connectionStructureCreate(server_s * srv){
 
 
 /*
- * Создание массива структур клиентских соединений
+ * Создание массива активных клиентских соединений
+ * Сами структуры соединений создаются по мере необходимости в connectionGet(),
+ * освобожденные структуры хранятся в списке свободных соединений реактора
  */
 result_e
-connectionsCreate(server_s * srv){
-	size_t i;
-	srv->connections		= (connection_s **)mNewZ(sizeof(connection_s *) * server_max_connections);
-	srv->connections_count	= 0;
-	for(i = 0; i < server_max_connections; i++){
-		srv->connections[i] = connectionStructureCreate(srv);
-	}
+connectionsCreate(reactor_s * reactor){
+	reactor->connections_size	= max(1, min(server_connections_initial_size, reactor->server->config.max_connections));
+	reactor->connections		= (connection_s **)mNewZ(sizeof(connection_s *) * reactor->connections_size);
+	reactor->connections_count	= 0;
+	reactor->connections_free	= NULL;
 	return RESULT_OK;
 }//END: connectionsArrayCreate
 
@@ -194,17 +183,22 @@ connectionsCreate(server_s * srv){
  * Удаление массива структур клиентских соединений
  */
 result_e
-connectionsFree(server_s * srv){
+connectionsFree(reactor_s * reactor){
 	size_t i;
 	connection_s * con;
-	for(i = 0; i < server_max_connections; i++){
-		con = srv->connections[i];
+	for(i = 0; i < reactor->connections_count; i++){
+		con = reactor->connections[i];
 		connectionClear(con);
-		mFree(con);
+		mFreeAligned(con);
 	}
-	mFree(srv->connections);
-	srv->connections		= NULL;
-	srv->connections_count	= 0;
+	while((con = reactor->connections_free) != NULL){
+		reactor->connections_free = con->next_free;
+		mFreeAligned(con);
+	}
+	mFree(reactor->connections);
+	reactor->connections		= NULL;
+	reactor->connections_size	= 0;
+	reactor->connections_count	= 0;
 	return RESULT_OK;
 }//END: connectionsFree
 
@@ -214,15 +208,16 @@ connectionsFree(server_s * srv){
  * Вывод на экран состояния активных соединений по состояниям
  */
 void
-connectionsPrint(server_s * srv){
+connectionsPrint(reactor_s * reactor){
 	size_t i;
 	uint32_t stages[CON_STAGE_DESTROYING + 1];
 	memset(stages,'\0',sizeof(stages));
 	connection_s * con;
+	printf("Reactor: %u\n",(uint32_t)reactor->index);
 	printf("Total connections: %" PRIu64 "\n",connection_unique_id);
-	printf("Active connections: %u\n",srv->connections_count);
-	for(i = 0; i < srv->connections_count; i++){
-		con = srv->connections[i];
+	printf("Active connections: %u\n",reactor->connections_count);
+	for(i = 0; i < reactor->connections_count; i++){
+		con = reactor->connections[i];
 		stages[(int)con->stage]++;
 	}
 	for(i = CON_STAGE_NONE; i <= CON_STAGE_DESTROYING; i++){
@@ -237,13 +232,28 @@ connectionsPrint(server_s * srv){
  * Возвращает экземпляр доступного для использования клиентского соединения или NULL, если нет доступных соединений
  */
 connection_s *
-connectionGet(server_s * srv){
-	if(srv->connections_count >= server_max_connections) RETURN_ERROR(NULL,"srv->connections_count >= server_max_connections");	//Достигнут лимит на количество установленных соединений
-	connection_s * con = srv->connections[srv->connections_count];
+connectionGet(reactor_s * reactor){
+	if(reactor->connections_count >= reactor->server->config.max_connections) RETURN_ERROR(NULL,"reactor->connections_count >= max_connections");	//Достигнут лимит на количество установленных соединений
+	//Массив соединений заполнен - увеличиваем в два раза, но не более max_connections
+	if(reactor->connections_count >= reactor->connections_size){
+		uint32_t size = min(reactor->connections_size * 2, reactor->server->config.max_connections);
+		reactor->connections = (connection_s **)mResize(reactor->connections, sizeof(connection_s *) * size);
+		memset(&reactor->connections[reactor->connections_size], '\0', sizeof(connection_s *) * (size - reactor->connections_size));
+		reactor->connections_size = size;
+	}
+	//Структура соединения берется из списка свободных соединений или создается, если список пуст
+	connection_s * con = reactor->connections_free;
+	if(con){
+		reactor->connections_free = con->next_free;
+		con->next_free = NULL;
+	}else{
+		con = connectionStructureCreate(reactor);
+	}
 	if(con->stage != CON_STAGE_NONE) FATAL_ERROR("con->stage != CON_STAGE_NONE");
-	con->index = srv->connections_count;
-	con->connection_id = connection_unique_id++;
-	srv->connections_count++;
+	reactor->connections[reactor->connections_count] = con;
+	con->index = reactor->connections_count;
+	con->connection_id = __sync_fetch_and_add(&connection_unique_id, 1);	//Счетчик общий для всех реакторов
+	reactor->connections_count++;
 	return con;
 }//END: connectionGet
 
@@ -289,10 +299,12 @@ connectionDelete(connection_s * con){
 
 	if(!con) FATAL_ERROR("!con");
 	if(!con->server) FATAL_ERROR("!con->server");
+	if(!con->reactor) FATAL_ERROR("!con->reactor");
 	if(con->index < 0) FATAL_ERROR("con->index < 0");
 	server_s * srv = con->server;
-	if(srv->connections[con->index]->index != con->index) FATAL_ERROR("srv->connections[i] != con");
-	if(!srv->connections_count) FATAL_ERROR("!srv->connections_count");
+	reactor_s * reactor = con->reactor;
+	if(reactor->connections[con->index]->index != con->index) FATAL_ERROR("reactor->connections[i] != con");
+	if(!reactor->connections_count) FATAL_ERROR("!reactor->connections_count");
 
 	//Текущий этап соединения - уничтожение
 	connectionSetStage(con, CON_STAGE_DESTROYING);
@@ -301,25 +313,35 @@ connectionDelete(connection_s * con){
 	//Если удалить не получилось (поскольку соединение в данный момен отбрабатывается рабочим потоком -> выходим)
 	if(!jobDelete(con)) return RESULT_OK;
 
-	//Уменьшение счетчика активных соединений, перемещение удаляемого соединения в конец массива активных соедниний
-	srv->connections_count--;
-	if(con->index < srv->connections_count){
-		srv->connections[con->index] = srv->connections[srv->connections_count];
-		srv->connections[con->index]->index = con->index;
-		srv->connections[srv->connections_count] = con;
+	//Уменьшение счетчика активных соединений, на место удаляемого соединения перемещается последнее активное соединение
+	reactor->connections_count--;
+	if(con->index < reactor->connections_count){
+		reactor->connections[con->index] = reactor->connections[reactor->connections_count];
+		reactor->connections[con->index]->index = con->index;
 	}
+	reactor->connections[reactor->connections_count] = NULL;
 
 	//DEBUG_MSG("connectionClosed. -> %d", con->fd);
 
+	//Удаление таймера соединения
+	timerDelete(con);
+
 	//Сброс удаляемого соединения до начатльных параметров
+	//(поколение заданий сохраняется, чтобы оставшиеся в очередях задания соединения считались устаревшими)
+	uint32_t job_gen = con->job_gen;
 	connectionClear(con);
+	con->job_gen		= job_gen;
 	con->index			= -1;
 	con->fd				= -1;	//Дескриптор соединения
 	con->stage			= CON_STAGE_NONE;
 	con->server			= srv;	//Ссылка на структуру сервера
+	con->reactor		= reactor;	//Ссылка на реактор, владеющий соединением
 	con->http_code		= 200;	//HTTP статус обработки запроса (код ответа)
 	con->job_stage		= JOB_STAGE_NONE;
-	con->job_item		= NULL;
+
+	//Соединение возвращается в список свободных соединений реактора
+	con->next_free				= reactor->connections_free;
+	reactor->connections_free	= con;
 
 	return RESULT_OK;
 }//END: connectionDelete
@@ -365,8 +387,8 @@ connectionClose(connection_s * con){
 		socketClose(con->fd);
 
 		//Удаление дескриптора сокета из Poll Engine
-		fdEventDelete(con->server->fdevent, con->fd);	//Удаление событий из pollfds
-		fdeventRemove(con->server->fdevent, con->fd);	//Удаление дескриптора из fds
+		fdEventDelete(con->reactor->fdevent, con->fd);	//Удаление событий из pollfds
+		fdeventRemove(con->reactor->fdevent, con->fd);	//Удаление дескриптора из fds
 
 	}
 
@@ -382,8 +404,8 @@ connectionClose(connection_s * con){
  * Принимает клиентское соединение
  */
 connection_s * 
-connectionAccept(server_s * srv){
-	if(srv->connections_count >= server_max_connections) RETURN_ERROR(NULL,"srv->connections_count >= server_max_connections");	//Достигнут лимит на количество установленных соединений
+connectionAccept(reactor_s * reactor){
+	if(reactor->connections_count >= reactor->server->config.max_connections) RETURN_ERROR(NULL,"reactor->connections_count >= max_connections");	//Достигнут лимит на количество установленных соединений
 	connection_s 	* con = NULL;
 	socket_addr_s	addr;
 	socklen_t		len = sizeof(addr);
@@ -391,7 +413,11 @@ connectionAccept(server_s * srv){
 	int error_no;
 
 	//Открытие соединения
-	if((fd = accept(srv->listen_fd, (struct sockaddr *) &addr, &len)) == -1) return NULL; //RETURN_ERROR(NULL, "[%d] accept failed: %s", errno, strerror(errno));
+	if((fd = accept(reactor->listen_fd, (struct sockaddr *) &addr, &len)) == -1){
+		//Исчерпаны дескрипторы: соединение остается в очереди прослушиваемого сокета и событие повторяется на каждой итерации реактора
+		if(errno == EMFILE || errno == ENFILE) reactorAcceptExhausted(reactor);
+		return NULL; //RETURN_ERROR(NULL, "[%d] accept failed: %s", errno, strerror(errno));
+	}
 
 	//Установка сокета в неблокируемое состояние + открытие на чтение / запись
 	if(fcntl(fd, F_SETFL, O_NONBLOCK | O_RDWR)==-1){
@@ -403,7 +429,7 @@ connectionAccept(server_s * srv){
 	DEBUG_MSG("Incomming connection: FD = %d", fd);
 
 	//Получение структуры соединения
-	if((con = connectionGet(srv))==NULL) RETURN_ERROR(NULL, "connectionGet() failed");
+	if((con = connectionGet(reactor))==NULL) RETURN_ERROR(NULL, "connectionGet() failed");
 
 	con->fd = fd;
 	memcpy(&(con->remote_addr), &addr, sizeof(socket_addr_s));
@@ -417,12 +443,12 @@ connectionAccept(server_s * srv){
 */
 
 	//Добавление дескриптора сокета в Poll Engine
-	fdeventAdd(srv->fdevent, fd, connectionHandleFdEvent, con);
+	fdeventAdd(reactor->fdevent, fd, connectionHandleFdEvent, con);
 
 	//Добавляем событие на чтение из сокета для текущего соединения
-	fdEventSet(srv->fdevent, fd, FDPOLL_READ);
+	fdEventSet(reactor->fdevent, fd, FDPOLL_READ);
 
-	con->start_ts			= srv->current_ts;		//Unix время начала соединения
+	con->start_ts			= reactor->current_ts;		//Unix время начала соединения
 	con->http_code			= 200;					//HTTP статус обработки запроса (код ответа)
 	con->stage 				= CON_STAGE_ACCEPTING;	//Инициализация соединения
 	con->job_stage 			= JOB_STAGE_NONE;
@@ -442,16 +468,20 @@ static void
 connectionFdEventUpdate(connection_s * con){
 
 	switch(con->stage){
-		case CON_STAGE_ACCEPTING:
 		case CON_STAGE_HANDSTAKE:
+			//Рукопожатие может ожидать как чтения, так и записи в сокет
+			fdEventSet(con->reactor->fdevent, con->fd, (con->ssl && SSL_want_write(con->ssl) ? FDPOLL_WRITE : FDPOLL_READ));
+		break;
+		case CON_STAGE_ACCEPTING:
+		case CON_STAGE_KEEPALIVE:
 		case CON_STAGE_READ:
-			fdEventSet(con->server->fdevent, con->fd, FDPOLL_READ);
+			fdEventSet(con->reactor->fdevent, con->fd, FDPOLL_READ);
 		break;
 		case CON_STAGE_WRITE:
-			fdEventSet(con->server->fdevent, con->fd, FDPOLL_WRITE);
+			fdEventSet(con->reactor->fdevent, con->fd, FDPOLL_WRITE);
 		break;
 		default:
-			fdEventDelete(con->server->fdevent, con->fd);
+			fdEventDelete(con->reactor->fdevent, con->fd);
 		break;
 	}
 
@@ -459,11 +489,215 @@ connectionFdEventUpdate(connection_s * con){
 
 
 
+/*
+ * Проверяет, может ли соединение быть сохранено после отправки ответа (keep-alive)
+ */
+static bool
+connectionKeepAliveAllowed(connection_s * con){
+	server_s * srv = con->server;
+	if(!srv->config.keepalive_timeout || !con->request.keep_alive || XG_STATUS != XGS_WORKING) return false;
+	//Достигнут лимит запросов на одном соединении - текущий ответ будет последним
+	if(srv->config.keepalive_requests > 0 && con->requests_count + 1 >= (uint32_t)srv->config.keepalive_requests) return false;
+	return true;
+}//END: connectionKeepAliveAllowed
+
+
+
+/*
+ * Переносит данные, полученные после окончания текущего запроса, в отдельный буфер (HTTP pipelining)
+ * Буфер запроса обрезается до длинны текущего запроса, чтобы разбор тела запроса не затрагивал следующий запрос
+ */
+static void
+connectionPipelineDetach(connection_s * con, uint32_t request_len){
+	buffer_s * buf = con->request.data;
+	if(buf->count <= request_len) return;
+	//Следующий запрос будет обработан только на сохраняемом соединении
+	if(con->keep_alive){
+		con->request.pipeline = bufferCreate(request_buffer_increment);
+		bufferAddHeap(con->request.pipeline, &buf->buffer[request_len], buf->count - request_len);
+	}
+	buf->count	= request_len;
+	buf->index	= request_len;
+	buf->buffer[request_len] = '\0';
+}//END: connectionPipelineDetach
+
+
+
+/*
+ * Подготавливает соединение к приему следующего запроса клиента (keep-alive)
+ * Буферы запроса и ответа используются повторно, SSL сессия сохраняется
+ * Если вместе с предыдущим запросом было получено начало следующего - соединение сразу переходит к чтению запроса
+ */
+static void
+connectionKeepAlive(connection_s * con){
+
+	buffer_s * data		= con->request.data;
+	buffer_s * pipeline	= con->request.pipeline;
+	buffer_s * head		= con->response.head;
+	request_header_s * header_list	= con->request.header_list;
+	uint32_t headers_size			= con->request.headers_size;
+	con->request.data		= NULL;
+	con->request.pipeline	= NULL;
+	con->request.header_list	= NULL;
+	con->response.head		= NULL;
+
+	requestClear(&(con->request));		//Обнуление структуры request_s (запрос)
+	responseClear(&(con->response));	//Обнуление структуры response_s (ответ)
+
+	if(pipeline){
+		//Буфер с началом следующего запроса становится буфером запроса
+		if(data) bufferFree(data);
+		con->request.data				= pipeline;
+		con->request.parser.pipelined	= true;
+	}else{
+		con->request.data				= (data ? bufferClear(data) : bufferCreate(request_buffer_increment));
+	}
+	con->response.head		= (head ? bufferClear(head) : bufferCreate(response_buffer_head_increment));
+	con->response.content	= chunkqueueCreate();
+	con->request.header_list	= header_list;
+	con->request.headers_size	= headers_size;
+
+	con->requests_count++;
+	con->keep_alive			= false;
+	con->http_code			= 200;
+	con->connection_error	= CON_ERROR_NONE;
+	con->read_idle_ts		= 0;
+	con->read_wait			= false;
+	con->keepalive_ts		= con->reactor->current_ts;
+
+	if(pipeline) con->start_ts = con->reactor->current_ts;
+
+	//Жизненный цикл соединения возвращается на стадию ожидания (или чтения) запроса,
+	//поэтому стадия устанавливается напрямую, минуя connectionSetStage()
+	__atomic_store_n(&con->stage, (pipeline ? CON_STAGE_READ : CON_STAGE_KEEPALIVE), __ATOMIC_SEQ_CST);
+
+	connectionFdEventUpdate(con);
+
+}//END: connectionKeepAlive
+
+
+
+/*
+ * Возвращает время срабатывания таймера соединения (монотонное время в миллисекундах) для текущего этапа жизненного цикла
+ * или 0, если на текущем этапе таймаут не отслеживается
+ * Таймер срабатывает в начале секунды, следующей за истечением таймаута, что соответствует проверкам вида current_ts - ts > timeout,
+ * срок, заданный Unix временем, переводится в монотонное время реактора
+ */
+static uint64_t
+connectionTimerDeadline(connection_s * con){
+
+	server_s * srv = con->server;
+	time_t deadline;
+
+	switch(con->stage){
+		case CON_STAGE_ACCEPTING:
+			deadline = con->start_ts + min((time_t)accepting_read_timeout, (time_t)srv->config.max_request_time);
+		break;
+		case CON_STAGE_HANDSTAKE:
+			deadline = con->start_ts + min((time_t)handstake_timeout, (time_t)srv->config.max_request_time);
+		break;
+		case CON_STAGE_CONNECTED:
+			deadline = con->start_ts + srv->config.max_request_time;
+		break;
+		case CON_STAGE_READ:
+			deadline = con->start_ts + srv->config.max_request_time;
+			if(con->read_idle_ts > 0) deadline = min(deadline, con->read_idle_ts + srv->config.max_read_idle);
+		break;
+		case CON_STAGE_KEEPALIVE:
+			deadline = con->keepalive_ts + srv->config.keepalive_timeout;
+		break;
+		default:
+			return 0;
+	}
+
+	return (uint64_t)(deadline + 1) * 1000 - con->reactor->clock_offset_ms;
+}//END: connectionTimerDeadline
+
+
+
+/*
+ * Устанавливает, переносит или удаляет таймер соединения согласно его текущего этапа жизненного цикла
+ */
+static void
+connectionTimerUpdate(connection_s * con){
+	uint64_t deadline;
+	if(con->stage == CON_STAGE_NONE || (deadline = connectionTimerDeadline(con)) == 0){
+		timerDelete(con);
+	}else{
+		timerSet(con, deadline);
+	}
+}//END: connectionTimerUpdate
+
+
+
+/*
+ * Обработка сработавшего таймера соединения
+ * Функция вызывается потоком реактора для соединения, извлеченного из кучи таймеров
+ */
+void
+connectionTimeout(connection_s * con){
+
+	if(con->stage == CON_STAGE_NONE) return;
+
+	//Соединение закрыто, но не было удалено
+	if(con->fd < 0 || con->stage >= CON_STAGE_CLOSED){
+		connectionDelete(con);
+		return;
+	}
+
+	//Соединение обрабатывается рабочим потоком: таймер будет установлен заново,
+	//когда рабочий поток вернет соединение реактору (см. connectionEngine)
+	if(con->job_stage == JOB_STAGE_WORKING) return;
+
+	//Срок таймаута еще не истек (этап соединения или отметки времени изменились после установки таймера)
+	if(connectionTimerDeadline(con) > con->reactor->current_ms){
+		connectionTimerUpdate(con);
+		return;
+	}
+
+	switch(con->stage){
+
+		//Истекло время ожидания следующего запроса на keep-alive соединении
+		case CON_STAGE_KEEPALIVE:
+			connectionSetStage(con, CON_STAGE_CLOSE);
+		break;
+
+		//Истекло время ожидания первого байта запроса
+		case CON_STAGE_ACCEPTING:
+			connectionSetStage(con, CON_STAGE_CLOSE);
+			con->connection_error = CON_ERROR_ACCEPT_TIMEOUT;
+		break;
+
+		//Истекло время ожидания SSL рукопожатия
+		case CON_STAGE_HANDSTAKE:
+			connectionSetStage(con, CON_STAGE_CLOSE);
+			con->connection_error = CON_ERROR_HANDSTAKE_TIMEOUT;
+		break;
+
+		//Превышен интервал ожидания данных между двумя socket read операциями
+		//или превышен лимит времени на получение запроса от клиента
+		default:
+			con->http_code = 408;	// 408 Request Timeout - время ожидания сервером передачи от клиента истекло
+			if(con->request.data){
+				con->stage = (con->request.data->count > 0 ? CON_STAGE_WORKING : CON_STAGE_CLOSE);
+			}else{
+				con->stage = CON_STAGE_CLOSE;
+			}
+			con->connection_error = CON_ERROR_TIMEOUT;
+		break;
+	}
+
+	connectionEngine(con);
+
+}//END: connectionTimeout
+
+
+
 /*
  * Обработка соединения согласно его текущего этапа жизненного цикла
  */
-result_e
-connectionEngine(connection_s * con){
+static result_e
+_connectionEngine(connection_s * con){
 
 	server_s * srv = con->server;
 	int ret;
@@ -524,7 +758,7 @@ connectionEngine(connection_s * con){
 					case RESULT_AGAIN:
 					default:
 						//Если интервал ожитания первого байта из сокета более accepting_read_timeout секунд -> закрываем соединение
-						if(srv->current_ts - con->start_ts > accepting_read_timeout){
+						if(con->reactor->current_ts - con->start_ts > accepting_read_timeout){
 							connectionSetStage(con, CON_STAGE_CLOSE);
 							con->connection_error = CON_ERROR_ACCEPT_TIMEOUT;
 						}else 
@@ -559,24 +793,26 @@ connectionEngine(connection_s * con){
 					}
 				}//Создание SSL объекта, если он еще не был создан
 
-				//Рукопожатие
-				switch(sslDoHandshake(con->ssl)){
-					case RESULT_ERROR: 
-						connectionSetStage(con, CON_STAGE_SOCKET_ERROR);
-						con->connection_error = CON_ERROR_HANDSTAKE_SOCKET;
-					break;
-					case RESULT_OK: 
-						connectionSetStage(con, CON_STAGE_CONNECTED);
-					break;
-					case RESULT_AGAIN:
-					default:
-						if(srv->current_ts - con->start_ts > handstake_timeout){
-							connectionSetStage(con, CON_STAGE_CLOSE);
-							con->connection_error = CON_ERROR_HANDSTAKE_TIMEOUT;
-						}else 
-							return RESULT_OK;
+				if(con->reactor->current_ts - con->start_ts > handstake_timeout){
+					connectionSetStage(con, CON_STAGE_CLOSE);
+					con->connection_error = CON_ERROR_HANDSTAKE_TIMEOUT;
 					break;
 				}
+
+				//Рабочий поток вернул соединение, рукопожатие ожидает готовности сокета:
+				//подписываемся на нужное событие (чтение или запись) и ждем его
+				if(con->handshake_wait){
+					con->handshake_wait = false;
+					connectionFdEventUpdate(con);
+					return RESULT_OK;
+				}
+
+				//Рукопожатие (асимметричная криптография) выполняется рабочим потоком, чтобы не задерживать реактор,
+				//на время обработки события сокета не отслеживаются
+				fdEventDelete(con->reactor->fdevent, con->fd);
+				jobAdd(con);
+				return RESULT_OK;
+
 			break;
 
 
@@ -588,12 +824,59 @@ connectionEngine(connection_s * con){
 			break;
 
 
+			//Соединение (keep-alive) ожидает следующий запрос от клиента
+			case CON_STAGE_KEEPALIVE:
+				//Расшифрованные данные, оставшиеся в буфере SSL, не вызывают событий poll
+				if(con->ssl && SSL_pending(con->ssl) > 0){
+					con->start_ts = con->reactor->current_ts;
+					connectionSetStage(con, CON_STAGE_READ);
+					break;
+				}
+				//Проверка наличия первого байта следующего запроса
+				switch(socketReadPeek(con->fd, tmp_buf, 1, NULL)){
+					//Клиент начал передачу следующего запроса
+					case RESULT_OK:
+						con->start_ts = con->reactor->current_ts;	//Лимит времени на получение запроса отсчитывается заново
+						connectionSetStage(con, CON_STAGE_READ);
+					break;
+					//Клиент закрыл соединение
+					case RESULT_EOF:
+					case RESULT_CONRESET:
+						connectionSetStage(con, CON_STAGE_CLOSE);
+					break;
+					//Ошибка сокета
+					case RESULT_ERROR:
+						connectionSetStage(con, CON_STAGE_SOCKET_ERROR);
+						con->connection_error = CON_ERROR_READ_SOCKET;
+					break;
+					//Данных еще нет
+					case RESULT_AGAIN:
+					default:
+						if(con->reactor->current_ts - con->keepalive_ts > srv->config.keepalive_timeout){
+							connectionSetStage(con, CON_STAGE_CLOSE);
+						}else
+							return RESULT_OK;
+					break;
+				}
+			break;
+
+
 			//Получение данных от клиента
 			case CON_STAGE_READ:
 
+				//Рабочий поток вернул соединение, прочитав все доступные данные:
+				//подписываемся на чтение и ждем следующую часть запроса
+				if(con->read_wait){
+					con->read_wait = false;
+					connectionFdEventUpdate(con);
+					return RESULT_OK;
+				}
+
 				//Поскольку на этой стадии помимо чтения данных запроса из сокета выполняется
 				//их парсинг и анализ, и эта операция достаточно ресурсоемкая,
-				//то она однозначно должна выполняться в рабочем потоке
+				//то она однозначно должна выполняться в рабочем потоке,
+				//на время обработки события сокета не отслеживаются (как и при рукопожатии)
+				fdEventDelete(con->reactor->fdevent, con->fd);
 				jobAdd(con);
 				return RESULT_OK;
 
@@ -613,6 +896,9 @@ connectionEngine(connection_s * con){
 				bufferSeekBegin(con->response.head);
 				chunkqueueSetHeaderBuffer(con->response.content, con->response.head, false);
 				chunkqueueReset(con->response.content);
+				//Без SSL файлы отдаются через sendfile(), при kTLS - через SSL_sendfile(),
+				//в остальных случаях SSL_write() требует данные в пространстве пользователя
+				con->response.content->zero_copy = (con->ssl == NULL || sslKtlsSendEnabled(con->ssl));
 				connectionSetStage(con, CON_STAGE_WRITE);
 				connectionFdEventUpdate(con);
 			//break;
@@ -663,6 +949,11 @@ connectionEngine(connection_s * con){
 
 			//Запрос был получен, успешно обработан, завершающая стадия обработки запроса
 			case CON_STAGE_COMPLETE:
+				//Соединение сохраняется для следующего запроса клиента
+				if(con->keep_alive){
+					connectionKeepAlive(con);
+					break;
+				}
 				connectionFdEventUpdate(con);
 				connectionSetStage(con, CON_STAGE_CLOSE);
 			break;
@@ -709,7 +1000,7 @@ connectionEngine(connection_s * con){
 
 				//Закрытие соединения на запись
 				if (shutdown(con->fd, SHUT_WR) == 0){
-					con->close_timeout_ts = srv->current_ts;
+					con->close_timeout_ts = con->reactor->current_ts;
 				}else{
 					return connectionClose(con);
 				}
@@ -746,6 +1037,19 @@ connectionEngine(connection_s * con){
 	}//Обработка статуса соединения (пока обрабатывается)
 
 	return RESULT_OK;
+}//END: _connectionEngine
+
+
+
+/*
+ * Обработка соединения согласно его текущего этапа жизненного цикла
+ * После обработки таймер соединения устанавливается согласно новому этапу
+ */
+result_e
+connectionEngine(connection_s * con){
+	result_e result = _connectionEngine(con);
+	connectionTimerUpdate(con);
+	return result;
 }//END: connectionEngine
 
 
@@ -862,6 +1166,45 @@ connectionHandleReadSSL(connection_s * con){
 
 
 
+/*
+ * Разбор полученной части тела multipart/form-data
+ * Обработанные данные удаляются из буфера запроса, необработанный остаток сдвигается к началу тела
+ */
+static result_e
+_connectionMultipartBody(connection_s * con){
+	request_parser_s * parser = &(con->request.parser);
+	multipart_parser_s * mp = con->request.multipart;
+	buffer_s * buf = con->request.data;
+	uint32_t rest = con->request.content_length - mp->body_read;
+	uint32_t len = min(buf->count - parser->body_n, rest);
+	int n;
+
+	//Ошибка разбора: код HTTP ошибки установлен в multipartParse
+	if((n = multipartParse(con, &buf->buffer[parser->body_n], len, (len == rest))) < 0){
+		connectionSetStage(con, CON_STAGE_WORKING);
+		return RESULT_COMPLETE;
+	}
+
+	if(n > 0){
+		mp->body_read += (uint32_t)n;
+		memmove(&buf->buffer[parser->body_n], &buf->buffer[parser->body_n + n], buf->count - parser->body_n - n);
+		buf->count	-= (uint32_t)n;
+		buf->index	= buf->count;
+		buf->buffer[buf->count] = '\0';
+	}
+
+	if(mp->body_read < con->request.content_length) return RESULT_OK;
+
+	//Тело получено и разобрано полностью, данные после него - начало следующего запроса
+	parser->body_len = 0;
+	con->keep_alive = connectionKeepAliveAllowed(con);
+	connectionPipelineDetach(con, parser->body_n);
+	connectionSetStage(con, CON_STAGE_WORKING);
+	return RESULT_COMPLETE;
+}//END: _connectionMultipartBody
+
+
+
 /*
  * Парсинг и обработка данных запроса
  */
@@ -869,6 +1212,7 @@ result_e
 connectionPrepareRequest(connection_s * con){
 	request_parser_s * parser = &(con->request.parser);
 	buffer_s * buf = con->request.data;
+	request_line_s scan;
 	const char * line;
 	const char * ptr;
 	int code;
@@ -878,12 +1222,10 @@ connectionPrepareRequest(connection_s * con){
 
 		//Присваиваем ptr позицию от начала строки заголовка
 		line = &buf->buffer[parser->line_n];
-		//Просматриваем доступные строки
-		while((ptr = strchr(line, '\n')) != NULL){
-			parser->line_len = ptr - line;
-			if(*(ptr-1)=='\r') parser->line_len--;
-
-			ptr++;	//Пропускаем [\n]
+		//Просматриваем доступные строки: за один проход по строке определяются ее конец,
+		//позиции разделителей и недопустимые символы, ptr - начало следующей строки
+		while((ptr = scanRequestLine(line, buf->count - (line - buf->buffer), &scan)) != NULL){
+			parser->line_len = scan.len;
 
 			//Найдена пустая строка - конец заголовков
 			if(parser->line_len == 0){
@@ -893,9 +1235,14 @@ connectionPrepareRequest(connection_s * con){
 				if((code = requestHeadersToVariables(con)) != 0){
 					con->http_code = code;
 				}else{
-					//Если POST запрос и размер контента больше 0 - увеличиваем размер буфера на content_length
+					//Если POST запрос и размер контента больше 0 - увеличиваем размер буфера на content_length,
+					//тело multipart/form-data разбирается по мере получения и в буфере целиком не хранится
 					if(con->request.request_method == HTTP_POST && con->request.content_length > 0 && con->http_code == 200){
-						bufferIncrease(buf, con->request.content_length);
+						if(con->request.post_method == POST_MULTIPART){
+							multipartInit(con);
+						}else{
+							bufferIncrease(buf, con->request.content_length);
+						}
 					}
 				}
 				break;
@@ -904,7 +1251,7 @@ connectionPrepareRequest(connection_s * con){
 			//Обработка первой строки запроса
 			if(parser->line_no == 0){
 				//Если первая строка запроса обработана с ошибкой - дальнейший парсинг не имеет смысла
-				if((code = requestParseFirstLine(con, line, parser->line_len)) != 0){
+				if((code = requestParseFirstLine(con, line, &scan)) != 0){
 					con->http_code = code;
 					break;
 				}
@@ -938,9 +1285,7 @@ connectionPrepareRequest(connection_s * con){
 			}
 			//Обработка строки заголовка
 			else{
-				//Если это первый заголовок, инициализируем список заголовков
-				if(!con->request.headers) con->request.headers = kvNewRoot();
-				if((code = requestParseHeaderLine(con, line, parser->line_len)) != 0){
+				if((code = requestParseHeaderLine(con, line, &scan)) != 0){
 					con->http_code = code;
 					break;
 				}
@@ -968,26 +1313,31 @@ connectionPrepareRequest(connection_s * con){
 
 		#if 0
 		buffer_s * buf = bufferCreate(0);
-		kvEchoHeaders(buf, con->request.headers);
+		kvEchoHeaders(buf, requestGetHeaders(con));
 		bufferPrint(buf);
 		bufferFree(buf);
 		#endif
 
 		//Если не POST запрос или при обработке заголовков возникла ошибка
 		if(con->request.request_method != HTTP_POST || con->http_code != 200){
+			if(con->http_code == 200){
+				con->keep_alive = connectionKeepAliveAllowed(con);
+				//Данные после заголовков - начало следующего запроса
+				connectionPipelineDetach(con, parser->body_n);
+			}
 			connectionSetStage(con, CON_STAGE_WORKING);
 			return RESULT_COMPLETE;
 		}
 
-		//Получено нужное количество байт контента
-		if((parser->body_len = buf->count - parser->body_n) == con->request.content_length){
-			connectionSetStage(con, CON_STAGE_WORKING);
-			return RESULT_COMPLETE;
-		}
+		//multipart/form-data
+		if(con->request.multipart) return _connectionMultipartBody(con);
 
-		//Размер полученных данных больше, чем указано в Content-Length
-		if(parser->body_len > con->request.content_length){
-			con->http_code = 413;	//413 Request Entity Too Large
+		//Получено нужное количество байт контента,
+		//данные сверх Content-Length - начало следующего запроса
+		if((parser->body_len = buf->count - parser->body_n) >= con->request.content_length){
+			parser->body_len = con->request.content_length;
+			con->keep_alive = connectionKeepAliveAllowed(con);
+			connectionPipelineDetach(con, parser->body_n + con->request.content_length);
 			connectionSetStage(con, CON_STAGE_WORKING);
 			return RESULT_COMPLETE;
 		}
@@ -1012,11 +1362,22 @@ connectionHandleWrite(connection_s * con){
 	result_e result;
 	const char * ptr = NULL;
 	uint32_t	len = 0;
+	struct iovec iov[CHUNKQUEUE_IOVEC_MAX];
+	int iovcnt;
+	bool from_file;
 
 	do{
-		result = chunkqueueRead(con->response.content, &ptr, &len);
-		if(result != RESULT_OK) return result;
-		n = write(con->fd, ptr, len);
+		from_file = false;
+		//Идущие подряд части контента из памяти (заголовки и тело ответа) отправляются одним вызовом writev()
+		if((iovcnt = chunkqueueReadVector(con->response.content, iov, CHUNKQUEUE_IOVEC_MAX, UINT32_MAX, &len)) > 1){
+			n = writev(con->fd, iov, iovcnt);
+		}else{
+			result = chunkqueueRead(con->response.content, &ptr, &len);
+			if(result != RESULT_OK) return result;
+			//Часть контента из файла (ptr == NULL) отправляется через sendfile()
+			from_file = (ptr == NULL);
+			n = (ptr ? write(con->fd, ptr, len) : chunkqueueSendFile(con->response.content, con->fd, len));
+		}
 		if(n > 0) chunkqueueCommit(con->response.content, n);
 	}while(n > 0);
 
@@ -1037,6 +1398,9 @@ connectionHandleWrite(connection_s * con){
 	}
 	else
 	if (n == 0){
+		//Файл стал короче, чем при формировании ответа: клиент получит меньше данных, чем указано в Content-Length,
+		//поэтому соединение закрывается, а не считается успешно отправленным
+		if(from_file) RETURN_ERROR(RESULT_ERROR, "sendfile() returned 0: file is shorter than the response");
 		return RESULT_EOF;
 	}
 
@@ -1056,11 +1420,15 @@ connectionHandleWriteSSL(connection_s * con){
 	result_e result;
 	const char * ptr = NULL;
 	uint32_t	len = 0;
+	bool from_file;
 
 	do{
-		result = chunkqueueRead(con->response.content, &ptr, &len);
+		//Небольшие части контента из памяти объединяются в одну SSL запись
+		result = chunkqueueReadCoalesced(con->response.content, &ptr, &len, chunkqueue_ssl_record_size);
 		if(result != RESULT_OK) return result;
-		n = SSL_write(con->ssl, ptr, len);
+		//Часть контента из файла (ptr == NULL) при kTLS отправляется через SSL_sendfile()
+		from_file = (ptr == NULL);
+		n = (ptr ? SSL_write(con->ssl, ptr, len) : (int)chunkqueueSendFileSSL(con->response.content, con->ssl, len));
 		if(n > 0) chunkqueueCommit(con->response.content, n);
 	}while(n > 0);
 
@@ -1090,6 +1458,8 @@ connectionHandleWriteSSL(connection_s * con){
 				return RESULT_ERROR;
 		}
 	} else if (n == 0){
+		//Файл стал короче, чем при формировании ответа (см. connectionHandleWrite)
+		if(from_file) RETURN_ERROR(RESULT_ERROR, "SSL_sendfile() returned 0: file is shorter than the response");
 		return RESULT_EOF;
 	}
 
@@ -358,6 +358,8 @@ inline void *	mRealloc(void * ptr, size_t size);	//Изменение разме
 inline void *	mResize(void * ptr, size_t size);	//Изменение размера блока памяти realloc
 inline void		mFree(void * ptr);	//Освобождение блока памяти free
 inline void		mFreeAndNull(void ** ptr);	//Освобождение блока памяти free, установка ptr в NULL и возврат ptr
+void *			mNewAlignedZ(size_t alignment, size_t size);	//Выделение выровненного блока памяти posix_memalign c обнулением
+void			mFreeAligned(void * ptr);	//Освобождение блока памяти, выделенного mNewAlignedZ()
 
 inline string_s *	mStringNew(void);	//Создание новой структуры string_s
 inline string_s * 	mStringClear(string_s * str);	//Очистка структуры string_s
@@ -428,6 +430,8 @@ void		sleepMilliseconds(uint32_t usec);	//Усыпляет процесс / по
 void		sleepMicroseconds(uint32_t msec);	//Усыпляет процесс / поток на usec количество микросекунд
 string_s *	datetimeFormat(time_t ts, const char * format);	//Возвращает строку, содержащую дату и время согласно заданного формата
 uint32_t	nowNanoseconds(void);	//Функция возвращает текущее значение наносекунд
+uint64_t	nowMilliseconds(void);	//Функция возвращает текущее Unix время в миллисекундах
+uint64_t	nowMonotonicMilliseconds(void);	//Функция возвращает текущее монотонное время в миллисекундах
 
 
 /*Преобразования чисел и строк*/
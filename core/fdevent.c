@@ -12,14 +12,19 @@
 
 static fd_s * _fds_idle_list = NULL;
 
+//Мьютекс синхронизации в момент обращения к IDLE списку (список общий для всех реакторов)
+static pthread_mutex_t fds_idle_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 /*
  * Добавляет новый/существующмй элемент в IDLE список
  */
 static void
 _fdsToIdle(fd_s * item){
 	if(!item) item = (fd_s *)mNew(sizeof(fd_s));
-	item->next = _fds_idle_list;
-	_fds_idle_list = item;
+	pthread_mutex_lock(&fds_idle_mutex);
+		item->next = _fds_idle_list;
+		_fds_idle_list = item;
+	pthread_mutex_unlock(&fds_idle_mutex);
 }//END: _fdsToIdle
 
 
@@ -30,9 +35,13 @@ _fdsToIdle(fd_s * item){
 static fd_s *
 _fdsFromIdle(void){
 	fd_s * item = NULL;
-	if(_fds_idle_list){
-		item = _fds_idle_list;
-		_fds_idle_list = item->next;
+	pthread_mutex_lock(&fds_idle_mutex);
+		if(_fds_idle_list){
+			item = _fds_idle_list;
+			_fds_idle_list = item->next;
+		}
+	pthread_mutex_unlock(&fds_idle_mutex);
+	if(item){
 		memset(item,'\0',sizeof(fd_s));
 	}else{
 		item = (fd_s *)mNewZ(sizeof(fd_s));
@@ -42,6 +51,25 @@ _fdsFromIdle(void){
 
 
 
+/*
+ * Увеличивает массив дескрипторов fds так, чтобы в нем поместился дескриптор fd
+ * Размер массива удваивается, но не превышает лимита дескрипторов сервера
+ */
+static bool
+_fdeventGrow(fdevent_s * ev, socket_t fd){
+	uint32_t size = ev->fds_size;
+	if((uint32_t)fd < size) return true;
+	if((uint32_t)fd >= ev->server->config.max_fds) return false;
+	while(size <= (uint32_t)fd) size *= 2;
+	size = min(size, ev->server->config.max_fds);
+	ev->fds = (fd_s **)mResize(ev->fds, size * sizeof(fd_s *));
+	memset(&ev->fds[ev->fds_size], '\0', (size - ev->fds_size) * sizeof(fd_s *));
+	ev->fds_size = size;
+	return true;
+}//END: _fdeventGrow
+
+
+
 /***********************************************************************
  * Функции
  **********************************************************************/ 
@@ -73,20 +101,24 @@ fdFree(fd_s *fdn){
  * Создание структуры FD events
  */
 fdevent_s *
-fdeventNew(server_s * srv){
-	srv->fdevent = mNewZ(sizeof(fdevent_s));
-	srv->fdevent->server = srv;
-	srv->fdevent->fds = mNewZ(server_max_fds * sizeof(fd_s *));
+fdeventNew(reactor_s * reactor){
+	fdevent_s * ev = mNewZ(sizeof(fdevent_s));
+	reactor->fdevent = ev;
+	ev->server = reactor->server;
+	ev->reactor = reactor;
+	ev->fds_size = max(1, min(server_fds_initial_size, reactor->server->config.max_fds));
+	ev->fds = mNewZ(ev->fds_size * sizeof(fd_s *));
 #ifdef USE_EPOLL
-	if( (srv->fdevent->epoll_fd = epoll_create(server_max_fds)) == -1) FATAL_ERROR("epoll_create failed: %s",  strerror(errno));
-	srv->fdevent->epollfds = malloc(server_max_fds * sizeof(struct epoll_event));
+	if( (ev->epoll_fd = epoll_create(ev->fds_size)) == -1) FATAL_ERROR("epoll_create failed: %s",  strerror(errno));
+	ev->epollfds = mNew(server_epoll_events * sizeof(struct epoll_event));
 #endif
 #ifdef USE_POLL
-	srv->fdevent->pollfds = mNewZ(server_max_fds * sizeof(struct pollfd));
+	ev->pollfds_size = ev->fds_size;
+	ev->pollfds = mNewZ(ev->pollfds_size * sizeof(struct pollfd));
 #endif
 	int i;
-	for(i=0;i<server_max_fds;i++) _fdsToIdle(NULL);
-	return srv->fdevent;
+	for(i=0;i<ev->fds_size;i++) _fdsToIdle(NULL);
+	return ev;
 }//END: fdeventNew
 
 
@@ -98,7 +130,7 @@ void
 fdeventFree(fdevent_s * ev){
 	if (!ev) return;
 	size_t i;
-	for (i = 0; i < server_max_fds; i++) {
+	for (i = 0; i < ev->fds_size; i++) {
 		if (ev->fds[i]) fdFree(ev->fds[i]);
 	}
 	mFree(ev->fds);
@@ -120,7 +152,7 @@ fdeventFree(fdevent_s * ev){
 bool 
 fdeventAdd(fdevent_s * ev, socket_t fd, fdevent_handler handler, void * data){
 	if(fd < 0) return false;
-	if(server_max_fds < fd) return false;
+	if(!_fdeventGrow(ev, fd)) RETURN_ERROR(false, "fdeventAdd false: fd=[%d] exceeds max_fds=[%u]", fd, ev->server->config.max_fds);
 	fd_s * fdn 			= fdNew();
 	fdn->handler		= handler;
 	fdn->fd				= fd;
@@ -138,7 +170,7 @@ fdeventAdd(fdevent_s * ev, socket_t fd, fdevent_handler handler, void * data){
  */
 bool
 fdeventRemove(fdevent_s * ev, socket_t fd) {
-	if (!ev) return false;
+	if (!ev || fd < 0 || (uint32_t)fd >= ev->fds_size) return false;
 	fd_s * fdn = ev->fds[fd];
 	ev->fds[fd] = NULL;
 	fdFree(fdn);
@@ -154,7 +186,7 @@ fdeventRemove(fdevent_s * ev, socket_t fd) {
 int 
 fdeventPoll(fdevent_s * ev, int timeout_ms){
 #ifdef USE_EPOLL
-	return epoll_wait(ev->epoll_fd, ev->epollfds, server_max_fds, timeout_ms);
+	return epoll_wait(ev->epoll_fd, ev->epollfds, server_epoll_events, timeout_ms);
 #endif
 #ifdef USE_POLL
 	return poll(ev->pollfds, ev->pollfds_count, timeout_ms);
@@ -171,8 +203,8 @@ fdeventPoll(fdevent_s * ev, int timeout_ms){
  */
 bool
 fdEventSet(fdevent_s * ev, socket_t fd, int events){
-	if(fd < 0) RETURN_ERROR(false, "fdEventSet false: FD < 0, fd=[%d], max_fd=[%u]", fd, server_max_fds);
-	if(!ev->fds[fd]) RETURN_ERROR(false, "fdEventSet false: FD not exists, fd=[%d], max_fd=[%u]", fd, server_max_fds);
+	if(fd < 0) RETURN_ERROR(false, "fdEventSet false: FD < 0, fd=[%d], fds_size=[%u]", fd, ev->fds_size);
+	if((uint32_t)fd >= ev->fds_size || !ev->fds[fd]) RETURN_ERROR(false, "fdEventSet false: FD not exists, fd=[%d], fds_size=[%u]", fd, ev->fds_size);
 	ev->fds[fd]->events = events;
 	int poll_index = ev->fds[fd]->poll_index;
 
@@ -184,7 +216,7 @@ fdEventSet(fdevent_s * ev, socket_t fd, int events){
 
 	if(poll_index != -1){
 		//Указанный индекс больше размера массива
-		if(poll_index >= server_max_fds) RETURN_ERROR(false, "fdEventSet false: poll_index [%d] > server_max_fds [%u]", poll_index, server_max_fds);
+		if(poll_index >= ev->fds_size) RETURN_ERROR(false, "fdEventSet false: poll_index [%d] > fds_size [%u]", poll_index, ev->fds_size);
 		if(epoll_ctl(ev->epoll_fd, EPOLL_CTL_MOD, fd, &ep) != 0) RETURN_ERROR(false, "epoll_ctl set failed: %s", strerror(errno));
 		return true;
 	}
@@ -206,6 +238,13 @@ fdEventSet(fdevent_s * ev, socket_t fd, int events){
 		RETURN_ERROR(false, "fdEventSet false: POLL not exists, fd=[%d], poll_index=[%d]", fd, poll_index);
 	}
 
+	//Массив pollfds заполнен - увеличиваем
+	if(ev->pollfds_count >= ev->pollfds_size){
+		ev->pollfds_size *= 2;
+		ev->pollfds = (struct pollfd *)mResize(ev->pollfds, ev->pollfds_size * sizeof(struct pollfd));
+		memset(&ev->pollfds[ev->pollfds_count], '\0', (ev->pollfds_size - ev->pollfds_count) * sizeof(struct pollfd));
+	}
+
 	ev->pollfds[ev->pollfds_count].fd = fd;
 	ev->pollfds[ev->pollfds_count].events = events;
 	ev->fds[fd]->poll_index = ev->pollfds_count++;
@@ -222,8 +261,8 @@ fdEventSet(fdevent_s * ev, socket_t fd, int events){
  */
 bool
 fdEventDelete(fdevent_s * ev, socket_t fd){
-	if(fd < 0) RETURN_ERROR(false, "fdEventDelete false: FD < 0, fd=[%d], max_fd=[%u]", fd, server_max_fds);
-	if(!ev->fds[fd]) RETURN_ERROR(false, "fdEventDelete false: FD not exists, fd=[%d], max_fd=[%u]", fd, server_max_fds);
+	if(fd < 0) RETURN_ERROR(false, "fdEventDelete false: FD < 0, fd=[%d], fds_size=[%u]", fd, ev->fds_size);
+	if((uint32_t)fd >= ev->fds_size || !ev->fds[fd]) RETURN_ERROR(false, "fdEventDelete false: FD not exists, fd=[%d], fds_size=[%u]", fd, ev->fds_size);
 	ev->fds[fd]->events = 0;
 	int poll_index = ev->fds[fd]->poll_index;
 	ev->fds[fd]->poll_index = -1;
@@ -231,7 +270,7 @@ fdEventDelete(fdevent_s * ev, socket_t fd){
 #ifdef USE_EPOLL
 	//poll_index задан
 	if(poll_index != -1){
-		if(poll_index >= server_max_fds) RETURN_ERROR(false, "fdEventDelete false: poll_index [%d] > server_max_fds [%u]", poll_index, server_max_fds);
+		if(poll_index >= ev->fds_size) RETURN_ERROR(false, "fdEventDelete false: poll_index [%d] > fds_size [%u]", poll_index, ev->fds_size);
 		struct epoll_event ep;
 		memset(&ep, '\0', sizeof(ep));
 		ep.data.fd = fd;
@@ -256,7 +295,7 @@ fdEventDelete(fdevent_s * ev, socket_t fd){
 				ev->pollfds[poll_index].fd		= tmp_fd;
 				ev->pollfds[poll_index].events	= tmp_events;
 				//Не забываем изменить ссылку перемещенного элемента poll_index на новое значение
-				if(ev->fds[tmp_fd]!=NULL) ev->fds[tmp_fd]->poll_index = poll_index;
+				if(tmp_fd >= 0 && (uint32_t)tmp_fd < ev->fds_size && ev->fds[tmp_fd]!=NULL) ev->fds[tmp_fd]->poll_index = poll_index;
 			}
 			//Обнуление последнего элемента, уменьшение количества прослушиваемых сокетов на 1
 			ev->pollfds[ev->pollfds_count-1].fd = -1;
@@ -283,7 +322,7 @@ fdEventGetFd(fdevent_s * ev, size_t poll_index){
 #ifdef USE_EPOLL
 	return poll_index;
 	/*
-	if(poll_index >= server_max_fds) return -1;
+	if(poll_index >= ev->fds_size) return -1;
 	return ev->pollfds[poll_index].data.fd;
 	*/
 #endif
@@ -252,6 +252,17 @@ jobinternalThreadCreate(void){
 
 
 
+/*
+ * Закрепление потока внутренних заданий за процессорами
+ * Поток создается до загрузки конфигурации, поэтому привязка выполняется из основного потока
+ */
+void
+jobinternalThreadAffinity(void){
+	affinityApply(AFFINITY_INTERNAL, 0, jobinternal_thread_id);
+}//END: jobinternalThreadAffinity
+
+
+
 /*
  * Завершение рабочего потока сервера
  */
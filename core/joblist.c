@@ -11,88 +11,489 @@
 #include "server.h"
 #include "globals.h"
 
-//Мьютекс синхронизации в момент изменения состояния рабочего статуса соединения
-static pthread_mutex_t job_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 
 /***********************************************************************
- * Работа со списком заданий для рабочих потоков
- * Основной поток направляет соединения рабочим потокам
+ * Кольцевой буфер заданий
+ * Ограниченная lock-free очередь MPMC (алгоритм Д. Вьюкова): каждая ячейка хранит порядковый номер,
+ * по которому производитель и потребитель определяют, свободна ли ячейка для записи или готова для чтения.
+ * Задания не удаляются из очереди: при удалении соединения увеличивается con->job_gen,
+ * и задания с устаревшим поколением пропускаются при извлечении.
+ *
+ * Список заданий состоит из сегментов - кольцевых буферов: список создается с одним небольшим сегментом,
+ * при заполнении последнего сегмента под блокировкой добавляется сегмент двойного размера.
+ * Задания добавляются в последний сегмент, а извлекаются начиная с первого непустого сегмента,
+ * поэтому порядок заданий сохраняется. Сегменты освобождаются вместе со списком: память ячеек
+ * выделяется только при росте нагрузки и не зависит от лимита дескрипторов.
  **********************************************************************/ 
 
 
+/*
+ * Создание сегмента вместимостью size элементов (степень двойки)
+ */
+static jobring_s *
+_jobringNew(size_t size){
+	size_t i;
+	jobring_s * ring	= (jobring_s *)mNewAlignedZ(XG_CACHE_LINE, sizeof(jobring_s));
+	ring->items			= (jobitem_s *)mNew(size * sizeof(jobitem_s));
+	ring->mask			= size - 1;
+	for(i = 0; i < size; i++) ring->items[i].sequence = i;
+	return ring;
+}//END: _jobringNew
+
+
 
 /*
- * Добавляет новый/существующмй элемент в IDLE список
+ * Уничтожение сегмента
  */
 static void
-_joblistItemToIdle(joblist_s * list, jobitem_s * item){
-	if(!item) item = (jobitem_s *)mNew(sizeof(jobitem_s));
-	item->next = list->idle;
-	list->idle = item;
-}//END: _joblistItemToIdle
+_jobringDestroy(jobring_s * ring){
+	if(!ring) return;
+	mFree(ring->items);
+	mFreeAligned(ring);
+}//END: _jobringDestroy
 
 
 
 /*
- * Получает элемент из IDLE списка или создает новый, если IDLE список пуст
+ * Добавление задания в сегмент
+ * Возвращает false, если сегмент заполнен
  */
-static jobitem_s *
-_joblistItemFromIdle(joblist_s * list){
+static bool
+_jobringPush(joblist_s * list, jobring_s * ring, connection_s * con, uint32_t generation){
 	jobitem_s * item;
-	if(list->idle){
-		item = list->idle;
-		list->idle = item->next;
-	}else{
-		item = (jobitem_s *)mNew(sizeof(jobitem_s));
+	size_t pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+	size_t seq;
+	intptr_t dif;
+
+	for(;;){
+		item	= &ring->items[pos & ring->mask];
+		seq		= __atomic_load_n(&item->sequence, __ATOMIC_ACQUIRE);
+		dif		= (intptr_t)seq - (intptr_t)pos;
+		if(dif == 0){
+			if(__atomic_compare_exchange_n(&ring->enqueue_pos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+			__atomic_add_fetch(&list->stat_push_retries, 1, __ATOMIC_RELAXED);
+		}
+		else if(dif < 0){
+			return false;
+		}
+		else{
+			pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&list->stat_push_retries, 1, __ATOMIC_RELAXED);
+		}
 	}
-	return item;
-}//END: _joblistItemFromIdle
+
+	item->connection	= con;
+	item->generation	= generation;
+	__atomic_store_n(&item->sequence, pos + 1, __ATOMIC_RELEASE);
+	return true;
+}//END: _jobringPush
 
 
 
 /*
- * Создание списка рабочих заданий
+ * Извлечение задания из сегмента
+ * Возвращает false, если сегмент пуст
  */
-result_e
-joblistCreate(server_s * srv){
-	joblist_s * joblist 	= (joblist_s *)mNewZ(sizeof(joblist_s));
-	if(srv) srv->joblist	= joblist;
-	joblist->server 		= srv;
-	int i;
-	for(i=0;i<server_joblist_size; i++) _joblistItemToIdle(joblist, NULL);
-	return RESULT_OK;
+static bool
+_jobringPop(joblist_s * list, jobring_s * ring, connection_s ** pcon, uint32_t * pgeneration){
+	jobitem_s * item;
+	size_t pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+	size_t seq;
+	intptr_t dif;
+
+	for(;;){
+		item	= &ring->items[pos & ring->mask];
+		seq		= __atomic_load_n(&item->sequence, __ATOMIC_ACQUIRE);
+		dif		= (intptr_t)seq - (intptr_t)(pos + 1);
+		if(dif == 0){
+			if(__atomic_compare_exchange_n(&ring->dequeue_pos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+			__atomic_add_fetch(&list->stat_pop_retries, 1, __ATOMIC_RELAXED);
+		}
+		else if(dif < 0){
+			return false;
+		}
+		else{
+			pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&list->stat_pop_retries, 1, __ATOMIC_RELAXED);
+		}
+	}
+
+	*pcon			= item->connection;
+	*pgeneration	= item->generation;
+	__atomic_store_n(&item->sequence, pos + ring->mask + 1, __ATOMIC_RELEASE);
+	return true;
+}//END: _jobringPop
+
+
+
+/*
+ * Возвращает количество заданий в сегменте (проверка без блокировок, результат является подсказкой)
+ */
+static inline size_t
+_jobringLength(jobring_s * ring){
+	size_t dequeue_pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_ACQUIRE);
+	size_t enqueue_pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_ACQUIRE);
+	return (enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0);
+}//END: _jobringLength
+
+
+
+/*
+ * Создание списка заданий с начальной вместимостью не менее capacity элементов
+ */
+static joblist_s *
+_joblistNew(server_s * srv, size_t capacity){
+	size_t size = server_joblist_min_size;
+	while(size < capacity && size < server_joblist_max_size) size <<= 1;
+
+	joblist_s * list	= (joblist_s *)mNewAlignedZ(XG_CACHE_LINE, sizeof(joblist_s));
+	list->server		= srv;
+	list->segments[0]	= _jobringNew(size);
+	list->segments_count= 1;
+	list->capacity		= size;
+	pthread_mutex_init(&list->grow_mutex, NULL);
+	return list;
+}//END: _joblistNew
+
+
+
+/*
+ * Добавление сегмента двойного размера, если последним сегментом списка все еще является tail
+ * Возвращает false, если достигнуто максимальное количество сегментов
+ */
+static bool
+_joblistGrow(joblist_s * list, jobring_s * tail){
+	size_t count, size;
+	bool result = true;
+
+	pthread_mutex_lock(&list->grow_mutex);
+		count = __atomic_load_n(&list->segments_count, __ATOMIC_ACQUIRE);
+		if(list->segments[count - 1] == tail){
+			if(count < XG_JOBLIST_SEGMENTS){
+				size = min(server_joblist_max_size, (tail->mask + 1) << 1);
+				list->segments[count] = _jobringNew(size);
+				__atomic_add_fetch(&list->capacity, size, __ATOMIC_RELAXED);
+				__atomic_store_n(&list->segments_count, count + 1, __ATOMIC_RELEASE);
+			}else{
+				result = false;
+			}
+		}
+	pthread_mutex_unlock(&list->grow_mutex);
+
+	return result;
+}//END: _joblistGrow
+
+
+
+/*
+ * Добавление задания в список, при заполнении последнего сегмента список увеличивается
+ * Возвращает false, если список заполнен и не может быть увеличен
+ */
+static bool
+_joblistPush(joblist_s * list, connection_s * con, uint32_t generation){
+	jobring_s * tail;
+	for(;;){
+		tail = list->segments[__atomic_load_n(&list->segments_count, __ATOMIC_ACQUIRE) - 1];
+		if(_jobringPush(list, tail, con, generation)) return true;
+		if(!_joblistGrow(list, tail)) return false;
+	}
+}//END: _joblistPush
+
+
+
+/*
+ * Извлечение задания из списка: сегменты просматриваются от первого к последнему
+ * Возвращает false, если список пуст
+ */
+static bool
+_joblistPop(joblist_s * list, connection_s ** pcon, uint32_t * pgeneration){
+	size_t count = __atomic_load_n(&list->segments_count, __ATOMIC_ACQUIRE);
+	size_t i;
+	for(i = 0; i < count; i++){
+		if(_jobringPop(list, list->segments[i], pcon, pgeneration)) return true;
+	}
+	return false;
+}//END: _joblistPop
+
+
+
+/*
+ * Добавление задания в список с ожиданием освобождения места, если список заполнен и не может быть увеличен
+ */
+static void
+_joblistPushWait(joblist_s * list, connection_s * con, uint32_t generation){
+	if(_joblistPush(list, con, generation)) return;
+	__atomic_add_fetch(&list->stat_full_waits, 1, __ATOMIC_RELAXED);
+	while(!_joblistPush(list, con, generation)) sched_yield();
+}//END: _joblistPushWait
+
+
+
+/*
+ * Уничтожение списка заданий
+ */
+static void
+_joblistDestroy(joblist_s * list){
+	size_t i;
+	if(!list) return;
+	for(i = 0; i < list->segments_count; i++) _jobringDestroy(list->segments[i]);
+	pthread_mutex_destroy(&list->grow_mutex);
+	mFreeAligned(list);
+}//END: _joblistDestroy
+
+
+
+/*
+ * Возвращает true, если в списке нет заданий (проверка без блокировок, результат является подсказкой)
+ */
+bool
+joblistIsEmpty(joblist_s * list){
+	return joblistLength(list) == 0;
+}//END: joblistIsEmpty
+
+
+
+/*
+ * Возвращает количество заданий в списке (проверка без блокировок, результат является подсказкой)
+ */
+size_t
+joblistLength(joblist_s * list){
+	size_t count = __atomic_load_n(&list->segments_count, __ATOMIC_ACQUIRE);
+	size_t length = 0, i;
+	for(i = 0; i < count; i++) length += _jobringLength(list->segments[i]);
+	return length;
+}//END: joblistLength
+
+
+
+/*
+ * Вывод на экран счетчиков конкуренции кольцевого буфера заданий
+ */
+void
+joblistPrintStats(joblist_s * list, const char * name){
+	if(!list) return;
+	printf("%s: size=%zu (segments: %zu), queued=%zu, push retries=%" PRIu64 ", pop retries=%" PRIu64 ", full waits=%" PRIu64 ", stale skipped=%" PRIu64 ", stolen=%" PRIu64 ", expired=%" PRIu64 ", disconnected=%" PRIu64 "\n",
+		name,
+		__atomic_load_n(&list->capacity, __ATOMIC_RELAXED),
+		__atomic_load_n(&list->segments_count, __ATOMIC_ACQUIRE),
+		joblistLength(list),
+		__atomic_load_n(&list->stat_push_retries, __ATOMIC_RELAXED),
+		__atomic_load_n(&list->stat_pop_retries, __ATOMIC_RELAXED),
+		__atomic_load_n(&list->stat_full_waits, __ATOMIC_RELAXED),
+		__atomic_load_n(&list->stat_stale, __ATOMIC_RELAXED),
+		__atomic_load_n(&list->stat_stolen, __ATOMIC_RELAXED),
+		__atomic_load_n(&list->stat_expired, __ATOMIC_RELAXED),
+		__atomic_load_n(&list->stat_disconnected, __ATOMIC_RELAXED)
+	);
+}//END: joblistPrintStats
+
+
+
+/***********************************************************************
+ * Работа со списками заданий для рабочих потоков
+ * У каждого рабочего потока свои очереди заданий (по одной на класс заданий job_class_e):
+ * основной поток направляет соединение в очередь потока, выбранного по ID соединения,
+ * поэтому все стадии обработки соединения выполняются одним потоком.
+ * Поток выбирает задания из своих очередей пропорционально весам классов (smooth weighted round-robin),
+ * поэтому чтение запросов и отправка ответов не ждут завершения тяжелых обработчиков.
+ * Простаивающий поток забирает задания из очередей других потоков,
+ * если в них накопилось не менее worker_steal_backlog заданий.
+ * Задания чтения и обработки запроса имеют срок выполнения (con->job_deadline_ms): если к моменту
+ * извлечения задания срок истек или клиент закрыл соединение, запрос не обрабатывается,
+ * а соединение возвращается реактору для закрытия.
+ **********************************************************************/ 
+
+
+/*
+ * Создание очереди заданий рабочего потока с начальной вместимостью не менее capacity элементов
+ */
+joblist_s *
+joblistCreate(server_s * srv, size_t capacity){
+	return _joblistNew(srv, capacity);
 }//END: joblistCreate
 
 
 
 /*
- * Уничтожение списка рабочих заданий
+ * Уничтожение очереди заданий рабочего потока
  */
 result_e
 joblistFree(joblist_s * list){
-	jobitem_s * item;
-	jobitem_s * next;
+	_joblistDestroy(list);
+	return RESULT_OK;
+}//END: joblistFree
+
 
-	next = list->first;
-	while(next){
-		item = next;
-		next = item->next;
-		mFree(item);
+
+/*
+ * Проверяет состояние сокета соединения, ожидающего обработки запроса
+ * Возвращает true, если клиент сбросил соединение и ответ уже некому отправить.
+ * Если клиент лишь закрыл свою сторону соединения (half-close), запрос обрабатывается,
+ * но соединение не сохраняется после отправки ответа
+ */
+static inline bool
+_jobDisconnected(connection_s * con){
+	char c;
+	switch(socketReadPeek(con->fd, &c, 1, NULL)){
+		case RESULT_CONRESET:	return true;
+		case RESULT_EOF:
+			con->keep_alive			= false;
+			con->request.keep_alive	= false;
+			return false;
+		default:				return false;
 	}
+}//END: _jobDisconnected
+
+
+
+/*
+ * Извлекает из очереди первое актуальное задание и переводит соединение в рабочую стадию
+ * Если срок выполнения задания истек или клиент сбросил соединение - соединение переводится
+ * в стадию закрытия и возвращается без обработки (рабочий поток передает его реактору)
+ */
+static connection_s *
+_jobPop(joblist_s * joblist, uint64_t now_ms){
+	connection_s * con;
+	uint32_t generation;
+
+	while(_joblistPop(joblist, &con, &generation)){
 
-	next = list->idle;
-	while(next){
-		item = next;
-		next = item->next;
-		mFree(item);
+		//Задание устарело: соединение было удалено из очереди (jobDelete) или повторно добавлено
+		if(generation != __atomic_load_n(&con->job_gen, __ATOMIC_SEQ_CST)){
+			__atomic_add_fetch(&joblist->stat_stale, 1, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		//Если текущее соединение не используется или его обработка завершена или 
+		//не удается задать стадию соединения как рабочую - игнорируем соединение
+		if(
+			con->stage == CON_STAGE_NONE ||
+			con->stage >= CON_STAGE_COMPLETE || 
+			connectionSetJobStage(con, JOB_STAGE_WORKING, false) != JOB_STAGE_WORKING
+		){
+			continue;
+		}
+
+		//Срок выполнения задания истек: клиент уже не ждет ответа
+		if(con->job_deadline_ms && now_ms >= con->job_deadline_ms){
+			con->connection_error = CON_ERROR_TIMEOUT;
+			connectionSetStage(con, CON_STAGE_CLOSE);
+			__atomic_add_fetch(&joblist->stat_expired, 1, __ATOMIC_RELAXED);
+		}
+		//Клиент сбросил соединение, пока запрос ожидал обработки
+		else if(con->stage == CON_STAGE_WORKING && _jobDisconnected(con)){
+			con->connection_error = CON_ERROR_DISCONNECT;
+			connectionSetStage(con, CON_STAGE_CLOSE);
+			__atomic_add_fetch(&joblist->stat_disconnected, 1, __ATOMIC_RELAXED);
+		}
+
+		return con;
 	}
 
-	mFree(list);
-	return RESULT_OK;
-}//END: joblistFree
+	return NULL;
+}//END: _jobPop
+
+
+
+/*
+ * Возвращает класс задания соединения согласно его текущей стадии
+ */
+static inline job_class_e
+_jobClass(connection_s * con){
+	switch(con->stage){
+		case CON_STAGE_WORKING:		return (con->route ? con->route->job_class : JOB_CLASS_NORMAL);
+		case CON_STAGE_HANDSTAKE:	return JOB_CLASS_NORMAL;
+		default:					return JOB_CLASS_IO;
+	}
+}//END: _jobClass
+
 
 
+/*
+ * Возвращает количество заданий во всех очередях потока (проверка без блокировок, результат является подсказкой)
+ */
+size_t
+jobQueued(thread_s * thread){
+	size_t queued = 0;
+	int c;
+	for(c = 0; c < JOB_CLASSES; c++) queued += joblistLength(thread->queues[c]);
+	return queued;
+}//END: jobQueued
+
+
+
+/*
+ * Возвращает true, если другой поток может забрать задания из очередей потока victim:
+ * в очередях накопились задания или поток завершил работу
+ * (позиция пула может быть пустой, пока пул потоков создается)
+ */
+static inline bool
+_jobStealable(thread_s * victim){
+	if(!victim) return false;
+	return (__atomic_load_n(&victim->exited, __ATOMIC_SEQ_CST) ? jobQueued(victim) > 0 : jobQueued(victim) >= worker_steal_backlog);
+}//END: _jobStealable
+
+
+
+/*
+ * Возвращает срок выполнения задания соединения (монотонное время в миллисекундах), 0 - без срока
+ * Срок задается для чтения и обработки запроса: бюджет маршрута или max_request_time от начала запроса,
+ * начало запроса задано Unix временем и переводится в монотонное время один раз при добавлении задания
+ */
+static inline uint64_t
+_jobDeadline(connection_s * con){
+	uint64_t budget_ms = (uint64_t)con->server->config.max_request_time * 1000;
+	switch(con->stage){
+		case CON_STAGE_WORKING:
+			//Маршрут определяется после чтения запроса, на стадии чтения con->route остается от предыдущего запроса
+			if(con->route && con->route->budget_ms) budget_ms = con->route->budget_ms;
+		//fall through
+		case CON_STAGE_READ:
+			return (budget_ms ? (uint64_t)con->start_ts * 1000 + budget_ms - __atomic_load_n(&con->reactor->clock_offset_ms, __ATOMIC_RELAXED) : 0);
+		default:
+			return 0;
+	}
+}//END: _jobDeadline
+
+
+
+/*
+ * Учитывает время ожидания задания в очереди для проверки нагрузки на пул потоков (threadPoolAdjust)
+ * и перегрузки сервера (overloadCheck)
+ */
+static inline void
+_jobWaitStat(thread_pool_s * pool, connection_s * con, uint64_t now_ms){
+	uint64_t wait_ms	= (now_ms > con->job_queued_ms ? now_ms - con->job_queued_ms : 0);
+	uint64_t wait_max	= __atomic_load_n(&pool->wait_max_ms, __ATOMIC_RELAXED);
+	int bucket			= (wait_ms ? min(XG_WAIT_HISTOGRAM_SIZE - 1, 64 - __builtin_clzll(wait_ms)) : 0);
+	__atomic_add_fetch(&pool->wait_histogram[bucket], 1, __ATOMIC_RELAXED);
+	while(wait_ms > wait_max && !__atomic_compare_exchange_n(&pool->wait_max_ms, &wait_max, wait_ms, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}//END: _jobWaitStat
+
+
+
+/*
+ * Помещает задание в очередь класса job_class потока thread,
+ * если очередь заполнена - в очередь того же класса первого потока со свободным местом
+ * Возвращает поток, в очередь которого помещено задание
+ */
+static thread_s *
+_jobPush(thread_pool_s * pool, size_t count, thread_s * thread, connection_s * con, uint32_t generation, job_class_e job_class){
+	thread_s * other;
+	size_t i;
+
+	if(_joblistPush(thread->queues[job_class], con, generation)) return thread;
+
+	for(i = 1; i < count; i++){
+		other = pool->threads[(thread->index + i) % count];
+		if(other && _joblistPush(other->queues[job_class], con, generation)) return other;
+	}
+
+	_joblistPushWait(thread->queues[job_class], con, generation);
+	return thread;
+}//END: _jobPush
+
 
 
 /*
@@ -102,29 +503,25 @@ joblistFree(joblist_s * list){
 void
 jobAdd(connection_s * con){
 
-	joblist_s * joblist = con->server->joblist;
-	if(!joblist) return;
-
-	pthread_mutex_lock(&job_mutex);
+	thread_pool_s * pool = con->server->workers;
+	thread_s * thread;
+	uint32_t generation;
+	size_t count;
 
-		//Если соединение еще не находится в списке заданий - добавляем соединение в список заданий
-		if(connectionSetJobStage(con, JOB_STAGE_WAITING, false) == JOB_STAGE_WAITING){
+	if(!pool || !(count = __atomic_load_n(&pool->threads_count, __ATOMIC_ACQUIRE))) return;
 
-			jobitem_s * item = _joblistItemFromIdle(joblist);
-			item->connection	= con;
-			item->next			= NULL;
-			item->ignore		= false;
-			con->job_item		= item;
+	//Если соединение уже находится в списке заданий - ничего не делаем
+	if(connectionSetJobStage(con, JOB_STAGE_WAITING, false) != JOB_STAGE_WAITING) return;
 
-			if(joblist->last) joblist->last->next = item;
-			if(!joblist->first) joblist->first = item;
-			joblist->last = item;
+	con->job_queued_ms = con->reactor->current_ms;
+	con->job_deadline_ms = _jobDeadline(con);
+	generation = __atomic_add_fetch(&con->job_gen, 1, __ATOMIC_SEQ_CST);
 
-		}
-
-	pthread_mutex_unlock(&job_mutex);
+	//Все стадии обработки соединения выполняются одним и тем же потоком (пока не изменится размер пула потоков)
+	thread = pool->threads[con->connection_id % count];
+	thread = _jobPush(pool, count, thread, con, generation, _jobClass(con));
 
-	threadWakeup(con->server->workers);
+	threadWakeup(pool, thread);
 
 	return;
 }//END: jobAdd
@@ -132,77 +529,146 @@ jobAdd(connection_s * con){
 
 
 /*
- * Возвращает первое на очереди задание, одновременно удаляя его из списка заданий
- * Функция запрашивается только рабочими потоками 
+ * Возвращает обрабатываемое рабочим потоком соединение в очередь класса его маршрута
+ * Соединение возвращается в очередь, только если в очередях потока есть другие задания:
+ * иначе обработчик выполняется сразу, без лишней передачи через очередь
+ * Возвращает true, если соединение помещено в очередь (рабочий поток больше не должен обращаться к соединению)
+ * Функция вызывается только рабочими потоками
  */
-connection_s *
-jobGet(joblist_s * joblist){
-	if(!joblist) return NULL;
-	jobitem_s * item;
-	connection_s * con = NULL;
+bool
+jobRequeue(connection_s * con){
 
-	pthread_mutex_lock(&job_mutex);
+	thread_pool_s * pool = con->server->workers;
+	job_class_e job_class = _jobClass(con);
+	job_stage_e expected = JOB_STAGE_WORKING;
+	thread_s * thread;
+	uint32_t generation;
+	size_t count;
 
-		while(joblist->first){
-			item = joblist->first;
-			joblist->first = item->next;
-			if(joblist->last == item) joblist->last = NULL;
+	if(job_class == JOB_CLASS_IO || !pool || !(count = __atomic_load_n(&pool->threads_count, __ATOMIC_ACQUIRE))) return false;
 
-			//Если текущее задание должно быть проигнорировано (такое возникает в случае, когда соединение находится в процессе удаления)
-			if(item->ignore){
-				_joblistItemToIdle(joblist, item);
-				con = NULL;
-				continue;
-			}
+	thread = pool->threads[con->connection_id % count];
+	if(jobQueued(thread) == 0) return false;
 
-			con = item->connection;
-			if(con->job_item != item){
-				_joblistItemToIdle(joblist, item);
-				con = NULL;
-				continue;
-			}
+	if(!__atomic_compare_exchange_n(&con->job_stage, &expected, JOB_STAGE_WAITING, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) return false;
 
-			con->job_item = NULL;
-			_joblistItemToIdle(joblist, item);
-
-			//Если текущее соединение не используется или его обработка завершена или 
-			//не удается задать стадию соединения как рабочую - игнорируем соединение
-			if(
-				con->stage == CON_STAGE_NONE ||
-				con->stage >= CON_STAGE_COMPLETE || 
-				connectionSetJobStage(con, JOB_STAGE_WORKING, false) != JOB_STAGE_WORKING
-			){
-				con = NULL;
-				continue;
+	con->job_queued_ms = nowMonotonicMilliseconds();
+	con->job_deadline_ms = _jobDeadline(con);
+	generation = __atomic_add_fetch(&con->job_gen, 1, __ATOMIC_SEQ_CST);
+	thread = _jobPush(pool, count, thread, con, generation, job_class);
+
+	threadWakeup(pool, thread);
+
+	return true;
+}//END: jobRequeue
+
+
+
+/*
+ * Извлекает задание из очередей потока: очередь выбирается пропорционально весам классов
+ * среди непустых очередей (smooth weighted round-robin), если в выбранной очереди остались
+ * только устаревшие задания - очереди просматриваются в порядке приоритета
+ */
+static connection_s *
+_jobPopWeighted(thread_s * thread, uint64_t now_ms){
+	connection_s * con;
+	int32_t total = 0;
+	int c, best = -1;
+
+	for(c = 0; c < JOB_CLASSES; c++){
+		if(joblistIsEmpty(thread->queues[c])) continue;
+		thread->credits[c] += job_class_weights[c];
+		total += job_class_weights[c];
+		if(best < 0 || thread->credits[c] > thread->credits[best]) best = c;
+	}
+	if(best < 0) return NULL;
+
+	thread->credits[best] -= total;
+	if((con = _jobPop(thread->queues[best], now_ms)) != NULL) return con;
+
+	for(c = 0; c < JOB_CLASSES; c++){
+		if((con = _jobPop(thread->queues[c], now_ms)) != NULL) return con;
+	}
+	return NULL;
+}//END: _jobPopWeighted
+
+
+
+/*
+ * Возвращает первое на очереди задание потока, одновременно удаляя его из очереди заданий
+ * Если очереди потока пусты - забирает задание из очередей другого потока (в порядке приоритета классов)
+ * Функция запрашивается только рабочими потоками 
+ */
+connection_s *
+jobGet(thread_s * thread){
+	thread_pool_s * pool = thread->pool;
+	size_t slots = __atomic_load_n(&pool->threads_slots, __ATOMIC_ACQUIRE);
+	thread_s * victim;
+	connection_s * con;
+	uint64_t now_ms = nowMonotonicMilliseconds();
+	size_t i;
+	int c;
+
+	if((con = _jobPopWeighted(thread, now_ms)) != NULL){
+		_jobWaitStat(pool, con, now_ms);
+		return con;
+	}
+
+	//Очереди завершившихся потоков просматриваются наравне с очередями активных потоков
+	for(i = 1; i < slots; i++){
+		victim = __atomic_load_n(&pool->threads[(thread->index + i) % slots], __ATOMIC_ACQUIRE);
+		if(!_jobStealable(victim)) continue;
+		for(c = 0; c < JOB_CLASSES; c++){
+			if((con = _jobPop(victim->queues[c], now_ms)) != NULL){
+				__atomic_add_fetch(&victim->queues[c]->stat_stolen, 1, __ATOMIC_RELAXED);
+				_jobWaitStat(pool, con, now_ms);
+				return con;
 			}
-			break;
 		}
+	}
 
-	pthread_mutex_unlock(&job_mutex);
-	return con;
+	return NULL;
 }//END: jobGet
 
 
 
+/*
+ * Возвращает true, если для потока есть задания в его очередях или в очередях других потоков
+ * (проверка без блокировок, результат является подсказкой)
+ */
+bool
+jobAvailable(thread_s * thread){
+	thread_pool_s * pool = thread->pool;
+	size_t slots = __atomic_load_n(&pool->threads_slots, __ATOMIC_ACQUIRE);
+	size_t i;
+
+	if(jobQueued(thread) > 0) return true;
+
+	for(i = 1; i < slots; i++){
+		if(_jobStealable(__atomic_load_n(&pool->threads[(thread->index + i) % slots], __ATOMIC_ACQUIRE))) return true;
+	}
+
+	return false;
+}//END: jobAvailable
+
+
+
 /*
  * Удаляет соединение из списка рабочих заданий
+ * Задания соединения в очередях становятся устаревшими, если соединение обрабатывается рабочим потоком - возвращает false
  * Функция запрашивается основным потоком
  */
 bool
 jobDelete(connection_s * con){
-	bool can_delete = true;
-	pthread_mutex_lock(&job_mutex);
-
-		if(con->job_item) con->job_item->ignore = true;
-		con->job_item = NULL;
-		if(con->job_stage == JOB_STAGE_WORKING){
-			can_delete = false;
-		}else{
-			connectionSetJobStage(con, JOB_STAGE_NONE, true);
-		}
+	job_stage_e stage;
+
+	__atomic_add_fetch(&con->job_gen, 1, __ATOMIC_SEQ_CST);
 
-	pthread_mutex_unlock(&job_mutex);
-	return can_delete;
+	for(;;){
+		stage = __atomic_load_n(&con->job_stage, __ATOMIC_SEQ_CST);
+		if(stage == JOB_STAGE_WORKING) return false;
+		if(__atomic_compare_exchange_n(&con->job_stage, &stage, JOB_STAGE_NONE, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) return true;
+	}
 }//END: jobDelete
 
 
@@ -210,7 +676,7 @@ jobDelete(connection_s * con){
 
 /***********************************************************************
  * Работа со списком заданий для основного потока
- * Рабочие потоки направляют соединения основному потоку после обработки
+ * Рабочие потоки направляют соединения потоку реактора после обработки
  * Функции вызываются только из рабочих потоков
  **********************************************************************/ 
 
@@ -219,12 +685,8 @@ jobDelete(connection_s * con){
  * Создание списка заданий для основного потока
  */
 result_e
-jobmainCreate(server_s * srv){
-	joblist_s * jobmain 	= (joblist_s *)mNewZ(sizeof(joblist_s));
-	if(srv) srv->jobmain	= jobmain;
-	jobmain->server 		= srv;
-	int i;
-	for(i=0;i<server_joblist_size; i++) _joblistItemToIdle(jobmain, NULL);
+jobmainCreate(reactor_s * reactor){
+	reactor->jobmain = _joblistNew(reactor->server, server_joblist_initial_size);
 	return RESULT_OK;
 }//END: jobmainCreate
 
@@ -236,7 +698,8 @@ jobmainCreate(server_s * srv){
  */
 result_e
 jobmainFree(joblist_s * jobmain){
-	return joblistFree(jobmain);
+	_joblistDestroy(jobmain);
+	return RESULT_OK;
 }//END: jobmainFree
 
 
@@ -247,27 +710,13 @@ jobmainFree(joblist_s * jobmain){
 void
 jobmainAdd(connection_s * con){
 
-	joblist_s * jobmain = con->server->jobmain;
+	joblist_s * jobmain = con->reactor->jobmain;
 	if(!jobmain) return;
 
-	pthread_mutex_lock(&job_mutex);
-
-		//Если соединение еще не находится в списке заданий - добавляем соединение в список заданий
-		if(connectionSetJobStage(con, JOB_STAGE_WAITMAIN, false) == JOB_STAGE_WAITMAIN){
-
-			jobitem_s * item = _joblistItemFromIdle(jobmain);
-			item->connection	= con;
-			item->next			= NULL;
-			item->ignore		= false;
-			con->job_item		= item;
-
-			if(jobmain->last) jobmain->last->next = item;
-			if(!jobmain->first) jobmain->first = item;
-			jobmain->last = item;
-
-		}
-
-	pthread_mutex_unlock(&job_mutex);
+	//Если соединение еще не находится в списке заданий - добавляем соединение в список заданий
+	if(connectionSetJobStage(con, JOB_STAGE_WAITMAIN, false) == JOB_STAGE_WAITMAIN){
+		_joblistPushWait(jobmain, con, __atomic_load_n(&con->job_gen, __ATOMIC_SEQ_CST));
+	}
 
 	return;
 }//END: jobmainAdd
@@ -282,45 +731,27 @@ jobmainAdd(connection_s * con){
 connection_s *
 jobmainGet(joblist_s * jobmain){
 	if(!jobmain) return NULL;
-	jobitem_s * item;
-	connection_s * con = NULL;
-
-	pthread_mutex_lock(&job_mutex);
-
-		while(jobmain->first){
-			item = jobmain->first;
-			jobmain->first = item->next;
-			if(jobmain->last == item) jobmain->last = NULL;
+	connection_s * con;
+	uint32_t generation;
 
-			//Если текущее задание должно быть проигнорировано (такое возникает в случае, когда соединение находится в процессе удаления)
-			if(item->ignore){
-				_joblistItemToIdle(jobmain, item);
-				con = NULL;
-				continue;
-			}
-
-			con = item->connection;
-			if(con->job_item != item){
-				_joblistItemToIdle(jobmain, item);
-				con = NULL;
-				continue;
-			}
+	while(_joblistPop(jobmain, &con, &generation)){
 
-			con->job_item = NULL;
-			_joblistItemToIdle(jobmain, item);
+		//Задание устарело: соединение было удалено (jobDelete)
+		if(generation != __atomic_load_n(&con->job_gen, __ATOMIC_SEQ_CST)){
+			__atomic_add_fetch(&jobmain->stat_stale, 1, __ATOMIC_RELAXED);
+			continue;
+		}
 
-			if(
-				con->stage == CON_STAGE_NONE ||
-				connectionSetJobStage(con, JOB_STAGE_NONE, false) != JOB_STAGE_NONE
-			){
-				con = NULL;
-				continue;
-			}
-			break;
+		if(
+			con->stage == CON_STAGE_NONE ||
+			connectionSetJobStage(con, JOB_STAGE_NONE, false) != JOB_STAGE_NONE
+		){
+			continue;
 		}
+		return con;
+	}
 
-	pthread_mutex_unlock(&job_mutex);
-	return con;
+	return NULL;
 }//END: jobmainGet
 
 
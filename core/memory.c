@@ -375,6 +375,44 @@ mFreeAndNull(void ** ptr){
 
 
 
+/*
+ * Выделение выровненного по alignment байт блока памяти posix_memalign c обнулением
+ * Блок не проходит через кеш маленьких блоков (XG_MEM_USE_CACHE) и освобождается только mFreeAligned()
+ */
+void *
+mNewAlignedZ(size_t alignment, size_t size){
+	void * ptr = NULL;
+	if(posix_memalign(&ptr, alignment, size) != 0 || !ptr) FATAL_ERROR("Out of memory. posix_memalign requested %zu bytes aligned to %zu.", size, alignment);
+#ifdef XG_MEMSTAT
+	pthread_mutex_lock(&mem_mutex);
+	if(mem_stat){
+		malloc_count++;
+	}
+	pthread_mutex_unlock(&mem_mutex);
+#endif
+	return memset(ptr, '\0', size);
+}
+
+
+
+/*
+ * Освобождение блока памяти, выделенного mNewAlignedZ()
+ */
+void
+mFreeAligned(void * ptr){
+	if(!ptr) return;
+	free(ptr);
+#ifdef XG_MEMSTAT
+	pthread_mutex_lock(&mem_mutex);
+	if(mem_stat){
+		free_count++;
+	}
+	pthread_mutex_unlock(&mem_mutex);
+#endif
+}
+
+
+
 /***********************************************************************
  * Функции - Работа со string_s
  **********************************************************************/
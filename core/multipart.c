@@ -0,0 +1,472 @@
+/***********************************************************************
+ * XG SERVER
+ * core/multipart.c
+ * Потоковый разбор тела POST запроса multipart/form-data
+ *
+ * Copyright (с) 2014-2015 Stanislav V. Tretyakov, svtrostov@yandex.ru
+ **********************************************************************/
+
+#define _GNU_SOURCE
+
+#include "core.h"
+#include "server.h"
+#include "globals.h"
+
+
+/*
+ * Тело multipart/form-data разбирается по мере получения данных от клиента (connectionPrepareRequest):
+ * каждая порция передается в multipartParse, обработанные байты удаляются из буфера запроса,
+ * поэтому в памяти находятся только заголовки запроса и необработанный остаток порции.
+ *
+ * Разделитель частей [\r\n--граница] ищется алгоритмом Бойера-Мура-Хорспула: таблица сдвигов
+ * строится один раз для запроса, при отсутствии разделителя в порции необработанными остаются
+ * только последние (длинна разделителя - 1) байт, которые могут быть его началом.
+ *
+ * Текстовые поля собираются в памяти (суммарно не больше max_post_size) и добавляются в con->request.post.
+ * Файлы размером до upload_spool_size хранятся в памяти, файлы большего размера записываются
+ * во временный файл в upload_temp_dir (каждый файл не больше max_upload_size) и добавляются в con->request.files.
+ */
+
+
+#define MULTIPART_TEMP_TEMPLATE "/xgupload_XXXXXX"
+
+
+
+/***********************************************************************
+ * Вспомогательные функции
+ **********************************************************************/
+
+
+/*
+ * Поиск разделителя частей в данных data длинной len
+ * Возвращает указатель на начало разделителя или NULL, если разделитель не найден
+ */
+static inline const char *
+_multipartSearch(const multipart_parser_s * mp, const char * data, uint32_t len){
+	const uint32_t m = mp->delimiter_len;
+	const unsigned char last = (unsigned char)mp->delimiter[m - 1];
+	uint32_t pos = 0;
+	unsigned char c;
+
+	while(pos + m <= len){
+		c = (unsigned char)data[pos + m - 1];
+		if(c == last && memcmp(data + pos, mp->delimiter, m - 1) == 0) return data + pos;
+		pos += mp->skip[c];
+	}
+	return NULL;
+}//END: _multipartSearch
+
+
+
+/*
+ * Поиск параметра param (name, filename) в значении заголовка Content-Disposition [ptr, end)
+ * Возвращает указатель на значение параметра (без кавычек) и его длинну в olen или NULL, если параметр не найден
+ */
+static const char *
+_multipartParam(const char * ptr, const char * end, const char * param, uint32_t param_len, uint32_t * olen){
+	const char * key;
+	const char * value;
+	uint32_t key_len;
+
+	//Пропускаем тип: "form-data", "attachment" и т.д.
+	while(ptr < end && *ptr != ';') ptr++;
+
+	while(ptr < end){
+		//Пропускаем [;] и пробелы
+		while(ptr < end && (*ptr == ';' || *ptr == ' ' || *ptr == '\t')) ptr++;
+		key = ptr;
+		while(ptr < end && *ptr != '=' && *ptr != ';') ptr++;
+		if(ptr >= end || *ptr != '=') continue;
+		key_len = ptr - key;
+		ptr++;
+
+		//Значение в кавычках
+		if(ptr < end && *ptr == '"'){
+			value = ++ptr;
+			while(ptr < end && *ptr != '"') ptr++;
+			if(ptr >= end) return NULL;
+			*olen = ptr - value;
+			ptr++;
+		}else{
+			value = ptr;
+			while(ptr < end && *ptr != ';' && *ptr != ' ' && *ptr != '\t') ptr++;
+			*olen = ptr - value;
+		}
+
+		if(key_len == param_len && stringCompareCaseN(key, param, param_len)) return value;
+	}
+	return NULL;
+}//END: _multipartParam
+
+
+
+/*
+ * Разбор заголовков части [ptr, end) и начало новой части
+ */
+static result_e
+_multipartPartBegin(connection_s * con, const char * ptr, const char * end){
+	multipart_parser_s * mp = con->request.multipart;
+	const char * line_end;
+	const char * value;
+	const char * name = NULL;
+	const char * filename = NULL;
+	const char * ctype = NULL;
+	uint32_t name_len = 0, filename_len = 0, ctype_len = 0;
+	post_file_s * file;
+
+	//Просмотр строк заголовков части
+	for(; ptr < end; ptr = line_end + 2){
+		if((line_end = memchr(ptr, '\r', end - ptr)) == NULL) line_end = end;
+
+		//Content-Disposition: form-data; name="file1"; filename="dh1024.pem"
+		if(line_end - ptr > 20 && stringCompareCaseN(ptr, "Content-Disposition:", 20)){
+			name = _multipartParam(ptr + 20, line_end, "name", 4, &name_len);
+			filename = _multipartParam(ptr + 20, line_end, "filename", 8, &filename_len);
+			continue;
+		}
+
+		//Content-Type: application/x-x509-ca-cert
+		if(line_end - ptr > 13 && stringCompareCaseN(ptr, "Content-Type:", 13)){
+			for(value = ptr + 13; value < line_end && (*value == ' ' || *value == '\t'); value++);
+			ctype = value;
+			ctype_len = line_end - value;
+			continue;
+		}
+	}
+
+	if(!name && !filename){
+		con->http_code = 400;
+		RETURN_ERROR(RESULT_ERROR, "Content-Disposition name not found");
+	}
+
+	if(!name){
+		name = filename;
+		name_len = filename_len;
+	}
+	mp->name.ptr = stringCloneN(name, name_len, &mp->name.len);
+
+	//Файл
+	if(filename){
+		file = (post_file_s *)mNewZ(sizeof(post_file_s));
+		file->fd = -1;
+		file->filename.ptr = stringCloneN(filename, filename_len, &file->filename.len);
+		if(ctype && ctype_len > 0){
+			file->mimetype.ptr = stringCloneN(ctype, ctype_len, &file->mimetype.len);
+		}else{
+			file->mimetype.ptr = stringCloneN("application/octet-stream", 24, &file->mimetype.len);
+		}
+		mp->file = file;
+	}
+
+	return RESULT_OK;
+}//END: _multipartPartBegin
+
+
+
+/*
+ * Запись len байт из data во временный файл
+ */
+static result_e
+_multipartWrite(int fd, const char * data, uint32_t len){
+	ssize_t n;
+	while(len > 0){
+		if((n = write(fd, data, len)) < 0){
+			if(errno == EINTR) continue;
+			return RESULT_ERROR;
+		}
+		data += n;
+		len -= (uint32_t)n;
+	}
+	return RESULT_OK;
+}//END: _multipartWrite
+
+
+
+/*
+ * Создание временного файла для загружаемого файла и перенос в него уже полученного содержимого
+ */
+static result_e
+_multipartSpool(connection_s * con){
+	multipart_parser_s * mp = con->request.multipart;
+	post_file_s * file = mp->file;
+	const char * dir = con->server->config.upload_temp_dir;
+	size_t size = strlen(dir) + sizeof(MULTIPART_TEMP_TEMPLATE);
+
+	file->path = (char *)mNew(size);
+	snprintf(file->path, size, "%s" MULTIPART_TEMP_TEMPLATE, dir);
+
+	if((file->fd = mkstemp(file->path)) < 0){
+		con->http_code = 500;
+		ERROR_MSG("mkstemp(%s) failed: %s", file->path, strerror(errno));
+		mFree(file->path);
+		file->path = NULL;
+		return RESULT_ERROR;
+	}
+
+	if(_multipartWrite(file->fd, mp->value->buffer, mp->value->count) != RESULT_OK){
+		con->http_code = 500;
+		RETURN_ERROR(RESULT_ERROR, "write(%s) failed: %s", file->path, strerror(errno));
+	}
+	bufferClear(mp->value);
+
+	return RESULT_OK;
+}//END: _multipartSpool
+
+
+
+/*
+ * Добавление len байт из data к содержимому текущей части
+ */
+static result_e
+_multipartAppend(connection_s * con, const char * data, uint32_t len){
+	multipart_parser_s * mp = con->request.multipart;
+	post_file_s * file = mp->file;
+
+	//Текстовое поле
+	if(!file){
+		if(mp->fields_size + len > (uint32_t)con->server->config.max_post_size){
+			con->http_code = 413;
+			RETURN_ERROR(RESULT_ERROR, "Warning: multipart fields too large, maximum is [%u]", con->server->config.max_post_size);
+		}
+		mp->fields_size += len;
+		bufferAddHeap(mp->value, data, len);
+		return RESULT_OK;
+	}
+
+	//Файл
+	if(file->size + len > (uint32_t)con->server->config.max_upload_size){
+		con->http_code = 413;
+		RETURN_ERROR(RESULT_ERROR, "Warning: uploaded file too large, maximum is [%u]", con->server->config.max_upload_size);
+	}
+	file->size += len;
+
+	//Файл пока помещается в памяти
+	if(file->fd < 0 && file->size < (uint32_t)con->server->config.upload_spool_size){
+		bufferAddHeap(mp->value, data, len);
+		return RESULT_OK;
+	}
+
+	if(file->fd < 0 && _multipartSpool(con) != RESULT_OK) return RESULT_ERROR;
+
+	if(_multipartWrite(file->fd, data, len) != RESULT_OK){
+		con->http_code = 500;
+		RETURN_ERROR(RESULT_ERROR, "write(%s) failed: %s", file->path, strerror(errno));
+	}
+
+	return RESULT_OK;
+}//END: _multipartAppend
+
+
+
+/*
+ * Завершение текущей части: добавление поля в con->request.post или файла в con->request.files
+ */
+static void
+_multipartPartEnd(connection_s * con){
+	multipart_parser_s * mp = con->request.multipart;
+	post_file_s * file = mp->file;
+	kv_s * node;
+
+	//POST переменная ключ = значение
+	if(!file){
+		if(!con->request.post) con->request.post = kvNewRoot();
+		node = kvAppend(con->request.post, mp->name.ptr, mp->name.len, KV_REPLACE);
+		if(mp->value->count > 0) kvSetString(node, mp->value->buffer, mp->value->count);
+	}
+	//Файл
+	else{
+		if(file->size > 0){
+			if(file->fd < 0){
+				//Содержимое может быть бинарным - копируется целиком
+				file->content.ptr = (char *)mNew(file->size + 1);
+				memcpy(file->content.ptr, mp->value->buffer, file->size);
+				file->content.ptr[file->size] = '\0';
+				file->content.len = file->size;
+			}else{
+				lseek(file->fd, 0, SEEK_SET);
+			}
+			if(!con->request.files) con->request.files = kvNewRoot();
+			kvSetPointer(kvAppend(con->request.files, mp->name.ptr, mp->name.len, KV_REPLACE), file, multipartFileFree);
+		}else{
+			multipartFileFree(file);
+		}
+		mp->file = NULL;
+	}
+
+	mStringClear(&mp->name);
+	bufferClear(mp->value);
+}//END: _multipartPartEnd
+
+
+
+/***********************************************************************
+ * Функции
+ **********************************************************************/
+
+
+/*
+ * Создание структуры разбора тела multipart/form-data по границе из заголовков запроса
+ * Функция вызывается после обработки заголовков POST запроса multipart/form-data
+ */
+result_e
+multipartInit(connection_s * con){
+	const string_s * boundary = &con->request.multipart_boundary;
+	multipart_parser_s * mp;
+	uint32_t i;
+
+	if(!boundary->len || boundary->len > XG_MULTIPART_BOUNDARY_MAX){
+		con->http_code = 400;
+		RETURN_ERROR(RESULT_ERROR, "Warning: bad multipart boundary length [%u]", boundary->len);
+	}
+
+	mp = (multipart_parser_s *)mNewZ(sizeof(multipart_parser_s));
+	mp->state			= MULTIPART_PREAMBLE;
+	mp->delimiter_len	= boundary->len + 4;
+	memcpy(mp->delimiter, "\r\n--", 4);
+	memcpy(mp->delimiter + 4, boundary->ptr, boundary->len);
+
+	//Таблица сдвигов: для последнего символа окна - расстояние от его последнего вхождения в разделитель до конца разделителя
+	for(i = 0; i < 256; i++) mp->skip[i] = (uint8_t)mp->delimiter_len;
+	for(i = 0; i < mp->delimiter_len - 1; i++) mp->skip[(unsigned char)mp->delimiter[i]] = (uint8_t)(mp->delimiter_len - 1 - i);
+
+	mp->value = bufferCreate(request_buffer_increment);
+	con->request.multipart = mp;
+
+	return RESULT_OK;
+}//END: multipartInit
+
+
+
+/*
+ * Разбор очередной порции тела запроса data длинной len, last = true - порция завершает тело запроса
+ * Возвращает количество обработанных байт (необработанный остаток передается повторно со следующей порцией)
+ * или -1 при ошибке, код HTTP ошибки записывается в con->http_code
+ */
+int
+multipartParse(connection_s * con, const char * data, uint32_t len, bool last){
+	multipart_parser_s * mp = con->request.multipart;
+	const uint32_t m = mp->delimiter_len;
+	const char * ptr = data;
+	const char * end = data + len;
+	const char * found;
+	uint32_t avail, n;
+
+	for(;;){
+		avail = end - ptr;
+
+		switch(mp->state){
+
+			//Данные до первой границы: тело обычно начинается сразу с [--граница] (разделитель без [\r\n])
+			case MULTIPART_PREAMBLE:
+				if(avail < m) goto label_wait;
+				if(ptr == data && mp->body_read == 0 && memcmp(ptr, mp->delimiter + 2, m - 2) == 0){
+					ptr += m - 2;
+					mp->state = MULTIPART_BOUNDARY;
+					continue;
+				}
+				if((found = _multipartSearch(mp, ptr, avail)) == NULL){
+					ptr = end - (m - 1);
+					goto label_wait;
+				}
+				ptr = found + m;
+				mp->state = MULTIPART_BOUNDARY;
+			continue;
+
+			//Окончание границы
+			case MULTIPART_BOUNDARY:
+				if(avail < 2) goto label_wait;
+				if(ptr[0] == '-' && ptr[1] == '-'){
+					mp->state = MULTIPART_DONE;
+					continue;
+				}
+				if(ptr[0] != '\r' || ptr[1] != '\n'){
+					con->http_code = 400;
+					RETURN_ERROR(-1, "RN not found after multipart boundary");
+				}
+				ptr += 2;
+				mp->state = MULTIPART_HEADERS;
+			continue;
+
+			//Заголовки части
+			case MULTIPART_HEADERS:
+				if(avail < 2) goto label_wait;
+				if(ptr[0] == '\r' && ptr[1] == '\n'){
+					found = ptr;
+				}else{
+					if((found = memmem(ptr, avail, "\r\n\r\n", 4)) == NULL){
+						if(avail > multipart_part_head_max){
+							con->http_code = 400;
+							RETURN_ERROR(-1, "Multipart part headers too large");
+						}
+						goto label_wait;
+					}
+					found += 2;
+				}
+				if(_multipartPartBegin(con, ptr, found) != RESULT_OK) return -1;
+				ptr = found + 2;
+				mp->state = MULTIPART_DATA;
+			continue;
+
+			//Содержимое части: все до разделителя, при отсутствии разделителя - все, кроме возможного его начала
+			case MULTIPART_DATA:
+				found = _multipartSearch(mp, ptr, avail);
+				n = (found ? (uint32_t)(found - ptr) : (avail >= m ? avail - (m - 1) : 0));
+				if(n > 0 && _multipartAppend(con, ptr, n) != RESULT_OK) return -1;
+				ptr += n;
+				if(!found) goto label_wait;
+				_multipartPartEnd(con);
+				ptr += m;
+				mp->state = MULTIPART_BOUNDARY;
+			continue;
+
+			//Данные после завершающей границы игнорируются
+			case MULTIPART_DONE:
+				return (int)len;
+		}
+	}
+
+	label_wait:
+
+	//Тело запроса получено полностью, а завершающая граница не найдена
+	if(last){
+		con->http_code = 400;
+		RETURN_ERROR(-1, "Unexpected end of multipart content");
+	}
+
+	return (int)(ptr - data);
+}//END: multipartParse
+
+
+
+/*
+ * Освобождение структуры разбора тела multipart/form-data
+ */
+void
+multipartFree(multipart_parser_s * mp){
+	if(!mp) return;
+	if(mp->file) multipartFileFree(mp->file);
+	if(mp->value) bufferFree(mp->value);
+	mStringClear(&mp->name);
+	mFree(mp);
+}//END: multipartFree
+
+
+
+/*
+ * Освобождение структуры post_file_s и удаление временного файла
+ */
+void
+multipartFileFree(void * ptr){
+	post_file_s * file = (post_file_s *)ptr;
+	if(!file) return;
+	if(file->fd >= 0) close(file->fd);
+	if(file->path){
+		unlink(file->path);
+		mFree(file->path);
+	}
+	mStringClear(&file->filename);
+	mStringClear(&file->mimetype);
+	mStringClear(&file->content);
+	mFree(file);
+}//END: multipartFileFree
+
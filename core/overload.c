@@ -0,0 +1,244 @@
+/***********************************************************************
+ * XG SERVER
+ * core/overload.c
+ * Контроль перегрузки сервера: отклонение новых соединений ответом 503
+ *
+ * Copyright (с) 2014-2015 Stanislav V. Tretyakov, svtrostov@yandex.ru
+ **********************************************************************/
+
+
+#include "core.h"
+#include "server.h"
+#include "globals.h"
+
+
+/*
+ * Реактор 0 каждые overload_check_interval миллисекунд сравнивает нагрузку с порогами:
+ * количество соединений реактора, количество заданий в очередях рабочих потоков
+ * и перцентиль времени ожидания заданий в очереди.
+ * При превышении любого порога сервер переходит в режим перегрузки: реакторы принимают новые
+ * соединения и сразу отвечают на них заранее подготовленным ответом 503 с заголовком Retry-After,
+ * не создавая соединений и не передавая их рабочим потокам. Уже установленные соединения обслуживаются.
+ * Сервер выходит из режима перегрузки, когда все показатели снизятся до overload_recover процентов
+ * от порогов, но не раньше чем через overload_min_duration миллисекунд.
+ *
+ * При использовании SSL ответ не отправляется (он не может быть передан без рукопожатия),
+ * соединение сразу закрывается.
+ */
+
+
+#define OVERLOAD_RESPONSE_BODY "<html><head><title>503: Service Unavailable</title></head><body><h1>503: Service Unavailable</h1></body></html>"
+
+static char		overload_response[512];		//Ответ 503, отправляемый в режиме перегрузки
+static size_t	overload_response_len = 0;	//Длинна ответа 503
+
+
+
+/***********************************************************************
+ * Вспомогательные функции
+ **********************************************************************/
+
+
+/*
+ * Возвращает перцентиль percentile времени ожидания заданий в очереди (в миллисекундах)
+ * по гистограмме пула потоков и обнуляет гистограмму
+ * Значение округляется вверх до границы интервала гистограммы
+ */
+static uint64_t
+_overloadWaitPercentile(thread_pool_s * pool, int percentile){
+	uint32_t counts[XG_WAIT_HISTOGRAM_SIZE];
+	uint64_t total = 0, target, sum = 0;
+	int i;
+
+	for(i = 0; i < XG_WAIT_HISTOGRAM_SIZE; i++){
+		counts[i] = __atomic_exchange_n(&pool->wait_histogram[i], 0, __ATOMIC_RELAXED);
+		total += counts[i];
+	}
+	if(!total) return 0;
+
+	target = (total * (uint64_t)percentile + 99) / 100;
+	for(i = 0; i < XG_WAIT_HISTOGRAM_SIZE; i++){
+		sum += counts[i];
+		if(sum >= target) break;
+	}
+	return (i < XG_WAIT_HISTOGRAM_SIZE ? ((uint64_t)1 << i) - 1 : ((uint64_t)1 << (XG_WAIT_HISTOGRAM_SIZE - 1)));
+}//END: _overloadWaitPercentile
+
+
+
+/*
+ * Возвращает true, если значение value достигло percent процентов порога limit (порог 0 не проверяется)
+ */
+static inline bool
+_overloadAbove(uint64_t value, uint64_t limit, int percent){
+	return (limit > 0 && value * 100 >= limit * (uint64_t)percent);
+}//END: _overloadAbove
+
+
+
+/***********************************************************************
+ * Функции
+ **********************************************************************/
+
+
+/*
+ * Подготовка ответа 503 и вывод порогов перегрузки
+ * Функция вызывается при старте сервера до запуска реакторов
+ */
+void
+overloadInit(server_s * srv){
+	char retry_after[32] = "";
+	int len;
+
+	if(srv->config.overload_retry_after > 0) snprintf(retry_after, sizeof(retry_after), "Retry-After: %d\r\n", srv->config.overload_retry_after);
+
+	len = snprintf(
+		overload_response,
+		sizeof(overload_response),
+		"HTTP/1.1 503 Service Unavailable\r\n" \
+		"Server: %s\r\n" \
+		"%s" \
+		"Content-Type: text/html; charset=UTF-8\r\n" \
+		"Content-Length: %d\r\n" \
+		"Connection: close\r\n" \
+		"\r\n" \
+		OVERLOAD_RESPONSE_BODY,
+		XG_SERVER_VERSION,
+		retry_after,
+		(int)(sizeof(OVERLOAD_RESPONSE_BODY) - 1)
+	);
+	if(len < 0 || (size_t)len >= sizeof(overload_response)) FATAL_ERROR("503 response does not fit into %zu bytes", sizeof(overload_response));
+	overload_response_len = (size_t)len;
+
+	if(!srv->config.overload_connections && !srv->config.overload_queue_depth && !srv->config.overload_wait){
+		printf("Overload control: only max_connections limit\n");
+		return;
+	}
+	printf("Overload control: connections per reactor >= %u, queued jobs >= %u, p%d queue wait >= %d ms, recover at %d%%\n",
+		srv->config.overload_connections,
+		srv->config.overload_queue_depth,
+		srv->config.overload_wait_percentile,
+		srv->config.overload_wait,
+		srv->config.overload_recover
+	);
+}//END: overloadInit
+
+
+
+/*
+ * Проверка нагрузки сервера и переключение режима перегрузки
+ * Функция вызывается только реактором 0
+ */
+void
+overloadCheck(server_s * srv, uint64_t now_ms){
+	thread_pool_s * pool = srv->workers;
+	uint64_t connections = 0, queued = 0, wait_ms;
+	size_t count, i;
+	int percent;
+	bool above;
+
+	if(!pool || now_ms < srv->overload_check_ms + overload_check_interval) return;
+	srv->overload_check_ms = now_ms;
+
+	//Гистограмма обнуляется при каждой проверке: перцентиль считается по заданиям последнего интервала
+	wait_ms = _overloadWaitPercentile(pool, srv->config.overload_wait_percentile);
+
+	for(i = 0; i < srv->reactors_count; i++){
+		connections = max(connections, (uint64_t)__atomic_load_n(&srv->reactors[i]->connections_count, __ATOMIC_RELAXED));
+	}
+
+	count = __atomic_load_n(&pool->threads_count, __ATOMIC_ACQUIRE);
+	for(i = 0; i < count; i++) queued += jobQueued(pool->threads[i]);
+
+	//Для перехода в режим перегрузки достаточно достичь любого порога, для выхода - снизить нагрузку ниже overload_recover процентов от всех порогов
+	percent = (srv->overloaded ? srv->config.overload_recover : 100);
+	above = (
+		_overloadAbove(connections, srv->config.overload_connections, percent) ||
+		_overloadAbove(queued, srv->config.overload_queue_depth, percent) ||
+		_overloadAbove(wait_ms, (uint64_t)srv->config.overload_wait, percent)
+	);
+
+	if(!srv->overloaded && above){
+		srv->overload_since_ms = now_ms;
+		__atomic_store_n(&srv->overloaded, 1, __ATOMIC_RELAXED);
+		ERROR_MSG("Server overloaded (connections: %" PRIu64 ", queued: %" PRIu64 ", p%d wait: %" PRIu64 " ms): new connections get 503", connections, queued, srv->config.overload_wait_percentile, wait_ms);
+	}
+	else if(srv->overloaded && !above && now_ms >= srv->overload_since_ms + overload_min_duration){
+		__atomic_store_n(&srv->overloaded, 0, __ATOMIC_RELAXED);
+		ERROR_MSG("Server recovered from overload after %" PRIu64 " ms, connections rejected: %" PRIu64, now_ms - srv->overload_since_ms, __atomic_load_n(&srv->overload_shed, __ATOMIC_RELAXED));
+	}
+}//END: overloadCheck
+
+
+
+/*
+ * Возвращает true, если сервер работает в режиме перегрузки
+ */
+bool
+overloadActive(server_s * srv){
+	return __atomic_load_n(&srv->overloaded, __ATOMIC_RELAXED) != 0;
+}//END: overloadActive
+
+
+
+/*
+ * Отвечает на принятое соединение ответом 503 и закрывает его
+ */
+static void
+_overloadReject(server_s * srv, socket_t fd){
+	char buf[4096];
+
+	//Закрытие сокета с непрочитанными данными приводит к отправке RST, и клиент может не получить ответ,
+	//поэтому уже полученное начало запроса вычитывается
+	if(!srv->config.use_ssl && (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) >= 0 || errno == EAGAIN || errno == EWOULDBLOCK)){
+		send(fd, overload_response, overload_response_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+	}
+
+	socketClose(fd);
+	__atomic_add_fetch(&srv->overload_shed, 1, __ATOMIC_RELAXED);
+}//END: _overloadReject
+
+
+
+/*
+ * Принимает соединение и сразу отвечает на него ответом 503 без создания структуры соединения
+ * Возвращает RESULT_AGAIN, если в очереди прослушиваемого сокета нет соединений или соединение не удалось принять
+ */
+result_e
+overloadShed(reactor_s * reactor){
+	socket_t fd;
+
+	if((fd = accept(reactor->listen_fd, NULL, NULL)) == -1){
+		if(errno == EMFILE || errno == ENFILE) reactorAcceptExhausted(reactor);
+		return RESULT_AGAIN;
+	}
+
+	_overloadReject(reactor->server, fd);
+	return RESULT_OK;
+}//END: overloadShed
+
+
+
+/*
+ * Принимает соединение на резервный дескриптор реактора и отвечает 503 без его обработки
+ * Вызывается при исчерпании дескрипторов (EMFILE / ENFILE): резервный дескриптор закрывается,
+ * освобожденный номер используется для принятия соединения, после чего дескриптор резервируется снова
+ * Возвращает RESULT_AGAIN, если в очереди нет соединений, RESULT_ERROR - если резервного дескриптора нет или соединение не удалось принять
+ */
+result_e
+overloadShedSpare(reactor_s * reactor){
+	socket_t fd;
+	int error_no = 0;
+
+	if(reactor->spare_fd < 0) return RESULT_ERROR;
+	close(reactor->spare_fd);
+	reactor->spare_fd = -1;
+
+	if((fd = accept(reactor->listen_fd, NULL, NULL)) == -1) error_no = errno;
+	else _overloadReject(reactor->server, fd);
+	reactor->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+	if(fd != -1) return RESULT_OK;
+	return (error_no == EAGAIN || error_no == EWOULDBLOCK ? RESULT_AGAIN : RESULT_ERROR);
+}//END: overloadShedSpare
+
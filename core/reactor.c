@@ -0,0 +1,419 @@
+/***********************************************************************
+ * XG SERVER
+ * core/reactor.c
+ * Потоки-реакторы: прием соединений и обработка событий сокетов
+ *
+ * Copyright (с) 2014-2015 Stanislav V. Tretyakov, svtrostov@yandex.ru
+ **********************************************************************/
+
+
+#include "server.h"
+#include "globals.h"
+#include "event.h"
+
+
+static void *	reactorMain(void * data);	//Основная функция потока реактора
+
+
+
+/***********************************************************************
+ * Обработчики событий Poll Engine
+ **********************************************************************/
+
+
+/*
+ * Функция обработки событий для прослушиваемого сокета реактора в Poll Engine
+ */
+static result_e
+reactorHandleListenEvent(server_s * srv, int revents, void * data){
+	reactor_s * reactor = (reactor_s *)data;
+	connection_s * con;
+	int loops = 150;
+
+	//Неизвестное событие для серверного сокета
+	if (BIT_ISUNSET(revents, FDPOLL_IN)) RETURN_ERROR(RESULT_ERROR, "strange event [%d] for server socket [%d]", revents, reactor->listen_fd);
+
+	//Принимаем loops новых соединений, ограничение loops нужно,
+	//чтобы была возможность обработать уже установленные соединения
+	for (; loops > 0; loops--){
+		//Сервер перегружен или достигнут лимит соединений реактора - соединение получает ответ 503 и закрывается,
+		//а не ждет в очереди прослушиваемого сокета
+		if(overloadActive(srv) || reactor->connections_count >= srv->config.max_connections){
+			if(overloadShed(reactor) != RESULT_OK) break;
+			continue;
+		}
+		if((con = connectionAccept(reactor)) == NULL) break;
+		connectionEngine(con);
+	}
+
+	return RESULT_OK;
+}//END: reactorHandleListenEvent
+
+
+
+/*
+ * Функция обработки событий для прерывающего eventfd в Poll Engine
+ */
+static result_e
+reactorHandleWakeupEvent(server_s * srv, int revents, void * data){
+	reactor_s * reactor = (reactor_s *)data;
+	eventfd_t value;
+	eventfd_read(reactor->wakeup_fd, &value);
+	//Признак сбрасывается после чтения eventfd: пробуждения, пришедшие до сброса, будут учтены
+	//при обработке jobmain в текущей итерации реактора, пришедшие после - снова запишут в eventfd
+	__atomic_store_n(&reactor->wakeup_pending, 0, __ATOMIC_SEQ_CST);
+	return RESULT_OK;
+}//END: reactorHandleWakeupEvent
+
+
+
+
+/***********************************************************************
+ * Работа с реакторами
+ **********************************************************************/
+
+
+/*
+ * Создание реактора
+ */
+static reactor_s *
+reactorCreate(server_s * srv, size_t index){
+
+	reactor_s * reactor	= (reactor_s *)mNewZ(sizeof(reactor_s));
+	reactor->server		= srv;
+	reactor->index		= index;
+	reactor->listen_fd	= -1;
+	reactor->wakeup_fd	= -1;
+	reactor->spare_fd	= open("/dev/null", O_RDONLY | O_CLOEXEC);	//Резервный дескриптор для ответа 503 при исчерпании дескрипторов
+
+	//Создание структур клиентских соединений
+	connectionsCreate(reactor);
+
+	//Создание кучи таймеров соединений
+	timersCreate(reactor);
+
+	//Инициализация Poll engine
+	fdeventNew(reactor);
+
+	//Инициализация прослушивающего сокета реактора
+	serverInitListener(reactor);
+
+	//Инициализация списка заданий для потока реактора
+	if(jobmainCreate(reactor)!=RESULT_OK) FATAL_ERROR("Init jobmain fail");
+
+	//Регистрация сокета реактора в обработчике событий Poll Engine
+	fdeventAdd(reactor->fdevent, reactor->listen_fd, reactorHandleListenEvent, reactor);
+	fdEventSet(reactor->fdevent, reactor->listen_fd, FDPOLL_IN);
+
+	//Прерывающий eventfd: рабочие потоки будят реактор при возврате соединений в jobmain
+	if((reactor->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) FATAL_ERROR("eventfd fail: %s", strerror(errno));
+	DEBUG_MSG("reactor [%u] wakeup eventfd = %d", (uint32_t)index, reactor->wakeup_fd);
+
+	//Регистрация прерывающего eventfd в обработчике событий Poll Engine
+	fdeventAdd(reactor->fdevent, reactor->wakeup_fd, reactorHandleWakeupEvent, reactor);
+	fdEventSet(reactor->fdevent, reactor->wakeup_fd, FDPOLL_IN);
+
+	return reactor;
+}//END: reactorCreate
+
+
+
+/*
+ * Уничтожение реактора
+ */
+static void
+reactorFree(reactor_s * reactor){
+	if(!reactor) return;
+	DEBUG_MSG("reactor [%u]: connectionsFree()...", (uint32_t)reactor->index);
+	timersFree(reactor);
+	connectionsFree(reactor);
+	if(reactor->wakeup_fd > -1) close(reactor->wakeup_fd);
+	if(reactor->spare_fd > -1) close(reactor->spare_fd);
+	jobmainFree(reactor->jobmain);
+	fdeventFree(reactor->fdevent);
+	socketClose(reactor->listen_fd);
+	mFree(reactor);
+}//END: reactorFree
+
+
+
+/*
+ * Создание реакторов сервера
+ */
+result_e
+reactorsCreate(server_s * srv, size_t count){
+
+	size_t i;
+	if(!count) count = 1;
+
+	srv->reactors		= (reactor_s **)mNewZ(count * sizeof(reactor_s *));
+	srv->reactors_count	= count;
+
+	for(i = 0; i < count; i++){
+		if((srv->reactors[i] = reactorCreate(srv, i)) == NULL) RETURN_ERROR(RESULT_ERROR, "reactorCreate fail");
+	}
+
+	DEBUG_MSG("Reactors created: %u", (uint32_t)count);
+
+	return RESULT_OK;
+}//END: reactorsCreate
+
+
+
+/*
+ * Уничтожение реакторов сервера
+ */
+void
+reactorsFree(server_s * srv){
+	size_t i;
+	if(!srv->reactors) return;
+	for(i = 0; i < srv->reactors_count; i++) reactorFree(srv->reactors[i]);
+	mFree(srv->reactors);
+	srv->reactors		= NULL;
+	srv->reactors_count	= 0;
+}//END: reactorsFree
+
+
+
+/*
+ * Запуск реакторов
+ * Реактор с индексом 0 выполняется в текущем потоке, остальные - в отдельных потоках.
+ * Функция возвращает управление после остановки сервера и завершения всех потоков реакторов
+ */
+result_e
+reactorsStart(server_s * srv){
+
+	size_t i;
+	pthread_attr_t attr;
+
+	if(pthread_attr_init(&attr) != 0) RETURN_ERROR(RESULT_ERROR, "pthread_attr_init error");
+
+	//Установка размера стека потока
+	if(pthread_attr_setstacksize(&attr, worker_thread_stack_size) != 0){
+		pthread_attr_destroy(&attr);
+		RETURN_ERROR(RESULT_ERROR, "pthread set stack size error");
+	}
+
+	for(i = 1; i < srv->reactors_count; i++){
+		if(pthread_create(&(srv->reactors[i]->thread_id), &attr, reactorMain, (void *)srv->reactors[i]) != 0){
+			pthread_attr_destroy(&attr);
+			FATAL_ERROR("reactor [%u] pthread create error", (uint32_t)i);
+		}
+	}
+
+	pthread_attr_destroy(&attr);
+
+	//Реактор 0 - в текущем потоке
+	srv->reactors[0]->thread_id = pthread_self();
+	reactorMain(srv->reactors[0]);
+
+	//Ожидание завершения остальных реакторов
+	for(i = 1; i < srv->reactors_count; i++){
+		pthread_join(srv->reactors[i]->thread_id, NULL);
+	}
+
+	return RESULT_OK;
+}//END: reactorsStart
+
+
+
+/*
+ * Прерывает ожидание poll в потоке реактора
+ * Пока предыдущее пробуждение не обработано реактором, повторная запись в eventfd не выполняется,
+ * поэтому пакет соединений, возвращенных несколькими рабочими потоками, стоит одного системного вызова
+ */
+void
+reactorWakeup(reactor_s * reactor){
+	if(reactor->wakeup_fd < 0) return;
+	if(__atomic_exchange_n(&reactor->wakeup_pending, 1, __ATOMIC_SEQ_CST) == 0) eventfd_write(reactor->wakeup_fd, 1);
+}//END: reactorWakeup
+
+
+
+/*
+ * Обработка исчерпания дескрипторов при приеме соединения (EMFILE / ENFILE)
+ * Прослушиваемый сокет опрашивается по уровню, поэтому непринятое соединение вызывало бы событие на каждой итерации реактора:
+ * соединение принимается на резервный дескриптор и получает ответ 503, а если это невозможно
+ * (резервный дескриптор занят другим процессом при ENFILE) - прием соединений приостанавливается на accept_pause_interval
+ */
+void
+reactorAcceptExhausted(reactor_s * reactor){
+	if(overloadShedSpare(reactor) != RESULT_ERROR) return;
+	if(reactor->accept_paused_ms) return;
+	ERROR_MSG("Reactor [%u]: no file descriptors available, accepting connections paused", (uint32_t)reactor->index);
+	fdEventDelete(reactor->fdevent, reactor->listen_fd);
+	reactor->accept_paused_ms = reactor->current_ms;
+}//END: reactorAcceptExhausted
+
+
+
+/*
+ * Возобновление приема соединений, приостановленного при исчерпании дескрипторов
+ */
+static void
+reactorAcceptResume(reactor_s * reactor){
+	if(reactor->spare_fd < 0) reactor->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	reactor->accept_paused_ms = 0;
+	fdEventSet(reactor->fdevent, reactor->listen_fd, FDPOLL_IN);
+}//END: reactorAcceptResume
+
+
+
+/*
+ * Обновление текущего времени реактора
+ * Таймеры и сроки заданий отсчитываются по монотонному времени, которое не изменяется при переводе системных часов,
+ * отметки времени соединений (*_ts) остаются Unix временем и переводятся в монотонное время через clock_offset_ms
+ */
+static inline void
+reactorClockUpdate(reactor_s * reactor){
+	reactor->current_ms = nowMonotonicMilliseconds();
+	__atomic_store_n(&reactor->clock_offset_ms, nowMilliseconds() - reactor->current_ms, __ATOMIC_RELAXED);
+	reactor->current_ts = (time_t)((reactor->current_ms + reactor->clock_offset_ms) / 1000);
+}//END: reactorClockUpdate
+
+
+
+/*
+ * Основная функция потока реактора: цикл приема соединений и обработки событий
+ */
+static void *
+reactorMain(void * data){
+
+	reactor_s * reactor = (reactor_s *)data;
+	server_s * srv = reactor->server;
+	fdevent_s * fdevent = reactor->fdevent;
+
+	int n;
+	int timeout_ms;
+	#ifdef XG_CONSTAT
+	char stat_name[32];
+	#endif
+	int revents;
+	int poll_index;
+	fdevent_handler handler;
+	void * hdata;
+	result_e result;
+	socket_t fd;
+	time_t old_ts;
+	connection_s * con;
+
+	DEBUG_MSG("Reactor [%u] started, listen FD = %d", (uint32_t)reactor->index, reactor->listen_fd);
+
+	//Привязка реактора к процессору
+	affinityApply(AFFINITY_REACTOR, reactor->index, pthread_self());
+
+	reactorClockUpdate(reactor);
+	old_ts = reactor->current_ts;
+
+	//Основный цикл приема соединений
+	while(XG_STATUS == XGS_WORKING){
+
+		//Текущее время
+		reactorClockUpdate(reactor);
+
+		//Обработка списка заданий jobmain
+		while((con=jobmainGet(reactor->jobmain))!=NULL) connectionEngine(con);
+
+		//Ожидание событий до срабатывания ближайшего таймера соединения,
+		//реактор 0 дополнительно просыпается в начале каждой секунды для выполнения общих задач сервера
+		timeout_ms = (reactor->index == 0 ? (int)(1000 - (reactor->current_ms + reactor->clock_offset_ms) % 1000) : reactor_poll_timeout_max);
+		timeout_ms = timerNextTimeout(reactor, reactor->current_ms, timeout_ms);
+
+		//Прием соединений приостановлен при исчерпании дескрипторов
+		if(reactor->accept_paused_ms){
+			if(reactor->current_ms >= reactor->accept_paused_ms + accept_pause_interval){
+				reactorAcceptResume(reactor);
+			}else{
+				timeout_ms = min(timeout_ms, (int)(reactor->accept_paused_ms + accept_pause_interval - reactor->current_ms));
+			}
+		}
+
+		//Получение новых событий, n - количество новых событий
+		n = fdeventPoll(fdevent, timeout_ms);
+
+		poll_index = -1;
+		//Обработка событий poll engine
+		while(n-- > 0){
+
+			//Получаем индекс массива pollfds, для дескриптора сокета которого есть события или -1, если ничего не найдено
+			if((poll_index = fdEventGetNextIndex(fdevent, poll_index)) == -1) break;
+
+#ifdef USE_EPOLL
+			fd		= fdevent->epollfds[poll_index].data.fd;
+			revents = fdevent->epollfds[poll_index].events;
+#endif
+
+#ifdef USE_POLL
+			fd		= fdevent->pollfds[poll_index].fd;
+			revents = fdevent->pollfds[poll_index].revents;
+#endif
+
+			if (fdevent->fds[fd] == NULL || fdevent->fds[fd]->fd != fd) FATAL_ERROR("fdevent->fds[fd] == NULL || fdevent->fds[fd]->fd != fd");
+			handler = fdevent->fds[fd]->handler;
+			hdata = fdevent->fds[fd]->data;
+
+			switch (result = (*handler)(srv, revents, hdata)){
+				case RESULT_ERROR: FATAL_ERROR("HANDLER RETURNED RESULT_ERROR");
+				default: break;
+			}
+
+		}//Обработка событий poll engine
+
+
+		//Обработка списка заданий jobmain
+		while((con=jobmainGet(reactor->jobmain))!=NULL) connectionEngine(con);
+
+
+		//Обработка сработавших таймеров соединений
+		reactorClockUpdate(reactor);
+		while((con=timerGetExpired(reactor, reactor->current_ms))!=NULL) connectionTimeout(con);
+
+		//Проверка нагрузки на пул рабочих потоков
+		if(reactor->index == 0) threadPoolAdjust(srv->workers, reactor->current_ms);
+
+		//Проверка перегрузки сервера
+		if(reactor->index == 0) overloadCheck(srv, reactor->current_ms);
+
+
+		//Если текущее время изменилось (в секундах, разумеется)
+		if(old_ts != reactor->current_ts){
+
+			//Общие для сервера задачи выполняются только реактором 0
+			if(reactor->index == 0){
+
+				//Добавление внутреннего задания на удаление сессий с истекшим сроком действия
+				if(reactor->current_ts % 60 == 0) jobinternalAdd(JOB_INTERNAL_SESSION_CLEANER, NULL, NULL);
+
+				if(reactor->current_ts % 5 == 0){
+
+					#ifdef XG_MEMSTAT
+					mStatPrint();
+					#endif
+
+					#ifdef XG_CONSTAT
+					printf("\n----------------------------------\n");
+					printf("Server thr idle: %u, active: %u\n", (uint32_t)srv->workers->threads_idle, (uint32_t)srv->workers->threads_count);
+					for(n = 0; n < srv->reactors_count; n++) connectionsPrint(srv->reactors[n]);
+					for(n = 0; n < (int)srv->workers->threads_slots * JOB_CLASSES; n++){
+						if(!srv->workers->threads[n / JOB_CLASSES]) continue;
+						snprintf(stat_name, sizeof(stat_name), "worker %d class %d", n / JOB_CLASSES, n % JOB_CLASSES);
+						joblistPrintStats(srv->workers->threads[n / JOB_CLASSES]->queues[n % JOB_CLASSES], stat_name);
+					}
+					for(n = 0; n < srv->reactors_count; n++) joblistPrintStats(srv->reactors[n]->jobmain, "jobmain");
+					printf("Overload: %s, rejected connections: %" PRIu64 "\n", (overloadActive(srv) ? "yes" : "no"), __atomic_load_n(&srv->overload_shed, __ATOMIC_RELAXED));
+					#endif
+
+				}
+			}
+
+			old_ts = reactor->current_ts;
+
+		}//Если текущее время изменилось (в секундах, разумеется)
+
+
+	}//Основный цикл приема соединений
+
+	DEBUG_MSG("Reactor [%u] stopped", (uint32_t)reactor->index);
+
+	return NULL;
+}//END: reactorMain
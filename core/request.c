@@ -50,11 +50,14 @@ requestClear(request_s * request){
 
 	//Освобождение занятой памяти
 	if(request->data)		bufferFree(request->data);
+	if(request->pipeline)	bufferFree(request->pipeline);
+	if(request->header_list) mFree(request->header_list);
 	if(request->headers)	kvFree(request->headers);
 	if(request->get)		kvFree(request->get);
 	if(request->post)		kvFree(request->post);
 	if(request->cookie)		kvFree(request->cookie);
 	if(request->files)		kvFree(request->files);
+	if(request->multipart)	multipartFree(request->multipart);
 	if(request->ranges)		requestHttpRangesFree(request->ranges);
 	if(request->static_file) requestStaticFileFree(request->static_file);
 	mStringClear(&(request->host));
@@ -153,44 +156,44 @@ requestParseURI(request_uri_s * uri, const char * raw_uri, size_t ilen, const_st
 /*
  * Парсинг первой строки заголовков запроса GET /uri HTTP/x.y[\r\n],
  * возвращает 0 в случае успеха или код HTTP ошибки
+ * Позиции пробелов и недопустимые символы определены при просмотре строки (scanRequestLine)
  */
 int
-requestParseFirstLine(connection_s * con, const char * line, size_t len){
+requestParseFirstLine(connection_s * con, const char * line, const request_line_s * scan){
 
 	request_s * request = &con->request;
 	register const char * ptr = line;
 	register const char * tmp;
-	register const char * end = line + len;
-	size_t n = 0;
+	size_t len = scan->len;
+
+	//Строка запроса содержит недопустимые символы
+	if(scan->illegal) RETURN_ERROR(400, "400 Bad Request");	//400 Bad Request: некорректный запрос -> управляющие символы в строке запроса
+
+	//Строка запроса состоит из трех частей, разделенных пробелом: METHOD /uri HTTP/x.y
+	//Версия протокола имеет фиксированную длинну, поэтому конец URI известен без поиска второго пробела
+	if(scan->spaces != 2 || scan->space < 3 || len < (size_t)scan->space + 11 || line[len - 9] != ' '){
+		RETURN_ERROR(400, "400 Bad Request");	//400 Bad Request: некорректный запрос -> неверное количество частей строки запроса
+	}
 
 	//Метод запроса: GET / POST
-	if(*(int32_t *)ptr == 0x20544547){
+	if(scan->space == 3 && *(int32_t *)ptr == 0x20544547){
 		request->request_method = HTTP_GET;
-		n = 4;
 	}
-	else if(*(int32_t *)ptr == 0x54534f50 && ptr[4] == ' '){
+	else if(scan->space == 4 && *(int32_t *)ptr == 0x54534f50){
 		request->request_method = HTTP_POST;
-		n = 5;
 	}
 	else{
 		RETURN_ERROR(501, "501 Not Implemented");	//501 Not Implemented: сервер не понимает указанный в запросе метод
 	}
 
 	//Пропускаем GET / POST
-	ptr += n;
+	ptr += scan->space + 1;
 
 	//Проверка начала URI (GET /uri... HTTP/x.y)
 	if(*ptr!='/') RETURN_ERROR(400, "400 Bad Request");	//400 Bad Request: некорректный запрос -> символ начала URI [/] не найден
 
-	//Определение URI и его длинны
-	tmp = ptr; 
-	while(tmp < end && *tmp != '\0' && !isspace((int)*tmp)) tmp++;
-
-	//Если при поиске URI не найден пробел -> ошибка
-	//GET [/uri...] HTTP/x.y
-	if(*tmp!=0x20){
-		RETURN_ERROR(400, "400 Bad Request"); //400 Bad Request: некорректный запрос -> пробел после URI не найден
-	}
+	//Конец URI: пробел перед HTTP/x.y
+	tmp = line + len - 9;
 
 	//Парсинг URI
 	if(requestParseURI(&(request->uri), ptr, tmp - ptr, (const_string_s *)&con->server->config.directory_index) != RESULT_OK) RETURN_ERROR(400, "400 Bad Request"); //400 Bad Request: некорректный запрос -> ошибка парсинга URI запроса
@@ -217,175 +220,230 @@ requestParseFirstLine(connection_s * con, const char * line, size_t len){
 
 /*
  * Функция обрабатывает строку заголовка запроса, возвращает 0 в случае успеха или код HTTP ошибки
+ * Позиция разделителя [:] и недопустимые символы определены при просмотре строки (scanRequestLine)
  */
 int
-requestParseHeaderLine(connection_s * con, const char * line, uint32_t len){
+requestParseHeaderLine(connection_s * con, const char * line, const request_line_s * scan){
 
 	request_s * request = &con->request;
 	register const char * ptr = line;
 	register const char * tmp;
-	register const char * end = line + len;
+	register const char * end = line + scan->len;
+	request_header_s * header;
 	size_t n = 0;
-	kv_s * node;
 
 	//Получение заголовков запроса
 	//Каждая строка заголовка имеет следующий вид:
 	//[ключ]: [значение]\r\n
+	//Имя и значение не копируются: заголовок запоминает их позиции в буфере запроса
+
+	//Строка заголовка содержит недопустимые символы
+	if(scan->illegal) RETURN_ERROR(400, "400"); //400 Bad Request: управляющие символы в строке заголовка
 
-	//Поиск разделителя :
-	tmp = charSearchN(ptr, ':', len);
-	if(tmp == NULL) RETURN_ERROR(400, "400"); //400 Bad Request: не найден разделитель [:] или найден за пределами строки
+	//Разделитель :
+	if(scan->colon < 0) RETURN_ERROR(400, "400"); //400 Bad Request: не найден разделитель [:]
+	tmp = ptr + scan->colon;
 
 	n = tmp - ptr;
 	if(!n) RETURN_ERROR(400, "400"); //400 Bad Request: найден ключ нулевой длинны
 
-	//Создание ключа
-	if(!request->headers) request->headers = kvNewRoot();
-	node = kvAppend(request->headers, ptr, n, KV_REPLACE);
+	//Пробелы в имени заголовка и между именем и [:] недопустимы
+	if(scan->space >= 0 && scan->space < scan->colon) RETURN_ERROR(400, "400"); //400 Bad Request: пробел в имени заголовка
+
+	//Массив заголовков создается при первом запросе соединения и сохраняется между запросами keep-alive
+	if(request->headers_count == request->headers_size){
+		if(request->headers_size >= request_headers_max) RETURN_ERROR(431, "431"); //431 Request Header Fields Too Large: слишком много заголовков
+		request->headers_size	= (request->headers_size ? min(request->headers_size * 2, request_headers_max) : request_headers_initial_size);
+		request->header_list	= (request_header_s *)mResize(request->header_list, request->headers_size * sizeof(request_header_s));
+	}
+	header = &request->header_list[request->headers_count++];
+	header->name_n		= (uint32_t)(ptr - request->data->buffer);
+	header->name_len	= (uint32_t)n;
 
 	//Пропускаем [:]
 	tmp++;
 
 	//Пропускаем пробелы после [:]
-	while(*tmp==0x20)tmp++;
+	while(tmp < end && *tmp==0x20)tmp++;
 
-	ptr = tmp;
-	n = end - ptr;
+	header->value_n		= (uint32_t)(tmp - request->data->buffer);
+	header->value_len	= (uint32_t)(end - tmp);
 
-	//Присвоение значения ключу
-	if(n > 0) kvSetString(node, ptr, n);
+	//Значение завершается '\0' на месте [\r] или [\n]: строка уже просмотрена, и значение можно использовать как C строку
+	request->data->buffer[header->value_n + header->value_len] = '\0';
 
 	return 0;
 }//END: requestParseHeaderLine
 
 
 
+/*
+ * Таблица известных заголовков для поиска по совершенной хеш-функции
+ * Хеш: (длина имени + первый символ в нижнем регистре) & 31 - для набора header_index_e коллизий нет,
+ * поэтому распознавание заголовка стоит одного вычисления хеша и одного сравнения имени
+ */
+#define REQUEST_HEADER_HASH_SIZE 32
+#define REQUEST_HEADER_HASH(name, len) (((len) + ((unsigned char)(name)[0] | 0x20)) & (REQUEST_HEADER_HASH_SIZE - 1))
+
+typedef struct{
+	const char *	name;	//Имя заголовка, NULL - пустая ячейка
+	uint32_t		len;	//Длина имени
+	header_index_e	index;	//Индекс заголовка
+} request_header_name_s;
+
+static const request_header_name_s request_header_names[REQUEST_HEADER_HASH_SIZE] = {
+	[7]		= {"X-Forwarded-For",	15,	HEADER_INDEX_X_FORWARDED_FOR},
+	[8]		= {"X-Requested-With",	16,	HEADER_INDEX_X_REQUESTED_WITH},
+	[9]		= {"Cookie",			6,	HEADER_INDEX_COOKIE},
+	[12]	= {"Host",				4,	HEADER_INDEX_HOST},
+	[13]	= {"Connection",		10,	HEADER_INDEX_CONNECTION},
+	[14]	= {"Authorization",		13,	HEADER_INDEX_AUTHORIZATION},
+	[15]	= {"Content-Type",		12,	HEADER_INDEX_CONTENT_TYPE},
+	[16]	= {"Accept-Encoding",	15,	HEADER_INDEX_ACCEPT_ENCODING},
+	[17]	= {"Content-Length",	14,	HEADER_INDEX_CONTENT_LENGTH},
+	[22]	= {"If-None-Match",		13,	HEADER_INDEX_IF_NONE_MATCH},
+	[23]	= {"Range",				5,	HEADER_INDEX_RANGE},
+	[25]	= {"Referer",			7,	HEADER_INDEX_REFERER},
+	[26]	= {"If-Modified-Since",	17,	HEADER_INDEX_IF_MODIFIED_SINCE},
+	[31]	= {"User-Agent",		10,	HEADER_INDEX_USER_AGENT}
+};
+
+
+
+/*
+ * Возвращает индекс известного заголовка с именем name длиной len или HEADER_KNOWN, если заголовок неизвестен
+ */
+static inline header_index_e
+_requestHeaderIndex(const char * name, uint32_t len){
+	const request_header_name_s * known;
+	if(!len) return HEADER_KNOWN;
+	known = &request_header_names[REQUEST_HEADER_HASH(name, len)];
+	if(known->len != len || !stringCompareCaseN(name, known->name, len)) return HEADER_KNOWN;
+	return known->index;
+}//END: _requestHeaderIndex
+
+
+
+/*
+ * Отмечает заголовок i как известный заголовок index
+ */
+static inline void
+_requestHeaderKnown(request_s * request, header_index_e index, uint32_t i){
+	request->headers_bits |= BIT(index);
+	request->headers_known[index] = (uint16_t)(i + 1);
+}//END: _requestHeaderKnown
+
+
+
 /*
  * Обработка заголовков запроса в переменные соединения, возвращает 0 в случае успеха или код HTTP ошибки
  */
 int
 requestHeadersToVariables(connection_s * con){
 	request_s * request = &(con->request);
-	kv_s * headers = request->headers;
-	if(!headers) return 0;
-	kv_s * node;
+	request_header_s * header;
+	const char * name;
+	const char * value;
+	header_index_e index;
+	uint32_t i, len;
 	int n;
 	const char * ptr;
 
-	//Просмотр заголовков
-	for(node = headers->value.v_list.first; node; node = node->next){
-		if(!node->key_name || !node->key_len) continue;
-
-		//Найден Content-Length
-		if(BIT_ISUNSET(request->headers_bits,HEADER_CONTENT_LENGTH) && node->key_len == 14 && stringCompareCaseN(node->key_name,"Content-Length", 14)){
-			request->headers_bits |= HEADER_CONTENT_LENGTH;
-			con->request.content_length = atol(node->value.v_string.ptr);
-			//Метод запроса - не POST
-			if(con->request.request_method != HTTP_POST && con->request.content_length > 0){
-				RETURN_ERROR(400,"Warning: Content-Length is forbidden for GET request method");
-				//400 Bad request
-			}
-			//Значение Content-Length больше лимита на размер POST контента
-			if(con->request.content_length > con->server->config.max_post_size){
-				RETURN_ERROR(413, "Warning: Content-Length too large [%u] but maximum is [%u]", con->request.content_length, con->server->config.max_post_size);
-				//413 Request Entity Too Large: Очень длинный запрос
-			}
-			continue;
-		}
+	//HTTP/1.1 по-умолчанию сохраняет соединение, HTTP/1.0 - только при наличии "Connection: keep-alive"
+	request->keep_alive = (request->http_version == HTTP_VERSION_1_1);
 
-		//Найден Content-Type
-		if(BIT_ISUNSET(request->headers_bits,HEADER_CONTENT_TYPE) && node->key_len == 12 && stringCompareCaseN(node->key_name,"Content-Type", 12)){
-			request->headers_bits |= HEADER_CONTENT_TYPE;
-			//multipart/form-data; boundary=----WebKitFormBoundaryZd4wrriBn2H7dq1A
-			if(stringCompareCaseN(node->value.v_string.ptr, "multipart/form-data;", 20)){
-				con->request.post_method = POST_MULTIPART;
-				n = 0;
-				if(stringCompareCaseN(node->value.v_string.ptr+21, "boundary=", 9)){
-					ptr = node->value.v_string.ptr+30;
-					if(*ptr != '\0'){
-						con->request.multipart_boundary.ptr = stringClone(ptr, &(con->request.multipart_boundary.len));
-						DEBUG_MSG("MULTIPART BOUNDARY FOUND = [%s]\n", con->request.multipart_boundary.ptr);
-						n = 1;
+	//Просмотр заголовков
+	for(i = 0; i < request->headers_count; i++){
+		header	= &request->header_list[i];
+		name	= request->data->buffer + header->name_n;
+		value	= request->data->buffer + header->value_n;
+		len		= header->name_len;
+
+		//Известный заголовок: учитывается только первое вхождение, пустой Host пропускается
+		index = _requestHeaderIndex(name, len);
+		if(index == HEADER_KNOWN || BIT_ISSET(request->headers_bits, BIT(index))) continue;
+		if(index == HEADER_INDEX_HOST && !header->value_len) continue;
+		_requestHeaderKnown(request, index, i);
+
+		switch(index){
+
+			//Connection
+			case HEADER_INDEX_CONNECTION:
+				//Значение может быть списком через запятую: "keep-alive, Upgrade"
+				for(ptr = value; ptr && *ptr; ptr = strchr(ptr, ',')){
+					while(*ptr == ',' || *ptr == ' ' || *ptr == '\t') ptr++;
+					if(stringCompareCaseN(ptr, "close", 5)) request->keep_alive = false;
+					else
+					if(stringCompareCaseN(ptr, "keep-alive", 10)) request->keep_alive = true;
+				}
+				break;
+
+			//Content-Length
+			case HEADER_INDEX_CONTENT_LENGTH:
+				con->request.content_length = atol(value);
+				//Метод запроса - не POST
+				if(con->request.request_method != HTTP_POST && con->request.content_length > 0){
+					RETURN_ERROR(400,"Warning: Content-Length is forbidden for GET request method");
+					//400 Bad request
+				}
+				break;
+
+			//Content-Type
+			case HEADER_INDEX_CONTENT_TYPE:
+				//multipart/form-data; boundary=----WebKitFormBoundaryZd4wrriBn2H7dq1A
+				if(stringCompareCaseN(value, "multipart/form-data;", 20)){
+					con->request.post_method = POST_MULTIPART;
+					n = 0;
+					if(stringCompareCaseN(value+21, "boundary=", 9)){
+						ptr = value+30;
+						if(*ptr != '\0'){
+							con->request.multipart_boundary.ptr = stringClone(ptr, &(con->request.multipart_boundary.len));
+							DEBUG_MSG("MULTIPART BOUNDARY FOUND = [%s]\n", con->request.multipart_boundary.ptr);
+							n = 1;
+						}
+					}
+					if(!n){
+						RETURN_ERROR(400, "Warning: bad headers -> content type is [multipart/form-data] but boundary not set.");
+						//400 Bad Request: найден ключ нулевой длинны
 					}
 				}
-				if(!n){
-					RETURN_ERROR(400, "Warning: bad headers -> content type is [multipart/form-data] but boundary not set.");
+				else 
+				if(stringCompareCaseN(value, "application/x-www-form-urlencoded", 33)){
+					con->request.post_method = POST_URLENCODED;
+				}
+				else{
+					RETURN_ERROR(400,"Warning: bad headers -> content type for POST request is undefined [%s]\n", value);
 					//400 Bad Request: найден ключ нулевой длинны
 				}
-			}
-			else 
-			if(stringCompareCaseN(node->value.v_string.ptr, "application/x-www-form-urlencoded", 33)){
-				con->request.post_method = POST_URLENCODED;
-			}
-			else{
-				RETURN_ERROR(400,"Warning: bad headers -> content type for POST request is undefined [%s]\n", node->value.v_string.ptr);
-				//400 Bad Request: найден ключ нулевой длинны
-			}
-			continue;
-		}
-
-		//Найден Cookie
-		if(BIT_ISUNSET(request->headers_bits,HEADER_COOKIE) && node->key_len == 6 && stringCompareCaseN(node->key_name,"Cookie", 6)){
-			request->headers_bits |= HEADER_COOKIE;
-			con->request.cookie = requestParseCookies(node->value.v_string.ptr);
-			continue;
-		}
-
-		//Найден Range
-		if(BIT_ISUNSET(request->headers_bits,HEADER_RANGE) && node->key_len == 5 && stringCompareCaseN(node->key_name,"Range", 6)){
-			request->headers_bits |= HEADER_RANGE;
-			if(stringCompareCaseN(node->value.v_string.ptr, "bytes=", 6)){
-				//Разбираем HTTP Ranges
-				con->request.ranges = requestParseHttpRanges(node->value.v_string.ptr+6, &n);
-				//Если в процессе разбора возникла ошибка - возвращаем ее (ошибка имеет номер HTTP ошибки)
-				if(n != 0) RETURN_ERROR(n,"HTTP Ranges parsing error");
-			}
-			continue;
-		}
+				break;
+
+			//Range
+			case HEADER_INDEX_RANGE:
+				if(stringCompareCaseN(value, "bytes=", 6)){
+					//Разбираем HTTP Ranges
+					con->request.ranges = requestParseHttpRanges(value+6, &n);
+					//Если в процессе разбора возникла ошибка - возвращаем ее (ошибка имеет номер HTTP ошибки)
+					if(n != 0) RETURN_ERROR(n,"HTTP Ranges parsing error");
+				}
+				break;
 
-		//Найден X-Requested-With
-		if(BIT_ISUNSET(request->headers_bits,HEADER_X_REQUESTED_WITH) && node->key_len == 16 && stringCompareCaseN(node->key_name,"X-Requested-With", 16)){
-			request->headers_bits |= HEADER_X_REQUESTED_WITH;
-			if(stringCompareCaseN(node->value.v_string.ptr, "XMLHttpRequest", 14)) con->request.is_ajax = true;
-			continue;
-		}
+			//X-Requested-With
+			case HEADER_INDEX_X_REQUESTED_WITH:
+				if(stringCompareCaseN(value, "XMLHttpRequest", 14)) con->request.is_ajax = true;
+				break;
 
-		//Найден Host
-		if(BIT_ISUNSET(request->headers_bits,HEADER_HOST) && node->key_len == 4 && stringCompareCaseN(node->key_name,"Host", 4)){
-			if(node->value.v_string.len > 0){
-				request->headers_bits |= HEADER_HOST;
+			//Host
+			case HEADER_INDEX_HOST:
 				//host:port
-				if((ptr = strchr(node->value.v_string.ptr, ':')) != NULL){
-					con->request.host.ptr = stringCloneN(node->value.v_string.ptr, ptr - node->value.v_string.ptr, &(con->request.host.len));
+				if((ptr = strchr(value, ':')) != NULL){
+					con->request.host.ptr = stringCloneN(value, ptr - value, &(con->request.host.len));
 				}else{
-					con->request.host.ptr = stringCloneN(node->value.v_string.ptr, node->value.v_string.len, &(con->request.host.len));
+					con->request.host.ptr = stringCloneN(value, header->value_len, &(con->request.host.len));
 				}
-			}
-			continue;
-		}
-
-		//Найден If-None-Match
-		if(BIT_ISUNSET(request->headers_bits,HEADER_IF_NONE_MATCH) && node->key_len == 13 && stringCompareCaseN(node->key_name,"If-None-Match", 13)){
-			request->headers_bits |= HEADER_IF_NONE_MATCH;
-			request->if_none_match.ptr = (const char *)node->value.v_string.ptr;
-			request->if_none_match.len = node->value.v_string.len;
-			continue;
-		}
-
-		//Найден User-Agent
-		if(BIT_ISUNSET(request->headers_bits,HEADER_USER_AGENT) && node->key_len == 10 && stringCompareCaseN(node->key_name,"User-Agent", 10)){
-			request->headers_bits |= HEADER_USER_AGENT;
-			request->user_agent.ptr = (const char *)node->value.v_string.ptr;
-			request->user_agent.len = node->value.v_string.len;
-			continue;
-		}
+				break;
 
-		//Найден Referer
-		if(BIT_ISUNSET(request->headers_bits,HEADER_REFERER) && node->key_len == 7 && stringCompareCaseN(node->key_name,"Referer", 7)){
-			request->headers_bits |= HEADER_REFERER;
-			request->referer.ptr = (const char *)node->value.v_string.ptr;
-			request->referer.len = node->value.v_string.len;
-			continue;
+			//Остальные известные заголовки только запоминаются в таблице headers_known
+			default: break;
 		}
 
 	}//Просмотр заголовков
@@ -404,6 +462,12 @@ requestHeadersToVariables(connection_s * con){
 	if(con->request.request_method == HTTP_POST){
 		if(BIT_ISUNSET(request->headers_bits,HEADER_CONTENT_LENGTH)) RETURN_ERROR(411,"411");	//Length Required - для указанного ресурса клиент должен указать Content-Length в заголовке запроса
 		if(con->request.post_method == POST_UNDEFINED) RETURN_ERROR(400,"400");	//Метод POST запроса не опредлен
+		//Значение Content-Length больше лимита на размер POST контента (multipart/form-data не хранится в памяти целиком и имеет свой лимит)
+		n = (con->request.post_method == POST_MULTIPART ? con->server->config.max_multipart_size : con->server->config.max_post_size);
+		if(con->request.content_length > (uint32_t)n){
+			RETURN_ERROR(413, "Warning: Content-Length too large [%u] but maximum is [%u]", con->request.content_length, n);
+			//413 Request Entity Too Large: Очень длинный запрос
+		}
 	}
 
 	return 0;
@@ -569,266 +633,146 @@ requestParseUrlEncodedForm(connection_s * con){
 
 
 /*
- * Функция обрабатывает POST запрос multipart/form-data
+ * Функция возвращает текстовое описание метода запроса
  */
-/*
-------WebKitFormBoundaryrCtjrJ8JevAUKXAd
-Content-Disposition: form-data; name="str1"
-
-str1 string
-------WebKitFormBoundaryrCtjrJ8JevAUKXAd
-Content-Disposition: form-data; name="str2"
-
-str2 string
-------WebKitFormBoundaryrCtjrJ8JevAUKXAd
-Content-Disposition: form-data; name="file1"; filename="dh1024.pem"
-Content-Type: application/x-x509-ca-cert
-
------BEGIN DH PARAMETERS-----
-MIGHAoGBANmAnfkETuKHOCWaE+W+F3kM/e7z5A8hZb7OqwGMQrUOaBEAr4BWeZBn
-G/87hhwZgNP69/KUchm714qd/PpOspCaUJ20x6PcmKujpAgca/f19HGMBjRawQMk
-R9oaBwazuQT0l0rTTKmvpMEcrQQIcVWii3CZI56I56oqF8biGPD7AgEC
------END DH PARAMETERS-----
-
-------WebKitFormBoundaryrCtjrJ8JevAUKXAd
-*/
-result_e
-requestParseMultipartForm(connection_s * con){
-
-	buffer_s * buf = con->request.data;
-	request_parser_s * parser = &(con->request.parser);
-	const char * ptr = &buf->buffer[parser->body_n];
-	const char * end = ptr + parser->body_len;
-	const char * name;
-	uint32_t name_len;
-	const char * filename;
-	uint32_t filename_len;
-	const char * ctype;
-	uint32_t ctype_len;
-	const char * value;
-	uint32_t value_len;
-	kv_s * node;
-	post_file_s * file;
-	const char * tmp;
-	const char * boundary = con->request.multipart_boundary.ptr;
-	uint32_t boundary_len = con->request.multipart_boundary.len;
-
-	const char * h;
-	const char * eh = end - boundary_len - 1;
-
-	//Граница не найдена
-	if(*(int16_t *)ptr != 0x2D2D || !stringCompareN(ptr+2, boundary, boundary_len)) RETURN_ERROR(RESULT_ERROR, "First boundary not found");
-
-	//Парсинг multipart/form-data
-	while(ptr < end){
-
-		name			= NULL;
-		name_len		= 0;
-		filename		= NULL;
-		filename_len	= 0;
-		ctype			= NULL;
-		ctype_len		= 0;
-		value			= NULL;
-		value_len		= 0;
-
-		//Пропускаем границу (длинна границы + 2 символа [-] в начале)
-		ptr += boundary_len + 2;
-
-		//Если после границы найдены два завершающих символа "--" - выход
-		if(*(int16_t *)ptr == 0x2D2D) return RESULT_OK;
-
-		//Если после границы не найдены символы перевода строки "\r\n"
-		if(*(int16_t *)ptr != 0x0A0D) RETURN_ERROR(RESULT_ERROR, "RN not found");
-
-		//Пропускаем символы перевода строки
-		ptr+=2;
-
-		//Не найдено Content-Disposition:
-		if(!*ptr || !stringCompareCaseN(ptr, "Content-Disposition:", 20)) RETURN_ERROR(RESULT_ERROR, "Content-Disposition not found");
-
-		//Пропускаем "Content-Disposition:"
-		ptr+=20;
-
-		//Пропускаем после "Content-Disposition:" слова "form-data" "attachment" и т.д. до символа [;]
-		while(*ptr && *ptr!=';' && *ptr!='\n')ptr++;
-		if(*ptr!=';') RETURN_ERROR(RESULT_ERROR, "*ptr!=';'");
-		ptr++;
-
-		//Пропускаем пробелы
-		while(*ptr && *ptr==0x20)ptr++;
-
-		//Ищем [name="]
-		if(!*ptr || !stringCompareCaseN(ptr, "name=\"", 6)) RETURN_ERROR(RESULT_ERROR, "name=\" not found");
-		ptr+=6;
-
-		//Начало имени переменной
-		name = ptr;
-
-		//Ищем окончание имени переменной
-		while(*ptr && *ptr!='"' && *ptr!='\n') ptr++;
-		if(*ptr!='"') RETURN_ERROR(RESULT_ERROR, "\" not found");
-
-		//Длинна имени переменной
-		name_len = ptr - name;
-
-		//Пропускаем завершающий ["]
-		ptr++;
-
-		//Пропускаем пробелы
-		while(*ptr && *ptr==0x20)ptr++;
-
-		//Если найден конец строки - то это текстовая переменная а не файл
-		if(*(int32_t *)ptr == 0x0A0D0A0D) goto label_value;
-
-		if(*ptr!=';') RETURN_ERROR(RESULT_ERROR, "; not found");
-		ptr++;
-		while(*ptr && *ptr==0x20)ptr++;
-
-		//Ищем [filename="]
-		if(!*ptr || !stringCompareCaseN(ptr, "filename=\"", 10)) RETURN_ERROR(RESULT_ERROR, "filename=\" not found: [%s]", ptr);
-		ptr+=10;
-
-		//Начало имени файла
-		filename = ptr;
-
-		//Ищем окончание имени файла
-		while(*ptr && *ptr!='"' && *ptr!='\n') ptr++;
-		if(*ptr!='"') RETURN_ERROR(RESULT_ERROR, "\" not found");
-
-		//Длинна имени переменной
-		filename_len = ptr - filename;
-
-		//Пропускаем завершающий ["]
-		ptr++;
-
-		//Если после имени файла не найдены символы перевода строки "\r\n"
-		if(*(int16_t *)ptr != 0x0A0D) RETURN_ERROR(RESULT_ERROR, "RN not found");
-
-		//Пропускаем \r\n
-		ptr+=2;
-
-		//Поскольку это файл, то следующей строкой должно идти [Content-Type:] 
-		if(!*ptr || !stringCompareCaseN(ptr, "Content-Type:", 13)) RETURN_ERROR(RESULT_ERROR, "Content-Type not found");
-
-		//Пропускаем "Content-Type:"
-		ptr+=13;
-
-		//Пропускаем пробелы
-		while(*ptr && *ptr==0x20)ptr++;
-
-		//Начало типа контента
-		ctype = ptr;
-
-		//Ищем окончание строки
-		while(*ptr && *ptr!='\r' && *ptr!='\n')ptr++;
-		if(*ptr!='\r') RETURN_ERROR(RESULT_ERROR, "RN not found");
+const char *
+requestMethodString(request_method_e method){
+	switch (method) {
+		case HTTP_GET: return "GET";
+		case HTTP_POST: return "POST";
+		default:  return "UNDEFINED";
+	}
+}//END: requestMethodString
 
-		//Длинна типа контента
-		ctype_len = ptr - ctype;
 
-		//Если не найден конец строки - ошибка
-		if(*(int32_t *)ptr != 0x0A0D0A0D) RETURN_ERROR(RESULT_ERROR, "RNRN not found");
 
+/*
+ * Функция возвращает значение заголовка (поиск имени без учета регистра)
+ */
+const char *
+requestGetHeader(connection_s * con, const char * header){
+	if(!con || !con->request.headers_count || !header) return NULL;
+	request_s * request = &con->request;
+	request_header_s * node;
+	size_t len = strlen(header);
+	uint32_t i;
+	header_index_e index = _requestHeaderIndex(header, (uint32_t)len);
+	//Известный заголовок берется из таблицы headers_known
+	if(index != HEADER_KNOWN) return requestGetKnownHeader(con, index, NULL);
+	for(i = 0; i < request->headers_count; i++){
+		node = &request->header_list[i];
+		if(node->name_len == len && stringCompareCaseN(request->data->buffer + node->name_n, header, len)) return request->data->buffer + node->value_n;
+	}
+	return NULL;
+}//END: requestGetHeader
 
-		//Определение значения переменной
-		label_value:
 
-		ptr+=4;
 
-		//значение переменной
-		value = ptr;
+/*
+ * Функция возвращает значение известного заголовка из таблицы headers_known или NULL, если заголовок не получен
+ */
+const char *
+requestGetKnownHeader(connection_s * con, header_index_e index, uint32_t * olen){
+	request_s * request = &con->request;
+	request_header_s * node;
+	if(index >= HEADER_KNOWN || !request->headers_known[index]){
+		if(olen) *olen = 0;
+		return NULL;
+	}
+	node = &request->header_list[request->headers_known[index] - 1];
+	if(olen) *olen = node->value_len;
+	return request->data->buffer + node->value_n;
+}//END: requestGetKnownHeader
 
-		//Поиск следующего вхождения границы
-		//Не проверяем на \0, т.к. могут быть бинарные данные
-		h = ptr;
-		tmp = NULL;
-		while(h <= eh){
-			if(*(int16_t *)h == 0x2D2D && stringCompareN(h+2, boundary, boundary_len)){tmp = h; break;}
-			++h;
-		}
 
-		//Граница не найдена
-		if(tmp == NULL) RETURN_ERROR(RESULT_ERROR,"tmp == NULL : [%s]\n[%s]",ptr, eh);
 
-		//Начало границы
-		ptr = tmp;
+/*
+ * Функция возвращает заголовки запроса в виде KV
+ * Структура KV создается при первом обращении, при обработке запроса заголовки не копируются
+ */
+kv_s *
+requestGetHeaders(connection_s * con){
+	request_s * request = &con->request;
+	request_header_s * node;
+	uint32_t i;
+	if(request->headers || !request->headers_count) return request->headers;
+	request->headers = kvNewRoot();
+	for(i = 0; i < request->headers_count; i++){
+		node = &request->header_list[i];
+		kvSetString(kvAppend(request->headers, request->data->buffer + node->name_n, node->name_len, KV_REPLACE), request->data->buffer + node->value_n, node->value_len);
+	}
+	return request->headers;
+}//END: requestGetHeaders
 
-		//Пропускаем \r\n перед границей
-		//Если \r\n не найдено - ошибка
-		tmp-=2;
-		if(*(int16_t *)tmp != 0x0A0D) RETURN_ERROR(RESULT_ERROR,"RN not found");
-		value_len = tmp - value;
 
-		if(!name && !filename) continue;
 
-		//Добавление переменной / файла в массив
-		if(!name){
-			name = filename;
-			name_len = filename_len;
-		}
+/*
+ * Разбор источника переменных запроса source при первом обращении к нему
+ */
+static void
+_requestParseVars(connection_s * con, request_vars_e source){
+	request_s * request = &(con->request);
+	if(BIT_ISSET(request->vars_parsed, source)) return;
+	request->vars_parsed |= source;
+	switch(source){
+		case REQUEST_VARS_GET:
+			if(request->uri.query.ptr && request->uri.query.len > 0) request->get = kvFromQueryString(request->uri.query.ptr);
+		break;
+		case REQUEST_VARS_POST:
+			//multipart/form-data разбирается по мере получения тела запроса (core/multipart.c)
+			if(request->request_method == HTTP_POST && request->post_method == POST_URLENCODED) requestParseUrlEncodedForm(con);
+		break;
+		case REQUEST_VARS_COOKIE:
+			request->cookie = requestParseCookies(requestGetKnownHeader(con, HEADER_INDEX_COOKIE, NULL));
+		break;
+	}
+}//END: _requestParseVars
 
-		//POST переменная ключ = значение
-		if(!filename){
 
-			if(!con->request.post) con->request.post = kvNewRoot();
-			node = kvAppend(con->request.post, name, name_len, KV_REPLACE);
-			if(value && value_len>0) kvSetString(node, value, value_len);
 
+/*
+ * Поиск параметра name в строке параметров str без ее разбора и декодирования
+ * separator - разделитель параметров: [&] для query string, [;] для Cookie (пробелы после разделителя пропускаются)
+ * Возвращает указатель на значение в исходной строке или NULL, длинна значения записывается в olen
+ */
+static const char *
+_requestFindRawParam(const char * str, const char * name, char separator, uint32_t * olen){
+	size_t name_len = strlen(name);
+	const char * end;
+	while(str && *str){
+		while(*str == ' ') str++;
+		if(!(end = strchr(str, separator))) end = str + strlen(str);
+		if((size_t)(end - str) > name_len && str[name_len] == '=' && strncmp(str, name, name_len) == 0){
+			if(olen) *olen = (uint32_t)(end - str - name_len - 1);
+			return str + name_len + 1;
 		}
-		//Файл
-		else{
-			if(value && value_len > 0){
-				if(!con->request.files) con->request.files = kvNewRoot();
-				file = (post_file_s *)mNewZ(sizeof(post_file_s));
-				node = kvSetPointer(kvAppend(con->request.files, name, name_len, KV_REPLACE), file, mFree);
-				file->filename.ptr = filename;
-				file->filename.len = filename_len;
-				file->content.ptr = value;
-				file->content.len = value_len;
-				if(ctype && ctype_len > 0){
-					file->mimetype.ptr = ctype;
-					file->mimetype.len = ctype_len;
-				}else{
-					file->mimetype.ptr = "application/octet-stream";
-					file->mimetype.len = 24;
-				}
-			}
-		}//Файл
-
-	}//Парсинг multipart/form-data
-
-	//Неожиданное окончание контента
-	return RESULT_ERROR;
-
-}//END: requestParseMultipartForm
-
+		str = (*end ? end + 1 : end);
+	}
+	if(olen) *olen = 0;
+	return NULL;
+}//END: _requestFindRawParam
 
 
 
 /*
- * Функция возвращает текстовое описание метода запроса
+ * Возвращает значение GET параметра name без декодирования (указатель на query string запроса) или NULL
+ * В отличие от requestGetGPC(), query string не разбирается целиком
  */
 const char *
-requestMethodString(request_method_e method){
-	switch (method) {
-		case HTTP_GET: return "GET";
-		case HTTP_POST: return "POST";
-		default:  return "UNDEFINED";
-	}
-}//END: requestMethodString
+requestGetQueryRaw(connection_s * con, const char * name, uint32_t * olen){
+	return _requestFindRawParam((con->request.uri.query.len > 0 ? con->request.uri.query.ptr : NULL), name, '&', olen);
+}//END: requestGetQueryRaw
 
 
 
 /*
- * Функция возвращает значение заголовка
+ * Возвращает значение Cookie name без декодирования (указатель на заголовок Cookie) или NULL
+ * В отличие от requestGetGPC(), заголовок Cookie не разбирается целиком
  */
 const char *
-requestGetHeader(connection_s * con, const char * header){
-	if(!con || !con->request.headers || !header) return NULL;
-	kv_s * node = kvSearch(con->request.headers, header, 0);
-	if(node) return node->value.v_string.ptr;
-	return NULL;
-}//END: requestGetHeader
+requestGetCookieRaw(connection_s * con, const char * name, uint32_t * olen){
+	return _requestFindRawParam(requestGetKnownHeader(con, HEADER_INDEX_COOKIE, NULL), name, ';', olen);
+}//END: requestGetCookieRaw
 
 
 
@@ -844,9 +788,9 @@ requestGetGPC(connection_s * con, const char * name, const char * rv, uint32_t *
 	uint32_t len, hash = hashString(name, &len);
 	while(*rv){
 		switch(*rv){
-			case 'g': case 'G': vars = con->request.get; break;
-			case 'p': case 'P': vars = con->request.post; break;
-			case 'c': case 'C': vars = con->request.cookie; break;
+			case 'g': case 'G': _requestParseVars(con, REQUEST_VARS_GET); vars = con->request.get; break;
+			case 'p': case 'P': _requestParseVars(con, REQUEST_VARS_POST); vars = con->request.post; break;
+			case 'c': case 'C': _requestParseVars(con, REQUEST_VARS_COOKIE); vars = con->request.cookie; break;
 			default: vars = NULL;
 		}
 		rv++;
@@ -867,7 +811,9 @@ requestGetGPC(connection_s * con, const char * name, const char * rv, uint32_t *
  */
 post_file_s *
 requestGetFile(connection_s * con, const char * name){
-	if(!con || con->request.request_method != HTTP_POST || con->request.post_method != POST_MULTIPART || !con->request.files || !name) return NULL;
+	if(!con || con->request.request_method != HTTP_POST || con->request.post_method != POST_MULTIPART || !name) return NULL;
+	_requestParseVars(con, REQUEST_VARS_POST);
+	if(!con->request.files) return NULL;
 	return (post_file_s *)kvGetPointerByPath(con->request.files, name, NULL);
 }//END: requestGetFile
 
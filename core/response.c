@@ -59,6 +59,16 @@ responseHTTPVersionString(http_version_e v){
 }//END: responseHTTPVersionString
 
 
+
+/*
+ * Функция возвращает значение заголовка Connection для ответа сервера
+ */
+const char *
+responseConnectionString(connection_s * con){
+	return (con->keep_alive ? "keep-alive" : "close");
+}//END: responseConnectionString
+
+
 /*
  * Функция возвращает текстовое представление кода HTTP ответа, согласно номеру ответа
  */
@@ -83,7 +93,7 @@ responseCodeCode(int http_code){
 		case 412: return "412";	case 413: return "413";
 		case 414: return "414";	case 415: return "415";
 		case 416: return "416";	case 417: return "417";
-		case 429: return "429";
+		case 429: return "429";	case 431: return "431";
 		case 500: return "500";	case 501: return "501";
 		case 502: return "502";	case 503: return "503";
 		case 504: return "504";	case 505: return "505";
@@ -138,6 +148,7 @@ responseCodeString(int http_code){
 		case 416: return "Requested Range Not Satisfiable";	//запрашиваемый диапазон не достижим. в поле Range заголовка запроса был указан диапазон за пределами ресурса и отсутствует поле If-Range
 		case 417: return "Expectation Failed";	//по каким-то причинам сервер не может удовлетворить значению поля Expect заголовка запроса
 		case 429: return "Too Many Requests";	//клиент попытался отправить слишком много запросов за короткое время, что может указывать, например, на попытку DoS-атаки. Может сопровождаться заголовком Retry-After, указывающим, через какое время можно повторить запрос
+		case 431: return "Request Header Fields Too Large";	//сервер отказывается обработать запрос, т.к. заголовков запроса слишком много или они слишком длинные
 
 		case 500: return "Internal Server Error";	//любая внутренняя ошибка сервера, которая не входит в рамки остальных ошибок класса
 		case 501: return "Not Implemented";	//сервер не поддерживает возможностей, необходимых для обработки запроса
@@ -169,13 +180,15 @@ responseHttpLocation(connection_s * con, const char * location, bool temporarily
 		"%s %s %s\r\n" \
 		"Server: %s\r\n" \
 		"Location: %s\r\n" \
-		"Connection: close\r\n" \
+		"Content-Length: 0\r\n" \
+		"Connection: %s\r\n" \
 		"\r\n",
 		responseHTTPVersionString(con->request.http_version),
 		responseCodeCode(con->http_code),
 		responseCodeString(con->http_code),
 		XG_SERVER_VERSION,
-		location
+		location,
+		responseConnectionString(con)
 	);
 
 	connectionSetStage(con, CON_STAGE_WORKING);
@@ -231,14 +244,15 @@ responseHttpError(connection_s * con){
 		"Content-Type: text/html; charset=UTF-8\r\n" \
 		"Content-Length: %d\r\n" \
 		"Date: %g\r\n" \
-		"Connection: close\r\n" \
+		"Connection: %s\r\n" \
 		"\r\n",
 		responseHTTPVersionString(con->request.http_version),
 		responseCodeCode(con->http_code),
 		responseCodeString(con->http_code),
 		XG_SERVER_VERSION,
 		(int64_t)con->response.content->content_length,
-		(time_t)time(NULL)
+		(time_t)time(NULL),
+		responseConnectionString(con)
 	);
 
 	connectionSetStage(con, CON_STAGE_WORKING);
@@ -323,7 +337,7 @@ responseBuildHeaderLines(buffer_s * buffer, kv_s * headers){
 	kvAppendString(headers, "Server", XG_SERVER_VERSION, 0, KV_BREAK);
 	kvAppendString(headers, "Date", tmp, tmp_len, KV_BREAK);
 	kvAppendString(headers, "Content-Type", "text/html; charset=UTF-8", 24, KV_BREAK);
-	kvAppendString(headers, "Connection", "close", 5, KV_REPLACE);
+	kvAppendString(headers, "Connection", "close", 5, KV_BREAK);
 
 	//Заголовки ответа сервера
 	kvEcho(headers, KVF_HEADERS, buffer);
@@ -365,6 +379,12 @@ responseBuildHeaders(connection_s * con){
 	//Генерация первой строки ответа сервера
 	responseBuildFirstLine(con->response.head, con->http_code, con->request.http_version);
 
+	//Размер контента и состояние соединения: без Content-Length клиент не сможет определить конец ответа на keep-alive соединении
+	if(con->response.headers){
+		kvAppendInt(con->response.headers, "Content-Length", con->response.content->content_length, KV_BREAK);
+		kvAppendString(con->response.headers, "Connection", responseConnectionString(con), 0, KV_REPLACE);
+	}
+
 	//Генерация заголовков ответа сервера
 	responseBuildHeaderLines(con->response.head, con->response.headers);
 
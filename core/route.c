@@ -17,29 +17,54 @@
  * Функции
  **********************************************************************/
 
+/*
+ * Освобождение структуры маршрута при удалении из XG_ROUTES
+ */
+static void
+_routeFree(void * route){
+	mFree(route);
+}//END: _routeFree
+
+
+
 /*
  * Добавляет функцию-обработчик запроса для обработки определенного маршрута
+ * job_class - класс заданий обработчика: определяет приоритет обработчика в очередях рабочих потоков
  */
 bool
-routeAdd(const char * path, route_cb v_function){
-	if(!path || !v_function) return false;
-	kvSetFunctionByPath(XG_ROUTES, path, v_function);
+routeAdd(const char * path, route_cb v_function, job_class_e job_class){
+	if(!path || !v_function || job_class >= JOB_CLASSES) return false;
+	route_s * route		= (route_s *)mNewZ(sizeof(route_s));
+	route->handler		= v_function;
+	route->job_class	= job_class;
+	kvSetPointerByPath(XG_ROUTES, path, route, _routeFree);
 	return true;
 }//END: routeAdd
 
 
 
 /*
- * Ищет функцию-обработчик запроса для обработки определенного маршрута
+ * Ищет маршрут (функцию-обработчик запроса и класс ее заданий) для определенного пути
  */
-route_cb
+route_s *
 routeGet(const char * path){
 	if(!path) return NULL;
-	return (route_cb)kvGetFunctionByPath(XG_ROUTES, path, NULL);
+	return (route_s *)kvGetPointerByPath(XG_ROUTES, path, NULL);
 }//END: routeGet
 
 
 
+/*
+ * Задает время (в миллисекундах от начала запроса), после которого запрос маршрута,
+ * ожидающий в очереди рабочих потоков, не обрабатывается, а соединение закрывается
+ */
+bool
+routeSetBudget(const char * path, uint32_t budget_ms){
+	route_s * route = routeGet(path);
+	if(!route) return false;
+	route->budget_ms = budget_ms;
+	return true;
+}//END: routeSetBudget
 
 
 
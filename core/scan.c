@@ -0,0 +1,254 @@
+/***********************************************************************
+ * XG SERVER
+ * core/scan.c
+ * Векторный просмотр строк заголовков HTTP запроса
+ *
+ * Copyright (с) 2014-2015 Stanislav V. Tretyakov, svtrostov@yandex.ru
+ **********************************************************************/
+
+
+#include "core.h"
+#include "server.h"
+#include "globals.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+
+/*
+ * За один проход по строке определяются: конец строки [\n], позиция первого разделителя [:],
+ * позиция первого пробела, количество пробелов и табуляций и наличие недопустимых символов
+ * (управляющие символы, кроме табуляции и [\r] перед [\n], и символ DEL).
+ * На x86 строка просматривается блоками по 32 байта (AVX2) или 16 байт (SSE4.2): для каждого блока
+ * сравнения дают битовые маски символов, позиции находятся по младшему биту маски, количество - по числу бит.
+ * Реализация выбирается при старте сервера по возможностям процессора, строки короче 16 байт
+ * и процессоры без SSE4.2 обрабатываются побайтно.
+ */
+
+
+typedef const char * (*scan_line_f)(const char * line, size_t len, request_line_s * scan);
+
+static const char *	_scanLineScalar(const char * line, size_t len, request_line_s * scan);
+
+static scan_line_f	scan_line = _scanLineScalar;	//Реализация просмотра строки
+static const char *	scan_name = "scalar";			//Название реализации
+
+
+
+/***********************************************************************
+ * Вспомогательные функции
+ **********************************************************************/
+
+
+/*
+ * Учитывает символ c в позиции pos строки
+ * Возвращает true, если найден конец строки
+ */
+static inline bool
+_scanByte(unsigned char c, uint32_t pos, request_line_s * scan, uint32_t * ctl){
+	switch(c){
+		case '\n':	return true;
+		case ':':	if(scan->colon < 0) scan->colon = (int32_t)pos; break;
+		case ' ':	if(scan->space < 0) scan->space = (int32_t)pos;
+		//fall through
+		case '\t':	scan->spaces++; break;
+		default:	if(c < 0x20 || c == 0x7F) (*ctl)++; break;
+	}
+	return false;
+}//END: _scanByte
+
+
+
+/*
+ * Завершает просмотр строки, конец которой [\n] найден в позиции pos
+ * Возвращает указатель на начало следующей строки
+ */
+static inline const char *
+_scanFinish(const char * line, uint32_t pos, request_line_s * scan, uint32_t ctl){
+	scan->len = pos;
+	//[\r] перед [\n] не является частью строки
+	if(pos > 0 && line[pos - 1] == '\r'){
+		scan->len--;
+		ctl--;
+	}
+	scan->illegal = (ctl > 0);
+	return line + pos + 1;
+}//END: _scanFinish
+
+
+
+/*
+ * Побайтный просмотр строки начиная с позиции pos
+ */
+static inline const char *
+_scanTail(const char * line, size_t len, uint32_t pos, request_line_s * scan, uint32_t ctl){
+	for(; pos < len; pos++){
+		if(_scanByte((unsigned char)line[pos], pos, scan, &ctl)) return _scanFinish(line, pos, scan, ctl);
+	}
+	return NULL;
+}//END: _scanTail
+
+
+
+/*
+ * Просмотр строки без SIMD инструкций
+ */
+static const char *
+_scanLineScalar(const char * line, size_t len, request_line_s * scan){
+	return _scanTail(line, len, 0, scan, 0);
+}//END: _scanLineScalar
+
+
+
+#ifdef SCAN_X86
+
+/*
+ * Просмотр строки блоками по 16 байт (SSE4.2)
+ * Последний неполный блок загружается со смещением назад (с перекрытием уже просмотренных байт),
+ * биты перекрытия отбрасываются сдвигом масок
+ */
+__attribute__((target("sse4.2,popcnt")))
+static const char *
+_scanLineSSE42(const char * line, size_t len, request_line_s * scan){
+	const __m128i v_lf		= _mm_set1_epi8('\n');
+	const __m128i v_colon	= _mm_set1_epi8(':');
+	const __m128i v_space	= _mm_set1_epi8(' ');
+	const __m128i v_tab		= _mm_set1_epi8('\t');
+	const __m128i v_del		= _mm_set1_epi8(0x7F);
+	const __m128i v_ctl		= _mm_set1_epi8(0x1F);
+	__m128i block;
+	uint32_t pos = 0, ctl = 0, shift = 0, lf, colon, space, tab, ctl_mask, below;
+	uint32_t first_colon = 0, first_space = 0, spaces = 0;	//Позиции + 1 (0 - не найден) хранятся в регистрах до конца строки
+
+	if(len < 16) return _scanTail(line, len, 0, scan, 0);
+
+	while(pos < len){
+		if(pos + 16 > len){
+			shift	= pos - (uint32_t)(len - 16);
+			pos		= (uint32_t)(len - 16);
+		}
+		block		= _mm_loadu_si128((const __m128i *)(line + pos));
+		lf			= (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(block, v_lf)) >> shift;
+		colon		= (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(block, v_colon)) >> shift;
+		space		= (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(block, v_space)) >> shift;
+		tab			= (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(block, v_tab)) >> shift;
+		//Управляющие символы: байт <= 0x1F (без знака) или 0x7F
+		ctl_mask	= ((uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(block, v_ctl), block), _mm_cmpeq_epi8(block, v_del))) >> shift) & ~tab;
+		pos			+= shift;
+		below		= (lf ? (1U << __builtin_ctz(lf)) - 1 : 0xFFFFFFFF);
+		if(!first_colon && (colon & below)) first_colon = pos + __builtin_ctz(colon & below) + 1;
+		if(!first_space && (space & below)) first_space = pos + __builtin_ctz(space & below) + 1;
+		spaces	+= __builtin_popcount((space | tab) & below);
+		ctl		+= __builtin_popcount(ctl_mask & below);
+		if(lf){
+			scan->colon		= (int32_t)first_colon - 1;
+			scan->space		= (int32_t)first_space - 1;
+			scan->spaces	= spaces;
+			return _scanFinish(line, pos + __builtin_ctz(lf), scan, ctl);
+		}
+		pos += 16 - shift;
+	}
+
+	return NULL;
+}//END: _scanLineSSE42
+
+
+
+/*
+ * Просмотр строки блоками по 32 байта (AVX2)
+ * Последний неполный блок загружается со смещением назад (с перекрытием уже просмотренных байт),
+ * биты перекрытия отбрасываются сдвигом масок
+ */
+__attribute__((target("avx2,popcnt")))
+static const char *
+_scanLineAVX2(const char * line, size_t len, request_line_s * scan){
+	const __m256i v_lf		= _mm256_set1_epi8('\n');
+	const __m256i v_colon	= _mm256_set1_epi8(':');
+	const __m256i v_space	= _mm256_set1_epi8(' ');
+	const __m256i v_tab		= _mm256_set1_epi8('\t');
+	const __m256i v_del		= _mm256_set1_epi8(0x7F);
+	const __m256i v_ctl		= _mm256_set1_epi8(0x1F);
+	__m256i block;
+	uint32_t pos = 0, ctl = 0, shift = 0, lf, colon, space, tab, ctl_mask, below;
+	uint32_t first_colon = 0, first_space = 0, spaces = 0;	//Позиции + 1 (0 - не найден) хранятся в регистрах до конца строки
+
+	//Строка короче блока
+	if(len < 32) return _scanLineSSE42(line, len, scan);
+
+	while(pos < len){
+		if(pos + 32 > len){
+			shift	= pos - (uint32_t)(len - 32);
+			pos		= (uint32_t)(len - 32);
+		}
+		block		= _mm256_loadu_si256((const __m256i *)(line + pos));
+		lf			= (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, v_lf)) >> shift;
+		colon		= (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, v_colon)) >> shift;
+		space		= (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, v_space)) >> shift;
+		tab			= (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, v_tab)) >> shift;
+		//Управляющие символы: байт <= 0x1F (без знака) или 0x7F
+		ctl_mask	= ((uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(block, v_ctl), block), _mm256_cmpeq_epi8(block, v_del))) >> shift) & ~tab;
+		pos			+= shift;
+		below		= (lf ? (1U << __builtin_ctz(lf)) - 1 : 0xFFFFFFFF);
+		if(!first_colon && (colon & below)) first_colon = pos + __builtin_ctz(colon & below) + 1;
+		if(!first_space && (space & below)) first_space = pos + __builtin_ctz(space & below) + 1;
+		spaces	+= __builtin_popcount((space | tab) & below);
+		ctl		+= __builtin_popcount(ctl_mask & below);
+		if(lf){
+			scan->colon		= (int32_t)first_colon - 1;
+			scan->space		= (int32_t)first_space - 1;
+			scan->spaces	= spaces;
+			return _scanFinish(line, pos + __builtin_ctz(lf), scan, ctl);
+		}
+		pos += 32 - shift;
+	}
+
+	return NULL;
+}//END: _scanLineAVX2
+
+#endif
+
+
+
+/***********************************************************************
+ * Функции
+ **********************************************************************/
+
+
+/*
+ * Выбор реализации просмотра строк по возможностям процессора
+ * Функция вызывается при старте сервера
+ */
+void
+scanInit(void){
+	#ifdef SCAN_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")){
+		scan_line = _scanLineAVX2;
+		scan_name = "AVX2";
+	}
+	else if(__builtin_cpu_supports("sse4.2")){
+		scan_line = _scanLineSSE42;
+		scan_name = "SSE4.2";
+	}
+	#endif
+	printf("HTTP request parser: %s\n", scan_name);
+}//END: scanInit
+
+
+
+/*
+ * Просмотр строки заголовков запроса, начинающейся с line, в пределах len байт
+ * Возвращает указатель на начало следующей строки или NULL, если конец строки [\n] не найден
+ */
+const char *
+scanRequestLine(const char * line, size_t len, request_line_s * scan){
+	scan->len		= 0;
+	scan->colon		= -1;
+	scan->space		= -1;
+	scan->spaces	= 0;
+	scan->illegal	= false;
+	return scan_line(line, len, scan);
+}//END: scanRequestLine
+
@@ -12,10 +12,6 @@
 #include "event.h"
 
 
-//Буфер-мусорка
-static char trash_buffer[1024 * 16];
-
-
 
 /***********************************************************************
  * Работа с сервером
@@ -33,8 +29,14 @@ serverSetConfig(server_s * srv){
 	srv->config.max_head_size			= max(0,(int)configGetInt("/webserver/max_head_size", 64*1024));					//Максимальный размер HTTP заголовков, принимаемых сервером, в байтах (по-умолчанию, 65536 байт = 64кб)
 	srv->config.max_post_size			= max(0,(int)configGetInt("/webserver/max_post_size", 1024*1024));				//Максимальный размер POST данных, принимаемых сервером, в байтах (по-умолчанию, 1048576 байт = 1Мб)
 	srv->config.max_upload_size			= max(0,(int)configGetInt("/webserver/max_upload_size", 512*1024));				//Максимальный размер загружаемого файла, принимаемого сервером, в байтах (по-умолчанию, 524288 байт = 500кб)
+	srv->config.max_multipart_size		= max(0,(int)configGetInt("/webserver/max_multipart_size", 16*1024*1024));		//Максимальный размер POST данных multipart/form-data, принимаемых сервером, в байтах (по-умолчанию, 16777216 байт = 16Мб)
+	srv->config.upload_spool_size		= max(0,(int)configGetInt("/webserver/upload_spool_size", 64*1024));			//Размер загружаемого файла, начиная с которого файл сохраняется во временный файл на диске, в байтах (по-умолчанию, 65536 байт = 64кб)
+	srv->config.upload_temp_dir			= stringClone(configGetString("/webserver/upload_temp_dir","/tmp"),NULL);		//Папка временных файлов загрузок
+	if(!dirExists(srv->config.upload_temp_dir)) FATAL_ERROR("Directory [%s] not found\n",srv->config.upload_temp_dir);
 	srv->config.max_read_idle			= max(0,min(30,(int)configGetInt("/webserver/max_read_idle", 2)));				//Маскимальное время ожидания данных от клиента (в секундах)
 	srv->config.max_request_time		= max(0,min(86400,(int)configGetInt("/webserver/max_request_time", 10)));		//Маскимальное время получения запроса от клиента (в секундах)
+	srv->config.keepalive_timeout		= max(0,min(300,(int)configGetInt("/webserver/keepalive_timeout", 5)));			//Маскимальное время ожидания следующего запроса на keep-alive соединении (в секундах), 0 - keep-alive отключен
+	srv->config.keepalive_requests		= max(0,(int)configGetInt("/webserver/keepalive_requests", 100));				//Максимальное количество запросов на одном keep-alive соединении, 0 - без ограничений
 	srv->config.public_html.ptr		= fileRealpath(configRequireString("/webserver/public_html"), &srv->config.public_html.len);		//Папка, содержащая статичный контент (html, js, css, изобажения, видео и прочие файлы, которые не требуют обработки)
 	if(!srv->config.public_html.ptr) FATAL_ERROR("[/webserver/public_html] path not found\n");
 	if(!dirExists(srv->config.public_html.ptr)) FATAL_ERROR("Directory [%s] not found\n",srv->config.public_html.ptr);
@@ -50,34 +52,82 @@ serverSetConfig(server_s * srv){
 	srv->config.dh1024_file				= stringClone(configRequireString("/webserver/dh1024_file"),NULL);			//Путь к файлам DH параметров: openssl dhparam -out dh1024.pem 1024
 	srv->config.dh2048_file				= stringClone(configRequireString("/webserver/dh2048_file"),NULL);			//Путь к файлам DH параметров: openssl dhparam -out dh2048.pem 2048
 	srv->config.use_ssl					= configGetBool("/webserver/use_ssl", true);								//Использовать SSL
+	srv->config.ssl_ktls				= configGetBool("/webserver/ssl_ktls", false);								//Использовать kernel TLS (kTLS)
+	srv->config.ssl_session_cache_size	= max(0,(int)configGetInt("/webserver/ssl_session_cache_size", 20480));		//Максимальное количество SSL сессий в кеше сервера, 0 - кеш сессий отключен
+	srv->config.ssl_session_timeout		= max(1,min(86400,(int)configGetInt("/webserver/ssl_session_timeout", 300)));	//Время жизни SSL сессии в кеше сервера (в секундах)
+	srv->config.ssl_ticket_key_lifetime	= max(0,min(86400,(int)configGetInt("/webserver/ssl_ticket_key_lifetime", 3600)));	//Время использования ключа шифрования session tickets (в секундах), 0 - session tickets отключены
 	srv->config.mimetypes				= kvGetRequireType(XG_CONFIG, "/webserver/mimetypes", KV_OBJECT);			//MIME типы файлов
 	srv->config.default_mimetype		= kvGetRequireStringS(srv->config.mimetypes, "default");					//MIME тип по-умолчанию
 	srv->config.directory_index.ptr		= stringClone(configGetString("/webserver/directory_index","index.php"), &srv->config.directory_index.len);	//Название файла по-умолчанию, если в URI запроса указана директория (последний символ URI = "/")
-	srv->config.worker_threads			= max(0,min(64,(int)configGetInt("/webserver/worker_threads", 0)));
+	srv->config.worker_threads			= max(0,min((int)server_max_workers,(int)configGetInt("/webserver/worker_threads", 0)));				//Количество рабочих потоков при старте (0 - по количеству ядер)
+	srv->config.worker_threads_min		= max(0,min((int)server_max_workers,(int)configGetInt("/webserver/worker_threads_min", 0)));		//Минимальное количество рабочих потоков (0 - равно worker_threads)
+	srv->config.worker_threads_max		= max(0,min((int)server_max_workers,(int)configGetInt("/webserver/worker_threads_max", 0)));		//Максимальное количество рабочих потоков (0 - равно worker_threads)
+	srv->config.worker_idle_timeout		= max(1,(int)configGetInt("/webserver/worker_idle_timeout", 60));			//Время простоя, после которого лишний рабочий поток завершается (в секундах)
+	srv->config.worker_grow_wait		= max(1,(int)configGetInt("/webserver/worker_grow_wait", 50));				//Время ожидания задания в очереди, при превышении которого добавляются рабочие потоки (в миллисекундах)
+	srv->config.reactor_cpus			= stringClone(configGetString("/webserver/reactor_cpus",""),NULL);			//Процессоры потоков-реакторов (cpulist), пустая строка - без привязки
+	srv->config.worker_cpus				= stringClone(configGetString("/webserver/worker_cpus",""),NULL);			//Процессоры рабочих потоков (cpulist), пустая строка - без привязки
+	srv->config.internal_cpus			= stringClone(configGetString("/webserver/internal_cpus",""),NULL);			//Процессоры потока внутренних заданий (cpulist), пустая строка - без привязки
+	srv->config.numa_local				= configGetBool("/webserver/numa_local", false);							//Выделять память закрепленных потоков в локальном узле NUMA
+	srv->config.reactor_threads			= max(0,min((int)server_max_reactors,(int)configGetInt("/webserver/reactor_threads", 1)));	//Количество потоков-реакторов (0 - по количеству ядер)
+	srv->config.max_fds					= (uint32_t)max(0,(int)configGetInt("/webserver/max_fds", 0));				//Максимальное количество дескрипторов (0 - по лимиту RLIMIT_NOFILE)
+	srv->config.max_connections			= (uint32_t)max(0,(int)configGetInt("/webserver/max_connections", 0));		//Максимальное количество соединений для каждого реактора (0 - равно max_fds)
+	srv->config.overload_connections	= (uint32_t)max(0,(int)configGetInt("/webserver/overload_connections", 0));	//Количество соединений реактора, при котором сервер переходит в режим перегрузки (0 - не проверяется)
+	srv->config.overload_queue_depth	= (uint32_t)max(0,(int)configGetInt("/webserver/overload_queue_depth", 0));	//Количество заданий в очередях рабочих потоков, при котором сервер переходит в режим перегрузки (0 - не проверяется)
+	srv->config.overload_wait			= max(0,(int)configGetInt("/webserver/overload_wait", 0));					//Время ожидания задания в очереди, при котором сервер переходит в режим перегрузки (в миллисекундах, 0 - не проверяется)
+	srv->config.overload_wait_percentile= max(1,min(100,(int)configGetInt("/webserver/overload_wait_percentile", 99)));	//Перцентиль времени ожидания заданий в очереди
+	srv->config.overload_recover		= max(1,min(100,(int)configGetInt("/webserver/overload_recover", 80)));		//Нагрузка (в процентах от порогов) для выхода из режима перегрузки
+	srv->config.overload_retry_after	= max(0,min(3600,(int)configGetInt("/webserver/overload_retry_after", 1)));	//Значение заголовка Retry-After ответа 503 (в секундах)
 }//END: serverSetConfig
 
 
 
 /*
- * Инициализация прослушивающего сокета сервера
+ * Определение лимитов дескрипторов и соединений исходя из RLIMIT_NOFILE
+ * Если в конфигурации задано больше дескрипторов, чем позволяет текущий лимит, выполняется попытка поднять лимит до жесткого
+ * Лимит дескрипторов общий для процесса, поэтому по-умолчанию он делится между реакторами за вычетом server_reserved_fds
  */
 void
-serverInitListener(server_s * srv){
+serverInitLimits(server_s * srv, size_t reactors_count){
+
+	struct rlimit rl;
+	uint32_t limit;
+
+	if(getrlimit(RLIMIT_NOFILE, &rl) != 0) FATAL_ERROR("getrlimit(RLIMIT_NOFILE) failed: %s", strerror(errno));
+
+	if(srv->config.max_fds > 0 && (rl.rlim_cur == RLIM_INFINITY || srv->config.max_fds > rl.rlim_cur)){
+		if(rl.rlim_cur != RLIM_INFINITY){
+			rl.rlim_cur = (rl.rlim_max == RLIM_INFINITY ? srv->config.max_fds : min((rlim_t)srv->config.max_fds, rl.rlim_max));
+			if(setrlimit(RLIMIT_NOFILE, &rl) != 0 || getrlimit(RLIMIT_NOFILE, &rl) != 0){
+				ERROR_MSG("setrlimit(RLIMIT_NOFILE) failed: %s", strerror(errno));
+			}
+		}
+	}
+
+	limit = (rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > INT32_MAX ? server_default_max_fds : (uint32_t)rl.rlim_cur);
+	if(!srv->config.max_fds || srv->config.max_fds > limit) srv->config.max_fds = limit;
+	if(!srv->config.max_connections){
+		srv->config.max_connections = max((uint32_t)1, (srv->config.max_fds > server_reserved_fds ? srv->config.max_fds - server_reserved_fds : srv->config.max_fds / 2) / (uint32_t)max((size_t)1, reactors_count));
+	}
+	if(srv->config.max_connections > srv->config.max_fds) srv->config.max_connections = srv->config.max_fds;
+
+	DEBUG_MSG("Max FDs: %u, max connections per reactor: %u", srv->config.max_fds, srv->config.max_connections);
+
+}//END: serverInitLimits
+
 
-	size_t addr_len;
+
+/*
+ * Определение адреса прослушиваемого сервером сокета
+ */
+void
+serverInitAddress(server_s * srv){
 
 	if(srv->config.host[0] == '[' || strchr(srv->config.host, ':') != NULL) srv->socket_type = SOCKTYPE_IPV6;
 
-	//Открытие сокета
 	switch(srv->socket_type){
 
 		//IPv6
 		case SOCKTYPE_IPV6:
-			srv->addr.plain.sa_family = AF_INET6;
-			if ((srv->listen_fd = socket(srv->addr.plain.sa_family, SOCK_STREAM, IPPROTO_TCP)) == -1){
-				FATAL_ERROR("IPv6 socket failed: %s", strerror(errno));
-			}
-
 			memset(&srv->addr, 0, sizeof(struct sockaddr_in6));
 			srv->addr.ipv6.sin6_family = AF_INET6;
 			//"[]" или "[*]" - любой IP сервера на этом порте
@@ -97,17 +147,12 @@ serverInitListener(server_s * srv){
 				freeaddrinfo(res);
 			}
 			srv->addr.ipv6.sin6_port = htons(srv->config.port);
-			addr_len = sizeof(struct sockaddr_in6);
+			srv->addr_len = sizeof(struct sockaddr_in6);
 
 		break;
 
 		case SOCKTYPE_IPV4:
 		default:
-			srv->addr.plain.sa_family = AF_INET;
-			if ((srv->listen_fd = socket(srv->addr.plain.sa_family, SOCK_STREAM, IPPROTO_TCP)) == -1){
-				FATAL_ERROR("IPv4 socket failed: %s", strerror(errno));
-			}
-
 			memset(&srv->addr, 0, sizeof(struct sockaddr_in));
 			srv->addr.ipv4.sin_family = AF_INET;
 			//"" или "*" - любой IP сервера на этом порте
@@ -121,26 +166,52 @@ serverInitListener(server_s * srv){
 				memcpy(&(srv->addr.ipv4.sin_addr.s_addr), he->h_addr_list[0], he->h_length);
 			}
 			srv->addr.ipv4.sin_port = htons(srv->config.port);
-			addr_len = sizeof(struct sockaddr_in);
+			srv->addr_len = sizeof(struct sockaddr_in);
 
 		break;
-	}//Открытие сокета
+	}
+
+}//END: serverInitAddress
+
 
 
+/*
+ * Инициализация прослушивающего сокета реактора
+ * Каждый реактор открывает собственный сокет на одном и том же адресе (SO_REUSEPORT),
+ * ядро распределяет входящие соединения между сокетами реакторов
+ */
+void
+serverInitListener(reactor_s * reactor){
+
+	server_s * srv = reactor->server;
 	int val = 1;
-	if (setsockopt(srv->listen_fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val)) < 0){
+
+	//Открытие сокета
+	if ((reactor->listen_fd = socket(srv->addr.plain.sa_family, SOCK_STREAM, IPPROTO_TCP)) == -1){
+		FATAL_ERROR("%s socket failed: %s", (srv->socket_type == SOCKTYPE_IPV6 ? "IPv6" : "IPv4"), strerror(errno));
+	}
+
+	if (setsockopt(reactor->listen_fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val)) < 0){
 		FATAL_ERROR("socketsockopt(SO_REUSEADDR) failed: %s", strerror(errno));
 	}
 
-	if(socketSetNonblockState(srv->listen_fd, true) == -1){
+#ifdef SO_REUSEPORT
+	if (setsockopt(reactor->listen_fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val)) < 0){
+		FATAL_ERROR("socketsockopt(SO_REUSEPORT) failed: %s", strerror(errno));
+	}
+#else
+	if(srv->reactors_count > 1) FATAL_ERROR("SO_REUSEPORT is not supported, [/webserver/reactor_threads] should be 1");
+#endif
+
+	if(socketSetNonblockState(reactor->listen_fd, true) == -1){
 		FATAL_ERROR("socketSetNonblockState() failed: %s", strerror(errno));
 	}
 
-	if (bind(srv->listen_fd, (struct sockaddr *) &(srv->addr), addr_len) != 0){
+	if (bind(reactor->listen_fd, (struct sockaddr *) &(srv->addr), srv->addr_len) != 0){
 		FATAL_ERROR("bind to socket failed: %s", strerror(errno));
 	}
 
-	if (listen(srv->listen_fd, SOMAXCONN) == -1) {
+	if (listen(reactor->listen_fd, SOMAXCONN) == -1) {
 		FATAL_ERROR("listen failed: %s", strerror(errno));
 	}
 
@@ -148,37 +219,6 @@ serverInitListener(server_s * srv){
 
 
 
-/*
- * Функция обработки событий для серверного сокета в Poll Engine
- */
-static result_e 
-serverHandleFdEvent(server_s * srv, int revents, void * data){
-	connection_s * con;
-	int loops = 150;
-
-	//Неизвестное событие для серверного сокета
-	if (BIT_ISUNSET(revents, FDPOLL_IN)) RETURN_ERROR(RESULT_ERROR, "strange event [%d] for server socket [%d]", revents, srv->listen_fd);
-
-	//Принимаем loops новых соединений, ограничение loops нужно,
-	//чтобы была возможность обработать уже установленные соединения
-	for (; loops > 0 && NULL != (con = connectionAccept(srv)); loops--) connectionEngine(con);
-
-	return RESULT_OK;
-}//END: serverHandleFdEvent
-
-
-
-/*
- * Функция обработки событий для прерывающего сокета в Poll Engine
- */
-static result_e 
-serverHandlePipeEvent(server_s * srv, int revents, void * data){
-	read(srv->pipe[0], trash_buffer,sizeof(trash_buffer));
-	return RESULT_OK;
-}//END: serverHandlePipeEvent
-
-
-
 /*
  * Инициализация сервера
  */
@@ -186,67 +226,44 @@ void
 serverInit(void){
 
 	server_s * srv = mNewZ(sizeof(server_s));
-
-
-	//Создание структур клиентских соединений
-	connectionsCreate(srv);
+	size_t reactors_count;
 
 	//Настройки сервера
 	serverSetConfig(srv);
 
-
 	//Генерация события (описание в core/event.h)
 	fireEvent(EVENT_SERVER_INIT, srv);
 
-
-	//Инициализация Poll engine
-	fdeventNew(srv);
-
 	//Инициализация SSL
 	if(srv->config.use_ssl) sslInit(srv);
 
-	//Инициализация прослушивающего сокета сервера
-	serverInitListener(srv);
-
-	//Инициализация списка заданий для рабочих потоков
-	if(joblistCreate(srv)!=RESULT_OK) FATAL_ERROR("Init joblist fail");
+	//Количество реакторов
+	reactors_count = (!srv->config.reactor_threads ? (size_t)sysconf(_SC_NPROCESSORS_ONLN) : (size_t)srv->config.reactor_threads);
+	reactors_count = min(reactors_count, server_max_reactors);
 
-	//Инициализация списка заданий для основного потока
-	if(jobmainCreate(srv)!=RESULT_OK) FATAL_ERROR("Init jobmain fail");
+	//Лимиты дескрипторов и соединений
+	serverInitLimits(srv, reactors_count);
 
-	//Инициализация рабочих потоков сервера
-	if(threadPoolCreate(srv, (!srv->config.worker_threads ? (size_t)sysconf(_SC_NPROCESSORS_ONLN) : (size_t)srv->config.worker_threads))!=RESULT_OK) FATAL_ERROR("Init workers threads fail");
-
-
-	//Регистрация сокета сервера в обработчике событий Poll Engine
-	fdeventAdd(srv->fdevent, srv->listen_fd, serverHandleFdEvent, srv);
-	fdEventSet(srv->fdevent, srv->listen_fd, FDPOLL_IN);
+	//Привязка потоков к процессорам: поток внутренних заданий уже запущен, реакторы и рабочие потоки закрепляются при старте
+	affinityInit(srv);
+	jobinternalThreadAffinity();
 
-#ifdef USE_POLL
+	//Пороги перегрузки и ответ 503, отправляемый реакторами в режиме перегрузки
+	overloadInit(srv);
 
-	if(pipe(srv->pipe)==-1)  FATAL_ERROR("pipe fail: %s", strerror(errno));
-	DEBUG_MSG("srv->pipe[0] (read) = %d", srv->pipe[0]);
-	DEBUG_MSG("srv->pipe[1] (write) = %d", srv->pipe[1]);
+	//Выбор реализации разбора заголовков запроса (SIMD инструкции процессора)
+	scanInit();
 
-	//Регистрация сокета сервера в обработчике событий Poll Engine
-	fdeventAdd(srv->fdevent, srv->pipe[0], serverHandlePipeEvent, srv);
-	fdEventSet(srv->fdevent, srv->pipe[0], FDPOLL_IN);
+	//Определение адреса прослушиваемого сокета
+	serverInitAddress(srv);
 
-#endif
+	//Инициализация реакторов: у каждого реактора свой Poll engine, соединения, список заданий и прослушиваемый сокет
+	if(reactorsCreate(srv, reactors_count)!=RESULT_OK) FATAL_ERROR("Init reactors fail");
 
-	int n;
-	int revents;
-	int poll_index;
-	fdevent_handler handler;
-	void * data;
-	result_e result;
-	socket_t fd;
-	time_t old_ts;
-	connection_s * con;
+	//Инициализация рабочих потоков сервера и их очередей заданий
+	if(threadPoolCreate(srv, (!srv->config.worker_threads ? (size_t)sysconf(_SC_NPROCESSORS_ONLN) : (size_t)srv->config.worker_threads))!=RESULT_OK) FATAL_ERROR("Init workers threads fail");
 
 	XG_STATUS = XGS_WORKING;
-	srv->current_ts = time(NULL);
-	old_ts = srv->current_ts;
 
 	#ifdef XG_MEMSTAT
 	sleepSeconds(2);
@@ -261,114 +278,8 @@ serverInit(void){
 	//Генерация события (описание в core/event.h)
 	fireEvent(EVENT_SERVER_START, srv);
 
-	//Основный цикл приема соединений
-	while(XG_STATUS == XGS_WORKING){
-
-		//Текущее время
-		srv->current_ts = time(NULL);
-
-		//Обработка списка заданий jobmain
-		while((con=jobmainGet(srv->jobmain))!=NULL) connectionEngine(con);
-
-		//Получение новых событий, n - количество новых событий
-#ifdef USE_EPOLL
-		n = fdeventPoll(srv->fdevent, 100);
-#endif
-#ifdef USE_POLL
-		n = poll(srv->fdevent->pollfds, srv->fdevent->pollfds_count, 100);
-#endif
-
-/*
-		if(n>0){
-			DEBUG_MSG("%u: poll events found: %d",(uint32_t)srv->current_ts,n);
-		}
-*/
-
-		poll_index = -1;
-		//Обработка событий poll engine
-		while(n-- > 0){
-
-			//Получаем индекс массива pollfds, для дескриптора сокета которого есть события или -1, если ничего не найдено
-			if((poll_index = fdEventGetNextIndex(srv->fdevent, poll_index)) == -1) break;
-
-#ifdef USE_EPOLL
-			fd		= srv->fdevent->epollfds[poll_index].data.fd;
-			revents = srv->fdevent->epollfds[poll_index].events;
-#endif
-
-#ifdef USE_POLL
-			fd		= srv->fdevent->pollfds[poll_index].fd;
-			revents = srv->fdevent->pollfds[poll_index].revents;
-#endif
-
-			//DEBUG_MSG("\t event fd = %d", fd);
-
-			if (srv->fdevent->fds[fd] == NULL || srv->fdevent->fds[fd]->fd != fd) FATAL_ERROR("srv->fdevent->fds[fd] == NULL || srv->fdevent->fds[fd]->fd != fd");
-			handler = srv->fdevent->fds[fd]->handler;
-			data = srv->fdevent->fds[fd]->data;
-
-			switch (result = (*handler)(srv, revents, data)){
-				case RESULT_ERROR: FATAL_ERROR("HANDLER RETURNED RESULT_ERROR");
-				default: break;
-			}
-
-		}//Обработка событий poll engine
-
-
-		//Обработка списка заданий jobmain
-		while((con=jobmainGet(srv->jobmain))!=NULL) connectionEngine(con);
-
-
-		//Если текущее время изменилось (в секундах, разумеется)
-		if(old_ts != srv->current_ts){
-
-			//Добавление внутреннего задания на удаление сессий с истекшим сроком действия
-			if(srv->current_ts % 60 == 0) jobinternalAdd(JOB_INTERNAL_SESSION_CLEANER, NULL, NULL);
-
-			if(srv->current_ts % 5 == 0){
-
-				#ifdef XG_MEMSTAT
-				mStatPrint();
-				#endif
-
-				#ifdef XG_CONSTAT
-				printf("\n----------------------------------\n");
-				printf("Server thr idle: %u\n", (uint32_t)srv->workers->threads_idle);
-				connectionsPrint(srv);
-				#endif
-
-			}
-
-			old_ts = srv->current_ts;
-
-			//Просмотр активных соединений
-			for(n = srv->connections_count-1; n >= 0; n--){
-				con = srv->connections[n];
-				if(!con || con->stage == CON_STAGE_NONE) continue;
-				if(con->fd < 0 || con->stage >= CON_STAGE_CLOSED){
-					connectionDelete(con);
-					continue;
-				}
-				//Проверка таймаутов
-				if(	(con->read_idle_ts > 0 && srv->current_ts - con->read_idle_ts > srv->config.max_read_idle && con->stage == CON_STAGE_READ) ||	//Превышен интервал ожидания данных между двумя socket read операциями
-					(srv->current_ts - con->start_ts > srv->config.max_request_time && (con->stage >= CON_STAGE_ACCEPTING && con->stage <= CON_STAGE_READ))	//Превышен лимит времени на получение запроса от клиента: CON_STAGE_ACCEPTING, CON_STAGE_HANDSTAKE, CON_STAGE_CONNECTED, CON_STAGE_READ
-				){
-					con->http_code = 408;	// 408 Request Timeout - время ожидания сервером передачи от клиента истекло
-					if(con->request.data){
-						con->stage = (con->request.data->count > 0 ? CON_STAGE_WORKING : CON_STAGE_CLOSE);
-					}else{
-						con->stage = CON_STAGE_CLOSE;
-					}
-					con->connection_error = CON_ERROR_TIMEOUT;
-					connectionEngine(con);
-				}
-
-			}//Просмотр активных соединений
-
-		}//Если текущее время изменилось (в секундах, разумеется)
-
-
-	}//Основный цикл приема соединений
+	//Запуск реакторов, управление возвращается после остановки сервера
+	reactorsStart(srv);
 
 
 	//Генерация события (описание в core/event.h)
@@ -385,19 +296,8 @@ serverInit(void){
 
 	DEBUG_MSG("threadPoolFree()...");
 	threadPoolFree(srv->workers);
-	DEBUG_MSG("connectionsFree()...");
-	connectionsFree(srv);
-	DEBUG_MSG("Closing pipe FDs...");
-	if(srv->pipe[0] > -1) close(srv->pipe[0]);
-	if(srv->pipe[1] > -1) close(srv->pipe[1]);
-	DEBUG_MSG("jobmainFree()...");
-	jobmainFree(srv->jobmain);
-	DEBUG_MSG("joblistFree()...");
-	joblistFree(srv->joblist);
-	DEBUG_MSG("fdeventFree()...");
-	fdeventFree(srv->fdevent);
-	DEBUG_MSG("socketClose()...");
-	socketClose(srv->listen_fd);
+	DEBUG_MSG("reactorsFree()...");
+	reactorsFree(srv);
 	DEBUG_MSG("sessionCacheSaveAll()...");
 	sessionCacheSaveAll();
 	DEBUG_MSG("SSL_CTX_free()...");
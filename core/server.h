@@ -33,12 +33,27 @@ extern "C" {
 #include <fcntl.h>
 #include <errno.h>
 #include <pthread.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <sys/eventfd.h>
+#include <sched.h>
 #include <resolv.h>
 #include <signal.h>
 
 #include <openssl/rand.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include <openssl/hmac.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	#include <openssl/core_names.h>
+	#include <openssl/params.h>
+#endif
+
+//Kernel TLS (kTLS): OpenSSL 3.0+ собранный с поддержкой kTLS
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+	#define XG_SSL_KTLS
+#endif
 
 #include "core.h"
 #include "kv.h"
@@ -76,6 +91,13 @@ extern "C" {
 	#define FDPOLL_ERR	POLLERR
 #endif
 
+//Размер кеш-линии процессора и выравнивание по ней
+#define XG_CACHE_LINE		64
+#define XG_CACHE_ALIGNED	__attribute__((aligned(XG_CACHE_LINE)))
+
+//Количество интервалов гистограммы времени ожидания заданий в очереди (интервал i: от 2^(i-1) до 2^i - 1 миллисекунд)
+#define XG_WAIT_HISTOGRAM_SIZE	16
+
 #define FDPOLL_ERROR	(FDPOLL_HUP | FDPOLL_ERR)
 #define FDPOLL_READ	(FDPOLL_IN  | FDPOLL_ERROR)
 #define FDPOLL_WRITE	(FDPOLL_OUT | FDPOLL_ERROR)
@@ -91,14 +113,53 @@ extern "C" {
 //Количество рабочих потоков
 static const uint32_t server_worker_threads = 4;
 
+//Максимальное количество рабочих потоков
+static const uint32_t server_max_workers = 256;
+
+//Интервал проверки нагрузки на пул рабочих потоков (в миллисекундах)
+static const uint64_t worker_pool_adjust_interval = 100;
+
+//Среднее количество заданий в очереди на один рабочий поток, при котором пул потоков увеличивается
+static const size_t worker_grow_queue_depth = 4;
+
+//Интервал проверки перегрузки сервера (в миллисекундах)
+static const uint64_t overload_check_interval = 100;
+
+//Минимальное время работы в режиме перегрузки (в миллисекундах), чтобы сервер не переключался между режимами при колебаниях нагрузки
+static const uint64_t overload_min_duration = 1000;
+
+//Максимальное количество потоков-реакторов (циклов обработки событий)
+static const uint32_t server_max_reactors = 64;
+
+//Количество повторных проверок списка заданий рабочим потоком перед засыпанием на condition
+static const uint32_t worker_spin_iterations = 64;
+
+//Минимальное количество заданий в очереди рабочего потока, при котором простаивающий поток забирает задания из этой очереди
+static const size_t worker_steal_backlog = 2;
+
+//Веса классов заданий (job_class_e): доля выборки заданий из очереди класса при наличии заданий в нескольких очередях
+static const int32_t job_class_weights[] = {8, 4, 2, 1};
+
 //Размер стека рабочего потока
 static const uint32_t worker_thread_stack_size = 1024 * 512;
 
-//Максимальное количество дескрипторов
-static const uint32_t server_max_fds = FD_SETSIZE;
+//Начальный размер таблиц Poll engine, индексируемых дескриптором (таблицы увеличиваются по мере необходимости до srv->config.max_fds)
+static const uint32_t server_fds_initial_size = 1024;
+
+//Начальный размер таблицы соединений реактора (таблица увеличивается по мере необходимости до srv->config.max_connections)
+static const uint32_t server_connections_initial_size = 256;
+
+//Максимальное количество событий, получаемых одним вызовом epoll_wait()
+static const uint32_t server_epoll_events = 1024;
 
-//Максимальное количество одновременных соединенй
-static const uint32_t server_max_connections = FD_SETSIZE;
+//Количество дескрипторов по-умолчанию, если лимит RLIMIT_NOFILE не ограничен
+static const uint32_t server_default_max_fds = 65536;
+
+//Количество дескрипторов, резервируемых для прослушиваемых сокетов, epoll, eventfd, файлов и журналов при расчете max_connections по-умолчанию
+static const uint32_t server_reserved_fds = 64;
+
+//Интервал приостановки приема соединений при исчерпании дескрипторов, если соединение не удалось отклонить ответом 503 (в миллисекундах)
+static const int accept_pause_interval = 100;
 
 //Максимальное время ожидания первого байта данных от клиента (в секундах, считается от начала установки соединения)
 static const uint32_t accepting_read_timeout = 3;
@@ -106,6 +167,9 @@ static const uint32_t accepting_read_timeout = 3;
 //Максимальное время ожидания первого байта данных от клиента (в секундах, считается от начала установки соединения)
 static const uint32_t handstake_timeout = 6;
 
+//Максимальное время ожидания событий реактором (в миллисекундах), если нет более раннего таймера соединения
+static const int reactor_poll_timeout_max = 1000;
+
 //Время ожидания данных от клиента перед непосредственным закрытием соединения (в секундах)
 static const uint32_t linger_on_close_timeout = 5;
 
@@ -118,15 +182,42 @@ static const uint32_t response_buffer_head_increment = 2048; //по умолча
 //Размер инкремента для буфера выходных данных от сервера: connection->response.body->increment
 static const uint32_t response_buffer_body_increment = 1024 * 8; //по умолчанию 8 килобайт
 
-//Размер списка заданий (равен максимальному количеству соединений x 4)
-static const uint32_t server_joblist_size = FD_SETSIZE;
+//Начальный размер списка заданий (степень двойки): при заполнении список увеличивается новым сегментом двойного размера
+//Очереди классов заданий рабочих потоков создаются пропорционально весам job_class_weights, но не меньше server_joblist_min_size
+static const size_t server_joblist_initial_size = 1024;
+static const size_t server_joblist_min_size = 64;
+
+//Максимальный размер одного сегмента списка заданий
+static const size_t server_joblist_max_size = 1024 * 1024;
 
 //Максимальная длинна маршрута (символов = байт), получаемая при запросе
 static const uint32_t request_path_max = 512;
 
+//Начальный размер массива заголовков запроса
+static const uint32_t request_headers_initial_size = 16;
+
+//Максимальное количество заголовков запроса
+static const uint32_t request_headers_max = 256;
+
+//Максимальный размер заголовков части тела multipart/form-data
+static const uint32_t multipart_part_head_max = 8192;
+
 //Размер внутреннего буфера отправки данных из локальных файлов (примеряется в chunkqueue_s)
 static const uint32_t chunkqueue_internal_buffer_size = 1024 * 32;
 
+//Максимальный объем данных из локального файла, передаваемых в сокет одним вызовом sendfile()
+static const uint32_t chunkqueue_sendfile_max = 1024 * 1024 * 2;
+
+//Максимальный объем данных из нескольких частей контента, объединяемых в одну SSL запись (размер TLS записи)
+static const uint32_t chunkqueue_ssl_record_size = 1024 * 16;
+
+//Максимальное количество частей контента, передаваемых в сокет одним вызовом writev()
+#ifdef IOV_MAX
+#define CHUNKQUEUE_IOVEC_MAX IOV_MAX
+#else
+#define CHUNKQUEUE_IOVEC_MAX 1024
+#endif
+
 
 /***********************************************************************
  * Объявления и декларации
@@ -174,9 +265,10 @@ typedef enum{
 	CON_STAGE_ACCEPTING			= CON_STAGE_NONE + 1,			//Принимаем соединение для обработки
 	CON_STAGE_HANDSTAKE			= CON_STAGE_ACCEPTING + 1,		//SSL Соединение было только что принято для обработки, ожидается "рукопожатие"
 	CON_STAGE_CONNECTED			= CON_STAGE_HANDSTAKE + 1,		//Соединение было только что принято для обработки
+	CON_STAGE_KEEPALIVE			= CON_STAGE_CONNECTED + 1,		//Соединение (keep-alive) ожидает следующий запрос от клиента
 
 	//Чтение данных запроса
-	CON_STAGE_READ				= CON_STAGE_CONNECTED + 1,		//Получение данных от клиента
+	CON_STAGE_READ				= CON_STAGE_KEEPALIVE + 1,		//Получение данных от клиента
 
 	//Подготовка и отправка ответа 
 	CON_STAGE_WORKING			= CON_STAGE_READ + 1,			//Обработка запроса сервером и формирование ответа
@@ -272,21 +364,53 @@ typedef enum{
 } request_in_e;
 
 
+//Индексы известных HTTP заголовков в таблице request_s->headers_known
+typedef enum{
+	HEADER_INDEX_CONNECTION = 0,
+	HEADER_INDEX_CONTENT_LENGTH,
+	HEADER_INDEX_CONTENT_TYPE,
+	HEADER_INDEX_COOKIE,
+	HEADER_INDEX_RANGE,
+	HEADER_INDEX_X_REQUESTED_WITH,
+	HEADER_INDEX_HOST,
+	HEADER_INDEX_IF_NONE_MATCH,
+	HEADER_INDEX_USER_AGENT,
+	HEADER_INDEX_REFERER,
+	HEADER_INDEX_ACCEPT_ENCODING,
+	HEADER_INDEX_IF_MODIFIED_SINCE,
+	HEADER_INDEX_AUTHORIZATION,
+	HEADER_INDEX_X_FORWARDED_FOR,
+	HEADER_KNOWN					//Количество известных заголовков
+} header_index_e;
+
+
 //HTTP заголовки
 typedef enum{
-	HEADER_CONNECTION		= BIT(1),
-	HEADER_CONTENT_LENGTH	= BIT(2),
-	HEADER_CONTENT_TYPE		= BIT(3),
-	HEADER_COOKIE			= BIT(4),
-	HEADER_RANGE			= BIT(5),
-	HEADER_X_REQUESTED_WITH	= BIT(6),
-	HEADER_HOST				= BIT(7),
-	HEADER_IF_NONE_MATCH	= BIT(8),
-	HEADER_USER_AGENT		= BIT(9),
-	HEADER_REFERER			= BIT(10)
+	HEADER_CONNECTION		= BIT(HEADER_INDEX_CONNECTION),
+	HEADER_CONTENT_LENGTH	= BIT(HEADER_INDEX_CONTENT_LENGTH),
+	HEADER_CONTENT_TYPE		= BIT(HEADER_INDEX_CONTENT_TYPE),
+	HEADER_COOKIE			= BIT(HEADER_INDEX_COOKIE),
+	HEADER_RANGE			= BIT(HEADER_INDEX_RANGE),
+	HEADER_X_REQUESTED_WITH	= BIT(HEADER_INDEX_X_REQUESTED_WITH),
+	HEADER_HOST				= BIT(HEADER_INDEX_HOST),
+	HEADER_IF_NONE_MATCH	= BIT(HEADER_INDEX_IF_NONE_MATCH),
+	HEADER_USER_AGENT		= BIT(HEADER_INDEX_USER_AGENT),
+	HEADER_REFERER			= BIT(HEADER_INDEX_REFERER),
+	HEADER_ACCEPT_ENCODING	= BIT(HEADER_INDEX_ACCEPT_ENCODING),
+	HEADER_IF_MODIFIED_SINCE	= BIT(HEADER_INDEX_IF_MODIFIED_SINCE),
+	HEADER_AUTHORIZATION	= BIT(HEADER_INDEX_AUTHORIZATION),
+	HEADER_X_FORWARDED_FOR	= BIT(HEADER_INDEX_X_FORWARDED_FOR)
 } header_e;
 
 
+//Источники переменных запроса, разбираемые при первом обращении
+typedef enum{
+	REQUEST_VARS_GET		= BIT(0),	//GET параметры из query string
+	REQUEST_VARS_POST		= BIT(1),	//POST параметры и файлы
+	REQUEST_VARS_COOKIE		= BIT(2)	//Cookie
+} request_vars_e;
+
+
 //Этапы обработки задания для соединения
 typedef enum{
 	JOB_STAGE_NONE		= 0,						//Соединение в настоящий момент не обрабатывается
@@ -296,6 +420,17 @@ typedef enum{
 } job_stage_e;
 
 
+
+//Классы заданий рабочих потоков: у каждого класса своя очередь, очереди обслуживаются пропорционально весам job_class_weights
+typedef enum{
+	JOB_CLASS_IO = 0,		//Чтение запроса и отправка ответа
+	JOB_CLASS_HIGH,			//Обработчики маршрутов с высоким приоритетом (легкие запросы, AJAX опросы)
+	JOB_CLASS_NORMAL,		//Обработчики маршрутов по-умолчанию, SSL рукопожатие
+	JOB_CLASS_LOW,			//Тяжелые обработчики маршрутов (долгие запросы к базе данных, отчеты)
+	JOB_CLASSES				//Количество классов заданий
+} job_class_e;
+
+
 //Типы частей контента
 typedef enum{
 	CHUNK_NONE		= 0,	//Нет контента (не использовать, пропустить)
@@ -352,6 +487,16 @@ typedef enum{
 
 
 
+//Роли потоков сервера для привязки к процессорам
+typedef enum{
+	AFFINITY_REACTOR = 0,	//Потоки-реакторы
+	AFFINITY_WORKER,		//Рабочие потоки
+	AFFINITY_INTERNAL,		//Поток внутренних заданий
+	AFFINITY_ROLES			//Количество ролей
+}affinity_role_e;
+
+
+
 
 /***********************************************************************
  * Структуры
@@ -366,15 +511,18 @@ typedef struct	type_request_s			request_s;			//Запрос
 typedef struct	type_response_s			response_s;			//Ответ
 typedef struct	type_connection_s		connection_s;		//Клиентское соединение
 typedef struct	type_fdevent_s			fdevent_s;			//Poll engine
+typedef struct	type_reactor_s			reactor_s;			//Реактор: поток обработки событий сокетов
 typedef struct	type_fd_s				fd_s;				//Элемент дескриптора Fd
 typedef struct	type_thread_s			thread_s;			//Элемент пула потоков
 typedef struct	type_thread_pool_s		thread_pool_s;		//Пул потоков
 typedef struct	type_joblist_s			joblist_s;			//Сипсок рабочих заданий для потоков
 typedef struct	type_jobitem_s			jobitem_s;			//Элемент списка рабочих заданий
+typedef struct	type_jobring_s			jobring_s;			//Сегмент списка рабочих заданий
 typedef struct	type_chunk_s			chunk_s;			//Часть контента
 typedef struct	type_chunkqueue_s		chunkqueue_s;		//Очередь частей контента
 typedef struct	type_ajax_s				ajax_s;				//Ajax ответ
 typedef struct	type_jobinternal_s		jobinternal_s;		//Внутреннее задание для сервера
+typedef struct	type_route_s			route_s;			//Маршрут: обработчик запроса и класс его заданий
 
 
 typedef result_e (*fdevent_handler)(server_s * srv, int revents, void * data);
@@ -387,6 +535,9 @@ typedef struct type_server_options_s{
 	int			max_head_size;				//Максимальный размер HTTP заголовков, принимаемых сервером, в байтах (по-умолчанию, 65536 байт = 64кб)
 	int			max_post_size;				//Максимальный размер POST данных, принимаемых сервером, в байтах (по-умолчанию, 1048576 байт = 1Мб)
 	int			max_upload_size;			//Максимальный размер загружаемого файла, принимаемого сервером, в байтах (по-умолчанию, 524288 байт = 500кб)
+	int			max_multipart_size;			//Максимальный размер POST данных multipart/form-data, принимаемых сервером, в байтах (по-умолчанию, 16777216 байт = 16Мб)
+	int			upload_spool_size;			//Размер загружаемого файла, начиная с которого файл сохраняется во временный файл на диске, в байтах (по-умолчанию, 65536 байт = 64кб)
+	char		* upload_temp_dir;			//Папка временных файлов загрузок (по-умолчанию, /tmp)
 	int			max_read_idle;				//Маскимальное время ожидания данных от клиента (в секундах) -> максимальный интервал времени простоя между получениями данных от клиента (socket read)
 	int			max_request_time;			//Маскимальное время запроса от клиента (в секундах) -> общее максимальное время ожидания сервером получения полного запроса от клиента
 	string_s	public_html;				//Папка, содержащая открытый статичный контент (html, js, css, изобажения, видео и прочие файлы, которые не требуют обработки)
@@ -399,9 +550,32 @@ typedef struct type_server_options_s{
 	char		* dh1024_file;				//Путь к файлам DH параметров: openssl dhparam -out dh1024.pem 1024
 	char		* dh2048_file;				//Путь к файлам DH параметров: openssl dhparam -out dh2048.pem 2048
 	bool		use_ssl;					//Использовать SSL
+	bool		ssl_ktls;					//Использовать kernel TLS: после рукопожатия шифрование выполняется ядром, файлы отдаются через SSL_sendfile()
+	int			ssl_session_cache_size;		//Максимальное количество SSL сессий в кеше сервера, 0 - кеш сессий отключен
+	int			ssl_session_timeout;		//Время жизни SSL сессии в кеше сервера (в секундах)
+	int			ssl_ticket_key_lifetime;	//Время использования ключа шифрования session tickets до его замены новым ключом (в секундах), 0 - session tickets отключены
 	kv_s		* mimetypes;				//MIME Типы и расширения файлов
 	const_string_s * default_mimetype;		//MIME тип по-умолчанию
-	int			worker_threads;				//Количество рабочих потоков
+	int			worker_threads;				//Количество рабочих потоков при старте сервера
+	int			worker_threads_min;			//Минимальное количество рабочих потоков (по-умолчанию, равно worker_threads)
+	int			worker_threads_max;			//Максимальное количество рабочих потоков (по-умолчанию, равно worker_threads)
+	int			worker_idle_timeout;		//Время простоя рабочего потока, после которого поток завершается, если потоков больше worker_threads_min (в секундах)
+	int			worker_grow_wait;			//Время ожидания задания в очереди, при превышении которого пул потоков увеличивается (в миллисекундах)
+	char		* reactor_cpus;				//Процессоры потоков-реакторов в формате cpulist ("0-3,8"), пустая строка - потоки не закрепляются
+	char		* worker_cpus;				//Процессоры рабочих потоков в формате cpulist
+	char		* internal_cpus;			//Процессоры потока внутренних заданий в формате cpulist
+	bool		numa_local;					//Выделять память закрепленных потоков в локальном узле NUMA
+	int			reactor_threads;			//Количество потоков-реакторов, каждый со своим прослушиваемым сокетом (SO_REUSEPORT)
+	int			keepalive_timeout;			//Маскимальное время ожидания следующего запроса на keep-alive соединении (в секундах), 0 - keep-alive отключен
+	int			keepalive_requests;			//Максимальное количество запросов на одном keep-alive соединении, 0 - без ограничений
+	uint32_t	max_fds;					//Максимальное количество дескрипторов процесса (по-умолчанию, лимит RLIMIT_NOFILE)
+	uint32_t	max_connections;			//Максимальное количество одновременных соединений для каждого реактора (по-умолчанию, (max_fds - server_reserved_fds) / количество реакторов)
+	uint32_t	overload_connections;		//Количество соединений реактора, при котором сервер переходит в режим перегрузки, 0 - не проверяется
+	uint32_t	overload_queue_depth;		//Общее количество заданий в очередях рабочих потоков, при котором сервер переходит в режим перегрузки, 0 - не проверяется
+	int			overload_wait;				//Время ожидания задания в очереди (в миллисекундах, перцентиль overload_wait_percentile), при котором сервер переходит в режим перегрузки, 0 - не проверяется
+	int			overload_wait_percentile;	//Перцентиль времени ожидания заданий в очереди, сравниваемый с overload_wait
+	int			overload_recover;			//Нагрузка (в процентах от порогов), до которой она должна снизиться для выхода из режима перегрузки
+	int			overload_retry_after;		//Значение заголовка Retry-After ответа 503 в режиме перегрузки (в секундах)
 } server_options_s;
 
 
@@ -416,10 +590,33 @@ typedef struct type_request_parser_s{
 	uint32_t		ptr_n;			//Текущая позиция (n символов от начала буффера)
 	uint32_t		body_n;			//Начало тела запроса (n символов от начала буффера)
 	uint32_t		body_len;		//Длинна тела запроса (n символов)
+	bool			pipelined;		//Буфер содержит начало запроса, полученное вместе с предыдущим запросом (HTTP pipelining)
 }request_parser_s;
 
 
 
+//Результат просмотра строки заголовков запроса (core/scan.c)
+typedef struct type_request_line_s{
+	uint32_t		len;			//Длинна строки без [\r\n]
+	int32_t			colon;			//Позиция первого разделителя [:], -1 - не найден
+	int32_t			space;			//Позиция первого пробела, -1 - не найден
+	uint32_t		spaces;			//Количество пробелов и табуляций в строке
+	bool			illegal;		//В строке есть недопустимые символы (управляющие символы, кроме табуляции, и DEL)
+}request_line_s;
+
+
+
+//Заголовок запроса: имя и значение хранятся в буфере запроса request_s->data
+//Позиции задаются смещениями от начала буфера, т.к. при получении данных буфер может быть перемещен (realloc)
+typedef struct type_request_header_s{
+	uint32_t		name_n;			//Начало имени заголовка (n символов от начала буфера)
+	uint32_t		name_len;		//Длинна имени заголовка
+	uint32_t		value_n;		//Начало значения заголовка (n символов от начала буфера), значение завершается '\0'
+	uint32_t		value_len;		//Длинна значения заголовка
+}request_header_s;
+
+
+
 //Структура URL адреса
 typedef struct type_request_uri_s{
 	string_s uri;
@@ -433,13 +630,46 @@ typedef struct type_request_uri_s{
 //Структура информации о файле, полученном из POST запроса
 typedef struct type_post_file_s{
 	//Имя поля POST запроса хранится в структуре KV (con->request.files) и здесь не представлено
-	const_string_s	filename;	//Имя файла					<- Содержит указатель на буфер запроса con->request.data->buffer
-	const_string_s	mimetype;	//MIME тип файла			<- Содержит указатель на буфер запроса con->request.data->buffer
-	const_string_s	content;	//Содержимое файла			<- Содержит указатель на буфер запроса con->request.data->buffer
+	string_s		filename;	//Имя файла
+	string_s		mimetype;	//MIME тип файла
+	string_s		content;	//Содержимое файла, если файл хранится в памяти (размер меньше upload_spool_size), иначе NULL
+	uint32_t		size;		//Размер файла
+	int				fd;			//Дескриптор временного файла с содержимым (позиция в начале файла), -1 - файл хранится в памяти
+	char			* path;		//Путь к временному файлу, NULL - файл хранится в памяти
+								//Временный файл удаляется по завершении запроса, обработчик может переместить его (rename)
 } post_file_s;
 
 
 
+//Этап разбора тела multipart/form-data
+typedef enum{
+	MULTIPART_PREAMBLE = 0,		//Данные до первой границы
+	MULTIPART_BOUNDARY,			//Окончание границы: [\r\n] - начало части, [--] - конец тела
+	MULTIPART_HEADERS,			//Заголовки части
+	MULTIPART_DATA,				//Содержимое части
+	MULTIPART_DONE				//Найдена завершающая граница
+} multipart_state_e;
+
+
+//Максимальная длинна границы multipart/form-data (RFC 2046)
+#define XG_MULTIPART_BOUNDARY_MAX 70
+
+
+//Структура потокового разбора тела multipart/form-data (core/multipart.c)
+typedef struct type_multipart_parser_s{
+	multipart_state_e	state;			//Этап разбора
+	char				delimiter[XG_MULTIPART_BOUNDARY_MAX + 4];	//Разделитель частей: [\r\n--] + граница
+	uint32_t			delimiter_len;	//Длинна разделителя
+	uint8_t				skip[256];		//Таблица сдвигов поиска разделителя (Бойер-Мур-Хорспул)
+	uint32_t			body_read;		//Количество обработанных байт тела запроса
+	uint32_t			fields_size;	//Суммарный размер текстовых полей
+	string_s			name;			//Имя поля текущей части
+	post_file_s			* file;			//Файл текущей части, NULL - текстовое поле
+	buffer_s			* value;		//Значение текстового поля или содержимое файла до сохранения на диск
+} multipart_parser_s;
+
+
+
 //Структура информации о статичном файле на сервере
 typedef struct type_static_file_s{
 	/*
@@ -487,23 +717,28 @@ typedef struct type_request_s{
 	string_s			host;				//Запрашиваемый Host
 	request_uri_s		uri;				//URI запроса
 	buffer_s			* data;				//Буфер входящих данных запроса
-	kv_s				* headers;			//Заголовки запроса
+	buffer_s			* pipeline;			//Данные, полученные после окончания текущего запроса - начало следующего запроса (HTTP pipelining)
+	request_header_s	* header_list;		//Заголовки запроса (имена и значения в буфере data)
+	uint32_t			headers_count;		//Количество заголовков запроса
+	uint32_t			headers_size;		//Размер массива header_list (массив сохраняется между запросами keep-alive соединения)
+	uint16_t			headers_known[HEADER_KNOWN];	//Позиции известных заголовков в header_list + 1, 0 - заголовок не получен
+	kv_s				* headers;			//Заголовки запроса в виде KV, создаются при первом обращении (requestGetHeaders)
 	size_t				headers_bits;		//Битовая матрица найденных заголовков set of enum header_e
-	kv_s				* get;				//GET параметры
-	kv_s				* post;				//POST параметры
-	kv_s				* cookie;			//Cookie параметры
-	kv_s				* files;			//Файлы, полученные от клиента в POST запросе
+	kv_s				* get;				//GET параметры, разбираются при первом обращении (requestGetGPC)
+	kv_s				* post;				//POST параметры, разбираются при первом обращении (requestGetGPC, requestGetFile)
+	kv_s				* cookie;			//Cookie параметры, разбираются при первом обращении (requestGetGPC)
+	kv_s				* files;			//Файлы, полученные от клиента в POST запросе, разбираются вместе с POST параметрами
+	uint32_t			vars_parsed;		//Разобранные источники переменных set of enum request_vars_e
 	request_range_s		* ranges;			//Информация о запрашиваемых диапазонах (частях) файла
 	static_file_s		* static_file;		//Информация о запрошенном статичном файле
-	const_string_s		if_none_match;		//Значение If-None-Match, полученное от клиента 
-	const_string_s		user_agent;			//Значение User-Agent
-	const_string_s		referer;			//Значение Referer
 	request_method_e	request_method;		//Метод запроса: GET, POST
 	http_version_e		http_version;		//Версия HTTP протокола клиента
 	uint32_t			content_length;		//Длинна контента POST запроса (Значение Content-Length в заголовках)
 	post_method_e		post_method;		//Метод обработки POST запроса (application/x-www-form-urlencoded или multipart/form-data)
 	string_s			multipart_boundary;	//Граница при POST_MULTIPART (Content-Type: multipart/form-data; boundary=[xxxxxxxxxxxxx])
+	multipart_parser_s	* multipart;		//Потоковый разбор тела POST_MULTIPART по мере получения данных
 	bool				is_ajax;			//Признак, указывающий что запрос в AJAX формате (X-Requested-With: XMLHttpRequest)
+	bool				keep_alive;			//Признак, указывающий что клиент хочет сохранить соединение после ответа (HTTP/1.1 по-умолчанию или Connection: keep-alive)
 } request_s;
 
 
@@ -533,10 +768,13 @@ typedef struct type_fd_s{
 //Poll engine - обработка Poll
 typedef struct type_fdevent_s{
 	server_s			* server;			//Указатель на родительскую структуру server_s
-	fd_s				** fds;				//Массив дескрипторов fd
+	reactor_s			* reactor;			//Указатель на реактор, владеющий Poll engine
+	fd_s				** fds;				//Массив дескрипторов fd (индекс массива - дескриптор)
+	uint32_t			fds_size;			//Размер массива fds
 #ifdef USE_POLL
 	struct pollfd		* pollfds;			//Массив дескрипторов для poll
 	uint32_t			pollfds_count;		//Количество дескрипторов
+	uint32_t			pollfds_size;		//Размер массива pollfds
 #endif
 #ifdef USE_EPOLL
 	int epoll_fd;
@@ -549,29 +787,45 @@ typedef struct type_fdevent_s{
 //Структура клиентского соединения
 typedef struct type_connection_s{
 
+	//Горячие поля: используются реактором при обработке каждого события соединения
 	server_s			* server;			//Указатель на родительскую структуру server_s
+	reactor_s			* reactor;			//Указатель на реактор, обслуживающий соединение
+	SSL *				ssl;				//SSL соединение
 
 	connection_stage_e	stage;				//Текущее состояние соединения
 	socket_t			fd;					//Дескриптор текущего соединения
-	int					index;				//Индекс текущего соединения в массиве соединений
-	socket_addr_s		remote_addr;		//Адрес клиента
-	int					http_code;			//HTTP статус обработки запроса (код ответа)
+	int					index;				//Индекс текущего соединения в массиве активных соединений реактора, -1 - соединение свободно
+	job_stage_e			job_stage;			//Состояние обработки соединения(не обрабатывается, находится в списке работ или обрабатывается) рабочим потоком
+	uint32_t			job_gen;			//Поколение заданий соединения: увеличивается при добавлении в список заданий и при удалении из него
+	uint64_t			job_queued_ms;		//Время добавления соединения в список заданий рабочих потоков (монотонное время в миллисекундах)
+	uint64_t			job_deadline_ms;	//Срок, после которого задание соединения не выполняется, а соединение закрывается (монотонное время в миллисекундах), 0 - без срока
 
-	SSL *				ssl;				//SSL соединение
-	uint32_t 			renegotiations;		//Количество SSL "рукопожатий" перед установкой соединения
+	uint64_t			timer_deadline;		//Время срабатывания таймера соединения (монотонное время в миллисекундах)
+	uint32_t			timer_index;		//Позиция соединения в куче таймеров реактора + 1, 0 - таймер не установлен
+	bool				handshake_wait;		//SSL "рукопожатие", выполняемое рабочим потоком, ожидает готовности сокета (SSL_ERROR_WANT_READ / SSL_ERROR_WANT_WRITE)
+	bool				read_wait;			//Рабочий поток прочитал все доступные данные запроса, чтение ожидает готовности сокета
+	bool				keep_alive;			//Признак, указывающий что соединение будет сохранено после отправки текущего ответа
 
-	request_s			request;			//Клиентский запрос
+	time_t				start_ts;			//Время старта соединения
+	time_t				read_idle_ts;		//Время начала простоя при выполнении операций чтения из сокета (в режиме ожидания данных)
+	time_t				keepalive_ts;		//Время перехода соединения в режим ожидания следующего запроса (keep-alive)
+
+	struct type_connection_s * next_free;	//Следующее соединение в списке свободных соединений реактора
+
+	//Холодные поля: используются при разборе запроса и формировании ответа, начинаются с новой кеш-линии
+	request_s			request XG_CACHE_ALIGNED;	//Клиентский запрос
 	response_s			response;			//Серверный ответ
 	session_s			* session;			//Сессия клиента на текущем соединении
 
 	ajax_s				* ajax;				//Структура AJAX ответа сервера
+	route_s				* route;			//Маршрут текущего запроса, NULL - запрос статичного файла
 
-	time_t				start_ts;			//Время старта соединения
-	time_t				read_idle_ts;		//Время начала простоя при выполнении операций чтения из сокета (в режиме ожидания данных)
-	time_t				close_timeout_ts;	//Время начала закрытия сокета
+	socket_addr_s		remote_addr;		//Адрес клиента
+	int					http_code;			//HTTP статус обработки запроса (код ответа)
+	uint32_t 			renegotiations;		//Количество SSL "рукопожатий" перед установкой соединения
 
-	job_stage_e			job_stage;			//Состояние обработки соединения(не обрабатывается, находится в списке работ или обрабатывается) рабочим потоком
-	jobitem_s			* job_item;			//Элемент в jobitem
+	time_t				close_timeout_ts;	//Время начала закрытия сокета
+	uint32_t			requests_count;		//Количество обработанных на соединении запросов
 
 	connection_error_e	connection_error;	//Номер последней ошибки, возникшей в процессе обработки соединения
 
@@ -581,30 +835,61 @@ typedef struct type_connection_s{
 
 
 
-//Структура сервера
-typedef struct type_server_s{
-	connection_s **		connections;		//Массив клиентских соединений
-	uint32_t			connections_count;	//Количество занятых слотов (количество установленных соединений)
+//Структура реактора
+//Каждый реактор работает в собственном потоке, имеет собственный прослушиваемый сокет (SO_REUSEPORT),
+//собственный Poll engine, таблицу соединений и список заданий для основного потока
+typedef struct type_reactor_s{
+	server_s			* server;			//Указатель на родительскую структуру server_s
+	size_t				index;				//Индекс реактора в массиве реакторов сервера
+	pthread_t			thread_id;			//Дескриптор потока реактора
+
+	connection_s **		connections;		//Плотный массив активных клиентских соединений [0, connections_count)
+	uint32_t			connections_count;	//Количество установленных соединений
+	uint32_t			connections_size;	//Размер массива connections
+	connection_s *		connections_free;	//Список свободных структур соединений (связан через connection_s->next_free)
 
 	fdevent_s *			fdevent;			//Poll engine
+	joblist_s *			jobmain;			//Указатель на список рабочих заданий для потока реактора
 
-	thread_pool_s *		workers;			//Указатель на пул рабочих потоков
-	joblist_s *			joblist;			//Указатель на список заданий для рабочих потоков
+	connection_s **		timers;				//Куча таймеров соединений (в корне - соединение с ближайшим сроком срабатывания)
+	uint32_t			timers_count;		//Количество установленных таймеров
+	uint32_t			timers_size;		//Размер массива timers
+
+	time_t				current_ts;			//Текущее Unix время реактора
+	uint64_t			current_ms;			//Текущее монотонное время реактора в миллисекундах (таймеры, сроки заданий, интервалы)
+	uint64_t			clock_offset_ms;	//Разница между Unix и монотонным временем в миллисекундах (перевод отметок *_ts в монотонное время)
 
-	joblist_s *			jobmain;			//Указатель на список рабочих заданий для основного потока
+	socket_t			listen_fd;			//Прослушиваемый сокет
+	socket_t			wakeup_fd;			//eventfd, событие которого прерывает ожидание poll
+	socket_t			spare_fd;			//Резервный дескриптор: освобождается при исчерпании дескрипторов (EMFILE / ENFILE), чтобы принять соединение и ответить 503
+	uint64_t			accept_paused_ms;	//Время приостановки приема соединений при исчерпании дескрипторов (монотонное время в миллисекундах), 0 - прием не приостановлен
+	int					wakeup_pending;		//Признак отправленного, но еще не обработанного пробуждения (объединяет пробуждения от нескольких потоков)
+} reactor_s;
 
-	time_t				current_ts;			//Текущее время сервера
+
+
+//Структура сервера
+typedef struct type_server_s{
+	reactor_s **		reactors;			//Массив реакторов
+	size_t				reactors_count;		//Количество реакторов
+
+	thread_pool_s *		workers;			//Указатель на пул рабочих потоков
 
 	//Прослушиваемый сокет
 	socket_type_e		socket_type;	//Тип прослушиваемо сокета
 	socket_addr_s		addr;			//Адрес
-	socket_t			listen_fd;		//Прослушиваемый сокет
-	socket_t			pipe[2];	//Сокеты, события которых будут прерывать ожидание poll
+	socklen_t			addr_len;		//Размер адреса
 
 	SSL_CTX 			* ctx;		//Указатель на SSL Context
 	bool				stopped;	//Признак, указывающий что сервер остановлен и должен прекратить свою работу
 	server_options_s	config;		//Настройки из конфигурационного файла
 
+	//Режим перегрузки: новые соединения получают ответ 503 от реактора без передачи рабочим потокам
+	int					overloaded;			//Признак режима перегрузки (устанавливается реактором 0)
+	uint64_t			overload_since_ms;	//Время перехода в режим перегрузки (монотонное время в миллисекундах)
+	uint64_t			overload_check_ms;	//Время последней проверки перегрузки (монотонное время в миллисекундах)
+	uint64_t			overload_shed;		//Количество соединений, отклоненных ответом 503
+
 } server_s;
 
 
@@ -622,7 +907,12 @@ typedef struct type_thread_s{
 	pthread_t		thread_id;	//Дескриптор потока
 	size_t			index;		//Индекс потока в пуле потоков
 	connection_s	* con;		//Указатель на обрабатываемое соединение
+	joblist_s		* queues[JOB_CLASSES];	//Очереди заданий потока по классам заданий
+	int32_t			credits[JOB_CLASSES];	//Текущие кредиты очередей для взвешенной выборки заданий (smooth weighted round-robin)
+	pthread_cond_t	condition;	//Условие, на котором поток ожидает появления заданий
+	int				sleeping;	//Признак, указывающий что поток ожидает на condition
 	bool 			destroy;	//Признак, указывающий что поток должен завершиться
+	bool			exited;		//Признак, указывающий что поток завершился (задания из его очереди забирают другие потоки)
 } thread_s;
 
 
@@ -630,30 +920,58 @@ typedef struct type_thread_s{
 //Структура пула потоков
 typedef struct type_thread_pool_s{
 	server_s		* server;		//Указатель на уструктуру сервера, использующего пул потоков
-	thread_s		** threads;		//Массив доступных потоков
-	size_t			threads_count;	//Общее количество потоков
+	thread_s		** threads;		//Массив потоков размером threads_max (позиция потока в массиве не меняется до завершения пула)
+	size_t			threads_count;	//Количество активных потоков: задания распределяются по потокам в позициях [0, threads_count)
+	size_t			threads_slots;	//Количество созданных позиций массива threads (включая позиции завершившихся потоков)
+	size_t			threads_min;	//Минимальное количество потоков
+	size_t			threads_max;	//Максимальное количество потоков
+	size_t			threads_running;	//Количество работающих (не завершившихся) потоков
 	size_t			threads_idle;	//Общее количество простаивающих потоков
-	pthread_cond_t	condition;		//Условие
+	uint32_t		threads_sleeping;	//Количество потоков, ожидающих на condition (потокам, проверяющим список заданий без сна, сигнал не нужен)
+	uint64_t		wait_max_ms;	//Максимальное время ожидания задания в очереди с момента последней проверки нагрузки (в миллисекундах)
+	uint32_t		wait_histogram[XG_WAIT_HISTOGRAM_SIZE];	//Гистограмма времени ожидания заданий в очереди с момента последней проверки перегрузки сервера
+	uint64_t		adjust_ms;		//Время последней проверки нагрузки на пул потоков (монотонное время в миллисекундах)
 	pthread_mutex_t	mutex;			//Блокировка
 } thread_pool_s;
 
 
 
-//Структура элемента списка рабочих заданий
+//Структура элемента (ячейки кольцевого буфера) списка рабочих заданий
 typedef struct type_jobitem_s{
-	connection_s		* connection;	//Список соединений, ждущих обработки
-	jobitem_s			* next;			//Следующий элемент
-	bool				ignore;			//Признак, указывающий что данный элемент следует проигнорировать
+	size_t				sequence;		//Порядковый номер ячейки: определяет, свободна ли ячейка для записи или готова для чтения
+	connection_s		* connection;	//Соединение, ждущее обработки
+	uint32_t			generation;		//Поколение задания: если не совпадает с connection->job_gen, задание игнорируется
 } jobitem_s;
 
 
 
+//Сегмент списка рабочих заданий: кольцевой буфер фиксированного размера
+typedef struct type_jobring_s{
+	jobitem_s		* items;	//Кольцевой буфер заданий
+	size_t			mask;		//Размер буфера - 1
+	size_t			enqueue_pos XG_CACHE_ALIGNED;	//Позиция записи (производители)
+	size_t			dequeue_pos XG_CACHE_ALIGNED;	//Позиция чтения (потребители)
+} jobring_s;
+
+
+//Максимальное количество сегментов списка рабочих заданий
+#define XG_JOBLIST_SEGMENTS 16
+
+
 //Структура списка рабочих заданий
 typedef struct type_joblist_s{
 	server_s		* server;	//Указатель на уструктуру сервера, использующего список рабочих заданий
-	jobitem_s		* first;	//Первый элемент списка рабочих заданий
-	jobitem_s		* last;		//Последний элемент списка рабочих заданий
-	jobitem_s		* idle;		//Свободные элементы списка рабочих заданий
+	jobring_s		* segments[XG_JOBLIST_SEGMENTS];	//Сегменты списка: задания добавляются в последний сегмент, извлекаются начиная с первого
+	size_t			segments_count;	//Количество созданных сегментов
+	size_t			capacity;		//Общая вместимость сегментов
+	pthread_mutex_t	grow_mutex;		//Блокировка добавления сегмента при заполнении последнего сегмента
+	uint64_t		stat_push_retries XG_CACHE_ALIGNED;	//Количество повторов CAS при добавлении заданий (конкуренция производителей)
+	uint64_t		stat_pop_retries;	//Количество повторов CAS при извлечении заданий (конкуренция потребителей)
+	uint64_t		stat_full_waits;	//Количество ожиданий освобождения места в заполненном буфере
+	uint64_t		stat_stale;			//Количество пропущенных устаревших заданий
+	uint64_t		stat_stolen;		//Количество заданий, забранных из очереди другими рабочими потоками
+	uint64_t		stat_expired;		//Количество пропущенных заданий с истекшим сроком выполнения
+	uint64_t		stat_disconnected;	//Количество пропущенных заданий соединений, сброшенных клиентом
 } joblist_s;
 
 
@@ -691,6 +1009,7 @@ typedef struct type_chunkqueue_s{
 		uint32_t	written_n;	//Количество байт, отправленных в текущей части
 	} current;
 	uint32_t		content_length;	//Общая длинна контента
+	bool			zero_copy;	//Части контента из файлов передаются в сокет через sendfile(), chunkqueueRead() не читает файл во внутренний буфер
 	chunkqueue_s	* next;		//для IDLE
 }chunkqueue_s;
 
@@ -734,18 +1053,19 @@ typedef struct type_jobinternal_s{
 connection_stage_e	connectionSetStage(connection_s * con, connection_stage_e new_stage);	//Устанавливает новый этап жизненного цикла соединения
 job_stage_e			connectionSetJobStage(connection_s * con, job_stage_e new_stage, bool necessarily);	//Устанавливает новый этап обработки соединения рабочим потоком
 
-result_e		connectionsCreate(server_s * srv);				//Создание массива структур клиентских соединений
-result_e		connectionsFree(server_s * srv);				//Удаление массива структур клиентских соединений
-void			connectionsPrint(server_s * srv);				//Вывод на экран состояния активных соединений
-connection_s *	connectionGet(server_s * srv);					//Возвращает экземпляр доступного для использования клиентского соединения или NULL, если нет доступных соединений
+result_e		connectionsCreate(reactor_s * reactor);			//Создание массива структур клиентских соединений реактора
+result_e		connectionsFree(reactor_s * reactor);			//Удаление массива структур клиентских соединений реактора
+void			connectionsPrint(reactor_s * reactor);			//Вывод на экран состояния активных соединений реактора
+connection_s *	connectionGet(reactor_s * reactor);				//Возвращает экземпляр доступного для использования клиентского соединения или NULL, если нет доступных соединений
 uint64_t		connectionGetLastId(void);						//Возвращает последний ID соединения
 result_e		connectionClear(connection_s * con);			//Сбрасывает структуру клиентского соединения до начальных параметров
 result_e		connectionDelete(connection_s * con);			//"Удаляет" соединение (фактически структура не удаляется, а сбрасывается до начального состояния)
 result_e		connectionClose(connection_s * con);			//Закрытие соединения
-connection_s * 	connectionAccept(server_s * srv);				//Принимает клиентское соединение
+connection_s * 	connectionAccept(reactor_s * reactor);			//Принимает клиентское соединение на прослушиваемом сокете реактора
 const char *	connectionStageAsString(connection_stage_e s);	//Возвращает этап соединения в виде строки
 const char *	connectionErrorAsString(connection_error_e e);	//Возвращает текстовое описание ошибки соединения
 result_e		connectionEngine(connection_s * con);			//Обработка соединения согласно его текущего этапа жизненного цикла
+void			connectionTimeout(connection_s * con);			//Обработка сработавшего таймера соединения
 
 result_e		connectionHandleRead(connection_s * con);		//Чтение данных от клиента
 result_e		connectionHandleReadSSL(connection_s * con);	//Чтение SSL данных от клиента
@@ -774,6 +1094,10 @@ void			chunkqueueReset(chunkqueue_s * cq);	//Сбросить счетчик п
 inline bool		chunkqueueIsEmpty(chunkqueue_s * cq);	//Проверяет, пуста очередь или нет
 result_e		chunkqueueRead(chunkqueue_s * cq, const char ** pointer, uint32_t * length);	//Читает из очереди очередную порцию контента для отправки клиенту
 void			chunkqueueCommit(chunkqueue_s * cq, uint32_t length);	//Вызов функции "говорит" очереди о том, что было успешно отправлено length байт данных
+ssize_t			chunkqueueSendFile(chunkqueue_s * cq, socket_t sock_fd, uint32_t length);	//Отправляет в сокет данные текущей части контента из файла через sendfile()
+ssize_t			chunkqueueSendFileSSL(chunkqueue_s * cq, SSL * ssl, uint32_t length);	//Отправляет в SSL соединение (kTLS) данные текущей части контента из файла через SSL_sendfile()
+int				chunkqueueReadVector(chunkqueue_s * cq, struct iovec * iov, int iov_max, uint32_t max_length, uint32_t * length);	//Заполняет массив iov указателями на идущие подряд части контента, находящиеся в памяти
+result_e		chunkqueueReadCoalesced(chunkqueue_s * cq, const char ** pointer, uint32_t * length, uint32_t max_length);	//Читает из очереди порцию контента, объединяя небольшие части контента из памяти в один блок
 chunk_s *		chunkqueueSetHeaderBuffer(chunkqueue_s * cq, buffer_s * buf, bool vfree);	//Устанавливает буфер с заголовками в начале очереди
 
 
@@ -801,6 +1125,7 @@ DH * 		sslDHLoad(const char * dh_file);		//Загрузка DH параметр
 bool		sslThreadSetup(void);					//Инициализация потоков SSL
 bool 		sslThreadCleanup(void);					//Уничтожение потоков SSL
 result_e	sslDoHandshake(SSL * ssl);				//Проверка готовности SSL соединения
+bool		sslKtlsSendEnabled(SSL * ssl);			//Проверяет, выполняется ли шифрование отправляемых данных ядром (kTLS)
 result_e	sslRead(SSL * ssl, char * buf, size_t buf_size, size_t * pcnt_read);	//Чтение данных из SSL
 result_e	sslWrite(SSL * ssl, const char * buf, size_t buf_size, size_t * pcnt_write);	//Запись данных в SSL
 
@@ -812,7 +1137,7 @@ result_e	sslWrite(SSL * ssl, const char * buf, size_t buf_size, size_t * pcnt_wr
 
 fd_s *			fdNew(void);						//Создание элемента fd_s
 inline void 	fdFree(fd_s *fdn);					//Освобождение элемента fd_s
-fdevent_s *		fdeventNew(server_s * srv);			//Создание структуры FD events
+fdevent_s *		fdeventNew(reactor_s * reactor);	//Создание структуры FD events для реактора
 void			fdeventFree(fdevent_s *ev);			//Освобождение структуры FD events
 bool 			fdeventAdd(fdevent_s * ev, socket_t fd, fdevent_handler handler, void * data);	//Добавление сокета в Poll engine
 bool			fdeventRemove(fdevent_s * ev, socket_t fd);	//Удаление сокета из Poll engine
@@ -831,18 +1156,75 @@ int				fdEventGetNextIndex(fdevent_s * ev, int index);	//Возвращает с
 //Работа с сервером
 void			serverInit(void);								//Инициализация сервера
 void			serverSetConfig(server_s * srv);				//Применяет опции конфигурации из webserver.conf к серверу
-void			serverInitListener(server_s * srv);				//Инициализация прослушивающего сокета сервера
+void			serverInitLimits(server_s * srv, size_t reactors_count);	//Определение лимитов дескрипторов и соединений исходя из RLIMIT_NOFILE
+void			serverInitAddress(server_s * srv);				//Определение адреса прослушиваемого сервером сокета
+void			serverInitListener(reactor_s * reactor);		//Инициализация прослушивающего сокета реактора
 
 
 
+/***********************************************************************
+ * Функции: core/reactor.c - Потоки-реакторы
+ **********************************************************************/
+
+result_e		reactorsCreate(server_s * srv, size_t count);	//Создание реакторов сервера
+void			reactorsFree(server_s * srv);					//Уничтожение реакторов сервера
+result_e		reactorsStart(server_s * srv);					//Запуск реакторов (реактор 0 выполняется в текущем потоке, функция возвращает управление после остановки сервера)
+void			reactorWakeup(reactor_s * reactor);				//Прерывает ожидание poll в потоке реактора
+void			reactorAcceptExhausted(reactor_s * reactor);	//Обработка исчерпания дескрипторов при приеме соединения (EMFILE / ENFILE)
+
+
+
+/***********************************************************************
+ * Функции: core/affinity.c - Привязка потоков к процессорам и узлам NUMA
+ **********************************************************************/
+
+void			affinityInit(server_s * srv);			//Разбор наборов процессоров из конфигурации сервера и вывод настроек привязки потоков
+void			affinityApply(affinity_role_e role, size_t index, pthread_t thread);	//Закрепление потока за процессорами роли
+
+
+
+/***********************************************************************
+ * Функции: core/scan.c - Векторный просмотр строк заголовков HTTP запроса
+ **********************************************************************/
+
+void			scanInit(void);		//Выбор реализации просмотра строк по возможностям процессора
+const char *	scanRequestLine(const char * line, size_t len, request_line_s * scan);	//Просмотр строки заголовков запроса, возвращает указатель на начало следующей строки или NULL
+
+
+
+/***********************************************************************
+ * Функции: core/overload.c - Контроль перегрузки сервера
+ **********************************************************************/
+
+void			overloadInit(server_s * srv);					//Подготовка ответа 503 и вывод порогов перегрузки
+void			overloadCheck(server_s * srv, uint64_t now_ms);	//Проверка нагрузки сервера и переключение режима перегрузки
+bool			overloadActive(server_s * srv);					//Возвращает true, если сервер работает в режиме перегрузки
+result_e		overloadShed(reactor_s * reactor);				//Принимает соединение и отвечает 503 без его обработки
+result_e		overloadShedSpare(reactor_s * reactor);			//Принимает соединение на резервный дескриптор реактора и отвечает 503 (при исчерпании дескрипторов)
+
+
+
+/***********************************************************************
+ * Функции: core/timer.c - Таймеры соединений реактора
+ **********************************************************************/
+
+result_e		timersCreate(reactor_s * reactor);				//Создание кучи таймеров реактора
+void			timersFree(reactor_s * reactor);				//Уничтожение кучи таймеров реактора
+void			timerSet(connection_s * con, uint64_t deadline_ms);	//Устанавливает (или переносит) таймер соединения
+void			timerDelete(connection_s * con);				//Удаляет таймер соединения, если он был установлен
+connection_s *	timerGetExpired(reactor_s * reactor, uint64_t now_ms);	//Возвращает соединение со сработавшим таймером или NULL
+int				timerNextTimeout(reactor_s * reactor, uint64_t now_ms, int max_ms);	//Возвращает интервал до срабатывания ближайшего таймера
+
+
 /***********************************************************************
  * Функции: core/threads.c - Работа с пулом рабочих потоков сервера
  **********************************************************************/
 
 result_e		threadPoolCreate(server_s * server, size_t count);		//Создание пула потоков
 result_e		threadPoolFree(thread_pool_s * pool);	//Завершение пула потоков
-thread_s * 		threadCreate(thread_pool_s * pool);		//Создание нового потока
-inline void		threadWakeup(thread_pool_s * pool);		//Посылает сигнал для "пробуждения" потока, т.к. появилось задание
+thread_s * 		threadCreate(thread_pool_s * pool, size_t index);	//Создание нового потока
+void			threadPoolAdjust(thread_pool_s * pool, uint64_t now_ms);	//Увеличение пула потоков, если задания ожидают обработки слишком долго
+void			threadWakeup(thread_pool_s * pool, thread_s * thread);	//Посылает сигнал для "пробуждения" потока, т.к. в его очереди появилось задание
 result_e		threadConnectionEngine(connection_s * con);	//Обработка соединения рабочим потоком согласно его текущего статуса
 mysql_s *		threadGetMysqlInstance(const char * instance_name);	//Получение экземпляра соединения с базой данных MySQL для текущего потока
 
@@ -851,17 +1233,22 @@ mysql_s *		threadGetMysqlInstance(const char * instance_name);	//Получен
  * Функции: core/joblist.c - Работа со списком заданий
  **********************************************************************/
 
-result_e		joblistCreate(server_s * srv);		//Создание списка рабочих заданий
-result_e		joblistFree(joblist_s * joblist);	//Уничтожение списка рабочих заданий
+joblist_s *		joblistCreate(server_s * srv, size_t capacity);	//Создание очереди заданий рабочего потока
+result_e		joblistFree(joblist_s * joblist);	//Уничтожение очереди заданий рабочего потока
 void			jobAdd(connection_s * con);			//Добавление соединения в список заданий для обработки рабочим потоком
-connection_s *	jobGet(joblist_s * joblist);		//Возвращает первое на очереди задание, одновременно удаляя его из списка заданий
+connection_s *	jobGet(thread_s * thread);			//Возвращает первое на очереди задание потока (или задание из очереди другого потока), одновременно удаляя его из очереди
+bool			jobAvailable(thread_s * thread);	//Возвращает true, если для потока есть задания
+bool			jobRequeue(connection_s * con);		//Возвращает обрабатываемое соединение в очередь класса его маршрута, если в очереди потока есть другие задания
+size_t			jobQueued(thread_s * thread);		//Возвращает количество заданий во всех очередях потока
 bool			jobDelete(connection_s * con);		//Идаляет соединение из очереди рабочих заданий
+bool			joblistIsEmpty(joblist_s * list);	//Возвращает true, если в списке нет заданий
+size_t			joblistLength(joblist_s * list);	//Возвращает количество заданий в списке
+void			joblistPrintStats(joblist_s * list, const char * name);	//Вывод на экран счетчиков конкуренции списка заданий
 
-result_e		jobmainCreate(server_s * srv);		//Создание списка заданий для основного потока
+result_e		jobmainCreate(reactor_s * reactor);	//Создание списка заданий для потока реактора
 result_e		jobmainFree(joblist_s * jobmain);	//Уничтожение списка заданий
 void			jobmainAdd(connection_s *con);		//Добавление соединения в список заданий для обработки основным потоком
 connection_s *	jobmainGet(joblist_s * jobmain);	//Возвращает первое на очереди задание, одновременно удаляя его из списка заданий
-bool			jobmainDelete(joblist_s * jobmain, connection_s * con);	//Ищет задание в очереди заданий и удаляет его
 
 /***********************************************************************
  * Функции: core/request.c - Функции обработки HTTP запроса
@@ -871,24 +1258,38 @@ bool			jobmainDelete(joblist_s * jobmain, connection_s * con);	//Ищет зад
 inline void		requestFree(request_s * request);			//Освобождение структуры request_s
 request_s * 	requestClear(request_s * request);			//Очистка структуры request_s
 result_e		requestParseURI(request_uri_s * uri, const char * raw_uri, size_t ilen, const_string_s * directory_index);	//Парсинг URI адреса запроса в структуру request_uri_s
-int				requestParseFirstLine(connection_s * con, const char * line, size_t len);	//Парсинг первой строки заголовков запроса GET /uri HTTP/x.y[\r\n], возвращает 0 в случае успеха или код HTTP ошибки
-int				requestParseHeaderLine(connection_s * con, const char * line, uint32_t len);	//Функция обрабатывает строку заголовка запроса, возвращает 0 в случае успеха или код HTTP ошибки
+int				requestParseFirstLine(connection_s * con, const char * line, const request_line_s * scan);	//Парсинг первой строки заголовков запроса GET /uri HTTP/x.y[\r\n], возвращает 0 в случае успеха или код HTTP ошибки
+int				requestParseHeaderLine(connection_s * con, const char * line, const request_line_s * scan);	//Функция обрабатывает строку заголовка запроса, возвращает 0 в случае успеха или код HTTP ошибки
 int				requestHeadersToVariables(connection_s * con);	//Обработка заголовков запроса в переменные соединения, возвращает 0 в случае успеха или код HTTP ошибки
 kv_s * 			requestParseCookies(const char * cookies);	//Парсинг Cookie в структуру KV
 request_range_s * requestParseHttpRanges(const char * ptr, int * error);	//Парсинг HTTP Range
 void			requestHttpRangesPrint(request_range_s * ranges);	//Вывод на экран структуры request_range_s
-result_e		requestParseMultipartForm(connection_s * con);	//Функция обрабатывает POST запрос multipart/form-data
 result_e		requestParseUrlEncodedForm(connection_s * con);	//Функция обрабатывает POST запрос application/x-www-form-urlencoded
 const char *	requestMethodString(request_method_e method);	//Функция возвращает текстовое описание метода запроса
 const char *	requestGetHeader(connection_s * con, const char * header);	//Функция возвращает значение заголовка
+const char *	requestGetKnownHeader(connection_s * con, header_index_e index, uint32_t * olen);	//Функция возвращает значение известного заголовка из таблицы headers_known
+kv_s *			requestGetHeaders(connection_s * con);	//Функция возвращает заголовки запроса в виде KV (создаются при первом обращении)
 const char *	requestGetGPC(connection_s * con, const char * name, const char * rv, uint32_t * olen);	//Получение значения переменной из массива GET POST или COOKIE, в зависимости от фильтра rv (по-умолчанию rv = "gpc")
 post_file_s *	requestGetFile(connection_s * con, const char * name);	//Возвращает структуру, содержащую загруженный методом POST файл
+const char *	requestGetQueryRaw(connection_s * con, const char * name, uint32_t * olen);	//Возвращает значение GET параметра без разбора query string и декодирования
+const char *	requestGetCookieRaw(connection_s * con, const char * name, uint32_t * olen);	//Возвращает значение Cookie без разбора заголовка Cookie и декодирования
 static_file_s *	requestStaticFileInfo(connection_s * con);	//Пытается найти локально запрошенный файл, и если файл найден - возвращает информацию о нем
 void			requestStaticFileFree(static_file_s * f);	//Освобождает память, занятую структурой статичного файла
 
 
 
 
+/***********************************************************************
+ * Функции: core/multipart.c - Потоковый разбор тела multipart/form-data
+ **********************************************************************/
+
+result_e		multipartInit(connection_s * con);				//Создание структуры разбора тела multipart/form-data по границе из заголовков запроса
+int				multipartParse(connection_s * con, const char * data, uint32_t len, bool last);	//Разбор очередной порции тела, возвращает количество обработанных байт или -1
+void			multipartFree(multipart_parser_s * mp);			//Освобождение структуры разбора тела multipart/form-data
+void			multipartFileFree(void * ptr);					//Освобождение структуры post_file_s и удаление временного файла
+
+
+
 /***********************************************************************
  * Функции: core/response.c - Функции обработки HTTP ответа
  **********************************************************************/
@@ -898,6 +1299,7 @@ response_s * 	responseClear(response_s * response);		//Очистка струк
 const char *	responseCodeCode(int http_code);			//Функция возвращает текстовое представление кода HTTP ответа, согласно номеру ответа
 const char *	responseCodeString(int http_code);			//Функция возвращает текстовое описание кода HTTP ответа, согласно номеру ответа
 const char *	responseHTTPVersionString(http_version_e v);//Функция возвращает текстовое описание HTTP версии используемого протокола
+const char *	responseConnectionString(connection_s * con);	//Функция возвращает значение заголовка Connection для ответа сервера
 void			responseHttpLocation(connection_s * con, const char * location, bool temporarily);	//Перенаправление
 void			responseHttpError(connection_s * con);		//Подготовка ответа ошибки сервера
 bool			responseSetCookie(response_s * response, const char * key_name, const char * value);	//Добавляет Cookie в ответ сервера
@@ -919,8 +1321,16 @@ result_e		responseStaticFile(connection_s * con, static_file_s * sf);	//Подг
 //Callback функция для обработки запроса по маршруту
 typedef result_e (*route_cb)(connection_s *);
 
-bool				routeAdd(const char * path, route_cb v_function);	//Добавляет функцию-обработчик запроса для обработки определенного маршрута
-route_cb			routeGet(const char * path);	//Ищет функцию-обработчик запроса для обработки определенного маршрута
+//Структура маршрута
+typedef struct type_route_s{
+	route_cb		handler;		//Функция-обработчик запроса
+	job_class_e		job_class;		//Класс заданий обработчика (приоритет в очередях рабочих потоков)
+	uint32_t		budget_ms;		//Время (от начала запроса), после которого ожидающий в очереди запрос не обрабатывается, 0 - равно max_request_time
+} route_s;
+
+bool				routeAdd(const char * path, route_cb v_function, job_class_e job_class);	//Добавляет функцию-обработчик запроса для обработки определенного маршрута
+route_s *			routeGet(const char * path);	//Ищет маршрут (функцию-обработчик запроса и класс ее заданий)
+bool				routeSetBudget(const char * path, uint32_t budget_ms);	//Задает время, после которого ожидающий в очереди запрос маршрута не обрабатывается
 
 
 
@@ -993,6 +1403,7 @@ void			jobinternalAdd(jobinternal_e type, void * data, free_cb cb);		//Доба
 jobinternal_s *	jobinternalGet(void);	//Возвращает первое на очереди задание, одновременно удаляя его из списка заданий
 inline void		jobinternalWakeup(void);	//Посылает сигнал для "пробуждения" потока, т.к. появилось задание
 void			jobinternalThreadFree(void);	//Завершение рабочего потока сервера
+void			jobinternalThreadAffinity(void);	//Закрепление потока внутренних заданий за процессорами
 
 
 #ifdef __cplusplus
@@ -20,6 +20,27 @@ static DH * dh2048	= NULL;
 static pthread_mutex_t * mutex_array = NULL;
 
 
+//Количество хранимых ключей шифрования session tickets: текущий ключ и предыдущие, которыми еще можно расшифровать ticket
+#define SSL_TICKET_KEYS 2
+
+//Ключ шифрования TLS session tickets
+typedef struct{
+	unsigned char	name[16];		//Имя ключа, передается клиенту в составе ticket
+	unsigned char	aes_key[32];	//Ключ шифрования AES-256
+	unsigned char	hmac_key[32];	//Ключ HMAC-SHA256
+	time_t			created_ts;		//Время создания ключа
+} ssl_ticket_key_s;
+
+//Ключи шифрования session tickets (хранятся только в памяти), [0] - текущий ключ
+static ssl_ticket_key_s ticket_keys[SSL_TICKET_KEYS];
+
+//Время использования ключа шифрования session tickets до его замены (в секундах)
+static time_t ticket_key_lifetime = 0;
+
+//Мьютекс синхронизации в момент обращения к ключам session tickets
+static pthread_mutex_t ticket_keys_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
 /***********************************************************************
  * Callback функции
  **********************************************************************/ 
@@ -83,6 +104,114 @@ sslDHCallback(SSL *ssl, int is_export, int keylength){
 
 
 
+/*
+ * Заменяет текущий ключ шифрования session tickets новым, если срок его использования истек
+ * Предыдущий ключ сохраняется для расшифровки ранее выданных tickets
+ * Вызывается под блокировкой ticket_keys_mutex
+ */
+static bool
+sslTicketKeysRotate(time_t now){
+	if(ticket_keys[0].created_ts > 0 && now - ticket_keys[0].created_ts < ticket_key_lifetime) return true;
+	ssl_ticket_key_s key;
+	if(	RAND_bytes(key.name, sizeof(key.name)) != 1 ||
+		RAND_bytes(key.aes_key, sizeof(key.aes_key)) != 1 ||
+		RAND_bytes(key.hmac_key, sizeof(key.hmac_key)) != 1
+	) return (ticket_keys[0].created_ts > 0);
+	key.created_ts = now;
+	memmove(&ticket_keys[1], &ticket_keys[0], (SSL_TICKET_KEYS - 1) * sizeof(ssl_ticket_key_s));
+	memcpy(&ticket_keys[0], &key, sizeof(ssl_ticket_key_s));
+	return true;
+}//END: sslTicketKeysRotate
+
+
+
+/*
+ * Выбор ключа шифрования TLS session tickets и инициализация шифрования AES-256-CBC
+ * enc = 1 - выдача нового ticket: выбирается текущий ключ
+ * enc = 0 - расшифровка ticket, полученного от клиента: ключ ищется по имени
+ * Возвращает: 1 - успешно, 2 - ticket расшифрован устаревшим ключом (клиенту будет выдан новый ticket),
+ * 0 - ключ не найден (полное рукопожатие), -1 - ошибка
+ */
+static int
+sslTicketKeySelect(unsigned char * key_name, unsigned char * iv, EVP_CIPHER_CTX * ectx, int enc, ssl_ticket_key_s * key){
+	int i, result = 1;
+
+	pthread_mutex_lock(&ticket_keys_mutex);
+	if(enc){
+		if(!sslTicketKeysRotate(time(NULL))){
+			pthread_mutex_unlock(&ticket_keys_mutex);
+			return -1;
+		}
+		memcpy(key, &ticket_keys[0], sizeof(ssl_ticket_key_s));
+	}else{
+		for(i = 0; i < SSL_TICKET_KEYS; i++){
+			if(ticket_keys[i].created_ts > 0 && memcmp(key_name, ticket_keys[i].name, sizeof(key->name)) == 0) break;
+		}
+		if(i == SSL_TICKET_KEYS){
+			pthread_mutex_unlock(&ticket_keys_mutex);
+			return 0;
+		}
+		memcpy(key, &ticket_keys[i], sizeof(ssl_ticket_key_s));
+		if(i > 0) result = 2;
+	}
+	pthread_mutex_unlock(&ticket_keys_mutex);
+
+	if(enc){
+		if(RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1) return -1;
+		memcpy(key_name, key->name, sizeof(key->name));
+		if(EVP_EncryptInit_ex(ectx, EVP_aes_256_cbc(), NULL, key->aes_key, iv) != 1) return -1;
+	}else{
+		if(EVP_DecryptInit_ex(ectx, EVP_aes_256_cbc(), NULL, key->aes_key, iv) != 1) return -1;
+	}
+
+	return result;
+}//END: sslTicketKeySelect
+
+
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+
+/*
+ * Callback функция шифрования / расшифровки TLS session tickets (OpenSSL 3.0+, HMAC-SHA256 через EVP_MAC)
+ * Возвращаемые значения - см. sslTicketKeySelect()
+ */
+static int
+sslTicketKeyCallback(SSL * ssl, unsigned char * key_name, unsigned char * iv, EVP_CIPHER_CTX * ectx, EVP_MAC_CTX * hctx, int enc){
+	ssl_ticket_key_s key;
+	OSSL_PARAM params[3];
+	int result;
+
+	if((result = sslTicketKeySelect(key_name, iv, ectx, enc, &key)) <= 0) return result;
+
+	params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmac_key, sizeof(key.hmac_key));
+	params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "SHA256", 0);
+	params[2] = OSSL_PARAM_construct_end();
+	if(EVP_MAC_CTX_set_params(hctx, params) != 1) return -1;
+
+	return result;
+}//END: sslTicketKeyCallback
+
+#else
+
+/*
+ * Callback функция шифрования / расшифровки TLS session tickets (OpenSSL до 3.0, HMAC_CTX)
+ * Возвращаемые значения - см. sslTicketKeySelect()
+ */
+static int
+sslTicketKeyCallback(SSL * ssl, unsigned char * key_name, unsigned char * iv, EVP_CIPHER_CTX * ectx, HMAC_CTX * hctx, int enc){
+	ssl_ticket_key_s key;
+	int result;
+
+	if((result = sslTicketKeySelect(key_name, iv, ectx, enc, &key)) <= 0) return result;
+	if(HMAC_Init_ex(hctx, key.hmac_key, sizeof(key.hmac_key), EVP_sha256(), NULL) != 1) return -1;
+
+	return result;
+}//END: sslTicketKeyCallback
+
+#endif
+
+
+
 /*
  * Callback функция получения ID потока
  */
@@ -224,9 +353,43 @@ sslCtxInit(server_s * srv){
 	SSL_CTX_set_tmp_dh_callback(ctx, sslDHCallback);
 
 	//Установка кеша сессий
-	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+	//Контекст один на все реакторы, поэтому сессия, созданная на одном прослушиваемом сокете, возобновляется на любом другом
+	SSL_CTX_set_session_id_context(ctx, (const unsigned char *)"xgserver", 8);
+	if(srv->config.ssl_session_cache_size > 0){
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+		SSL_CTX_sess_set_cache_size(ctx, srv->config.ssl_session_cache_size);
+	}else{
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+	}
+	SSL_CTX_set_timeout(ctx, srv->config.ssl_session_timeout);
+
+	//Session tickets: состояние сессии хранится у клиента, зашифрованное периодически заменяемым ключом сервера
+	if(srv->config.ssl_ticket_key_lifetime > 0){
+		ticket_key_lifetime = srv->config.ssl_ticket_key_lifetime;
+		pthread_mutex_lock(&ticket_keys_mutex);
+			if(!sslTicketKeysRotate(time(NULL))) FATAL_ERROR("Session ticket key generation fail");
+		pthread_mutex_unlock(&ticket_keys_mutex);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+		SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, sslTicketKeyCallback);
+#else
+		SSL_CTX_set_tlsext_ticket_key_cb(ctx, sslTicketKeyCallback);
+#endif
+	}else{
+		SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+	}
+
+	//Kernel TLS: после рукопожатия симметричное шифрование передается ядру
+	if(srv->config.ssl_ktls){
+#ifdef XG_SSL_KTLS
+		SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#else
+		ERROR_MSG("[/webserver/ssl_ktls] is not supported by OpenSSL library, kTLS disabled");
+		srv->config.ssl_ktls = false;
+#endif
+	}
 
-	SSL_CTX_set_default_read_ahead(ctx, 1);
+	//Опережающее чтение не позволяет передать ядру прием данных (kTLS), поскольку часть записей уже прочитана OpenSSL
+	if(!srv->config.ssl_ktls) SSL_CTX_set_default_read_ahead(ctx, 1);
 
 	//Позволяет при повторном вызове SSL_write передать буфер с тем же содержимым, расположенный в другом месте памяти
 	SSL_CTX_set_mode(ctx, SSL_CTX_get_mode(ctx) | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
@@ -369,6 +532,21 @@ sslDoHandshake(SSL * ssl){
 
 
 
+/*
+ * Проверяет, выполняется ли шифрование отправляемых данных ядром (kTLS)
+ * Результат имеет смысл только после завершения рукопожатия
+ */
+bool
+sslKtlsSendEnabled(SSL * ssl){
+#ifdef XG_SSL_KTLS
+	return (ssl && BIO_get_ktls_send(SSL_get_wbio(ssl)) ? true : false);
+#else
+	return false;
+#endif
+}//END: sslKtlsSendEnabled
+
+
+
 
 /*
  * Чтение данных из SSL
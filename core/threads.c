@@ -30,51 +30,131 @@ static void thr_mysql_instance_once_creator(void){
  * Работа с пулом потоков
  **********************************************************************/
 
+/*
+ * Вызывается с захваченной блокировкой pool->mutex
+ * Посылает сигнал первому найденному спящему потоку
+ */
+static void
+_threadSignalSleeper(thread_pool_s * pool){
+	size_t slots = pool->threads_slots;
+	size_t i;
+	for(i = 0; i < slots; i++){
+		if(pool->threads[i] && !pool->threads[i]->exited && pool->threads[i]->sleeping){
+			pthread_cond_signal(&pool->threads[i]->condition);
+			return;
+		}
+	}
+}//END: _threadSignalSleeper
+
+
+
+/*
+ * Вызывается с захваченной блокировкой pool->mutex
+ * Возвращает true, если поток может быть завершен при простое:
+ * поток является последним из активных потоков и потоков больше минимального количества
+ */
+static inline bool
+_threadRetirable(thread_pool_s * pool, thread_s * thread){
+	return (pool->threads_count > pool->threads_min && thread->index + 1 == pool->threads_count);
+}//END: _threadRetirable
+
+
+
 /*
  * Создание пула потоков
+ * count - количество потоков при старте, пул изменяется в пределах от worker_threads_min до worker_threads_max
  */
 result_e
 threadPoolCreate(server_s * srv, size_t count){
 
 	if(!count) count = server_worker_threads;
-	count = min(32, server_worker_threads);
+	count = min(count, (size_t)server_max_workers);
+
+	size_t threads_min = (srv && srv->config.worker_threads_min > 0 ? (size_t)srv->config.worker_threads_min : count);
+	size_t threads_max = (srv && srv->config.worker_threads_max > 0 ? (size_t)srv->config.worker_threads_max : count);
+	threads_min = min(threads_min, count);
+	threads_max = max(threads_max, count);
 
 	thread_pool_s * pool 	= (thread_pool_s *)mNewZ(sizeof(thread_pool_s));
-	pool->threads 			= mNewZ(count * sizeof(thread_s *));
-	pool->threads_count 	= count;
-	pool->threads_idle		= count;
+	pool->threads 			= mNewZ(threads_max * sizeof(thread_s *));
+	pool->threads_min		= threads_min;
+	pool->threads_max		= threads_max;
 	if(srv) srv->workers	= pool;
 	pool->server 			= srv;
 
-	if(pthread_cond_init(&(pool->condition), NULL) != 0) RETURN_ERROR(RESULT_ERROR,"pthread_cond_init fail");
 	if(pthread_mutex_init(&(pool->mutex), NULL) != 0) RETURN_ERROR(false,"pthread_mutex_init fail");
 
 	size_t i;
 	for(i=0; i < count; i++){
-		if((pool->threads[i] = threadCreate(pool)) == NULL) RETURN_ERROR(RESULT_ERROR, "threadToPool fail");
-		pool->threads[i]->index = i;
+		if(threadCreate(pool, i) == NULL) RETURN_ERROR(RESULT_ERROR, "threadToPool fail");
+		__atomic_store_n(&pool->threads_count, i + 1, __ATOMIC_RELEASE);
 	}
 
+	DEBUG_MSG("Worker threads: %zu (min %zu, max %zu)", count, threads_min, threads_max);
+
 	return RESULT_OK;
 }//END: threadPoolCreate
 
 
 
+/*
+ * Увеличение пула потоков, если все потоки заняты, а задания накапливаются в очередях или ожидают обработки слишком долго
+ * Функция вызывается только реактором 0
+ */
+void
+threadPoolAdjust(thread_pool_s * pool, uint64_t now_ms){
+	if(!pool || pool->threads_max <= pool->threads_min) return;
+	if(now_ms < pool->adjust_ms + worker_pool_adjust_interval) return;
+	pool->adjust_ms = now_ms;
+
+	uint64_t wait_ms	= __atomic_exchange_n(&pool->wait_max_ms, 0, __ATOMIC_RELAXED);
+	size_t count		= __atomic_load_n(&pool->threads_count, __ATOMIC_ACQUIRE);
+	size_t queued		= 0;
+	size_t add, i;
+
+	//Пул потоков достиг максимального размера или есть простаивающие потоки
+	if(count >= pool->threads_max || __atomic_load_n(&pool->threads_idle, __ATOMIC_SEQ_CST) > 0) return;
+
+	for(i = 0; i < count; i++) queued += jobQueued(pool->threads[i]);
+	if(queued < count * worker_grow_queue_depth && wait_ms < (uint64_t)pool->server->config.worker_grow_wait) return;
+
+	//Нагрузка растет скачкообразно, поэтому за одну проверку пул увеличивается на четверть (но не менее чем на один поток)
+	add = min(pool->threads_max - count, max((size_t)1, count / 4));
+
+	pthread_mutex_lock(&pool->mutex);
+		for(i = 0; i < add; i++){
+			count = pool->threads_count;
+			//Поток, ранее занимавший позицию, еще не завершился
+			if(pool->threads[count] && !pool->threads[count]->exited) break;
+			if(threadCreate(pool, count) == NULL) break;
+			__atomic_store_n(&pool->threads_count, count + 1, __ATOMIC_RELEASE);
+		}
+		count = pool->threads_count;
+	pthread_mutex_unlock(&pool->mutex);
+
+	//i - количество созданных потоков
+	if(i > 0) DEBUG_MSG("Worker pool grown to %zu threads (queued: %zu, max wait: %" PRIu64 " ms)", count, queued, wait_ms);
+}//END: threadPoolAdjust
+
+
+
 /*
  * Завершение пула потоков
  */
 result_e
 threadPoolFree(thread_pool_s * pool){
 	size_t i;
+	int c;
 
 	DEBUG_MSG("Pool free: setting thread destroy flags...");
 
 	//Установка флагов завершения потоков
 	pthread_mutex_lock(&pool->mutex);
-		for(i=0; i < pool->threads_count; i++){
-			if(pool->threads[i]) pool->threads[i]->destroy = true;
+		for(i=0; i < pool->threads_slots; i++){
+			if(!pool->threads[i] || pool->threads[i]->exited) continue;
+			pool->threads[i]->destroy = true;
+			pthread_cond_signal(&pool->threads[i]->condition);
 		}
-		pthread_cond_broadcast(&pool->condition);
 	pthread_mutex_unlock(&pool->mutex);
 
 	DEBUG_MSG("Pool free: waiting destroying threads...");
@@ -85,7 +165,7 @@ threadPoolFree(thread_pool_s * pool){
 	//Ожидание завершения всех потоков
 	while(!all_threads_destroyed){
 		pthread_mutex_lock(&pool->mutex);
-		all_threads_destroyed = (pool->threads_count > 0 ? false : true);
+		all_threads_destroyed = (pool->threads_running > 0 ? false : true);
 		pthread_mutex_unlock(&pool->mutex);
 		sleepMilliseconds(1);
 		//Даем 5 секунд на завершение работы всех потоков 
@@ -96,16 +176,21 @@ threadPoolFree(thread_pool_s * pool){
 	//Если не все потоки были завершены (выход по таймауту) - принудительно заверршаем
 	if(!all_threads_destroyed){
 		pthread_mutex_lock(&pool->mutex);
-		for(i=0; i < pool->threads_count; i++){
-			if(pool->threads[i] && !pthread_cancel(pool->threads[i]->thread_id)){
-				mFree(pool->threads[i]);
-			}
+		for(i=0; i < pool->threads_slots; i++){
+			if(pool->threads[i] && !pool->threads[i]->exited) pthread_cancel(pool->threads[i]->thread_id);
 		}
 		pthread_mutex_unlock(&pool->mutex);
 	}
 
+	//Структуры потоков и их очереди заданий освобождаются пулом: другие потоки могли обращаться к ним до своего завершения
+	for(i=0; i < pool->threads_slots; i++){
+		if(!pool->threads[i]) continue;
+		for(c = 0; c < JOB_CLASSES; c++) joblistFree(pool->threads[i]->queues[c]);
+		pthread_cond_destroy(&pool->threads[i]->condition);
+		mFree(pool->threads[i]);
+	}
+
 	mFree(pool->threads);
-	pthread_cond_destroy(&pool->condition);
 	pthread_mutex_destroy(&pool->mutex);
 	if(pool->server)pool->server->workers = NULL;
 	mFree(pool);
@@ -117,12 +202,14 @@ threadPoolFree(thread_pool_s * pool){
 
 
 /*
- * Создание нового потока
+ * Создание нового потока в позиции index пула потоков
+ * Если позиция уже использовалась завершившимся потоком - структура потока и его очередь заданий используются повторно
  */
 thread_s * 
-threadCreate(thread_pool_s * pool){
+threadCreate(thread_pool_s * pool, size_t index){
 
 	pthread_attr_t	attr;
+	int c;
 
 	//Инициализация аттрибутов потока
 	if(pthread_attr_init(&attr) != 0) RETURN_ERROR(NULL, "pthread_attr_init error");
@@ -140,12 +227,44 @@ threadCreate(thread_pool_s * pool){
 		RETURN_ERROR(false, "pthread set stack size error");
 	}
 
-	thread_s * thread = (thread_s *)mNewZ(sizeof(thread_s));
-	thread->pool = pool;
+	server_s * srv = pool->server;
+	thread_s * thread = pool->threads[index];
+
+	if(thread){
+		thread->con			= NULL;
+		thread->sleeping	= 0;
+		thread->destroy		= false;
+		thread->exited		= false;
+	}else{
+		thread = (thread_s *)mNewZ(sizeof(thread_s));
+		thread->pool	= pool;
+		thread->index	= index;
+
+		if(pthread_cond_init(&(thread->condition), NULL) != 0){
+			pthread_attr_destroy(&attr); mFree(thread);
+			RETURN_ERROR(NULL, "pthread_cond_init fail");
+		}
+
+		//Очереди заданий потока создаются небольшими, пропорционально весам классов, и увеличиваются при заполнении
+		for(c = 0; c < JOB_CLASSES; c++){
+			thread->queues[c] = joblistCreate(srv, server_joblist_initial_size * (size_t)job_class_weights[c] / (size_t)job_class_weights[0]);
+		}
+
+		//Поток доступен другим потокам и основному потоку до начала своей работы
+		__atomic_store_n(&pool->threads[index], thread, __ATOMIC_RELEASE);
+		if(index >= pool->threads_slots) __atomic_store_n(&pool->threads_slots, index + 1, __ATOMIC_RELEASE);
+	}
+
+	__atomic_add_fetch(&pool->threads_running, 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&pool->threads_idle, 1, __ATOMIC_SEQ_CST);
 
 	//Создание потока с точкой старта в функции threadMain
 	if (pthread_create(&(thread->thread_id), &attr, (void*)threadPoolMain, (void*)thread) != 0){
-		pthread_attr_destroy(&attr); mFree(thread);
+		pthread_attr_destroy(&attr);
+		//Позиция остается в пуле как позиция завершившегося потока
+		__atomic_store_n(&thread->exited, true, __ATOMIC_SEQ_CST);
+		__atomic_sub_fetch(&pool->threads_running, 1, __ATOMIC_SEQ_CST);
+		__atomic_sub_fetch(&pool->threads_idle, 1, __ATOMIC_SEQ_CST);
 		RETURN_ERROR(NULL, "pthread create error");
 	}
 
@@ -165,11 +284,17 @@ threadPoolMain(thread_s * thread){
 
 	thread_pool_s * pool	= thread->pool;		//Указатель на пул потоков
 	server_s * srv			= pool->server;		//Указатель на сервер
-	joblist_s * joblist		= srv->joblist;		//Указатель на список работ
 	connection_s * con		= NULL;
+	reactor_s * reactor		= NULL;
+	uint32_t spin;
+	bool retire				= false;
+	struct timespec idle_ts;
 
 	DEBUG_MSG("Thread ID:%d [%d] created on server [%s]...", (int)thread->thread_id, (int)pthread_self(), srv->config.host);
 
+	//Привязка к процессорам до создания соединений с MySQL, чтобы буферы потока выделялись в локальной памяти
+	affinityApply(AFFINITY_WORKER, thread->index, pthread_self());
+
 	//Экземпляры соединения с MySQL
 	mysql_thread_init();
 	mysql_s * mysql_instances = mysqlCreateAllInstances();
@@ -184,17 +309,48 @@ threadPoolMain(thread_s * thread){
 
 		//Если у потока нет работы - ожидаем
 		if (thread->con == NULL){
-			con = jobGet(joblist);
-			pthread_mutex_lock(&pool->mutex);
-			if(!con){
-				//Ожидаем pthread_cond_signal
-				if(pthread_cond_wait(&pool->condition, &pool->mutex) != 0){
-					con = NULL;
-				} else {
-					con = jobGet(joblist);
+			con = jobGet(thread);
+
+			//Перед засыпанием поток несколько раз проверяет свою очередь и очереди других потоков,
+			//в это время он не учитывается в threads_sleeping и сигнал ему не посылается
+			for(spin = 0; !con && spin < worker_spin_iterations && !thread->destroy; spin++){
+				sched_yield();
+				if(jobAvailable(thread)) con = jobGet(thread);
+			}
+
+			if(!con && !thread->destroy){
+				pthread_mutex_lock(&pool->mutex);
+				__atomic_store_n(&thread->sleeping, 1, __ATOMIC_SEQ_CST);
+				__atomic_add_fetch(&pool->threads_sleeping, 1, __ATOMIC_SEQ_CST);
+				//Повторная проверка после установки признака sleeping: задание могло быть добавлено,
+				//когда threadWakeup() еще не видел спящих потоков
+				if((con = jobGet(thread)) == NULL && !thread->destroy){
+					//Последний из активных потоков сверх минимального количества ожидает заданий не дольше worker_idle_timeout
+					if(_threadRetirable(pool, thread)){
+						clock_gettime(CLOCK_REALTIME, &idle_ts);
+						idle_ts.tv_sec += srv->config.worker_idle_timeout;
+						if(
+							pthread_cond_timedwait(&thread->condition, &pool->mutex, &idle_ts) == ETIMEDOUT &&
+							_threadRetirable(pool, thread) &&
+							!jobAvailable(thread)
+						){
+							//Поток больше не получает новых заданий, следующим по простою завершается предыдущий поток:
+							//будим его, чтобы он перешел к ожиданию с ограничением по времени
+							__atomic_store_n(&pool->threads_count, thread->index, __ATOMIC_RELEASE);
+							pthread_cond_signal(&pool->threads[thread->index - 1]->condition);
+							retire = true;
+						}
+					}else{
+						//Ожидаем pthread_cond_signal
+						pthread_cond_wait(&thread->condition, &pool->mutex);
+					}
 				}
+				__atomic_sub_fetch(&pool->threads_sleeping, 1, __ATOMIC_SEQ_CST);
+				__atomic_store_n(&thread->sleeping, 0, __ATOMIC_SEQ_CST);
+				pthread_mutex_unlock(&pool->mutex);
+				if(retire) break;
+				if(!con) con = jobGet(thread);
 			}
-			pthread_mutex_unlock(&pool->mutex);
 		}
 		//У потока есть задание - выполняем
 		else{
@@ -207,25 +363,25 @@ threadPoolMain(thread_s * thread){
 		//Есть соединение для обработки
 		if(con != NULL){
 
-			pthread_mutex_lock(&pool->mutex);
-			pool->threads_idle--;
-			pthread_mutex_unlock(&pool->mutex);
+			__atomic_sub_fetch(&pool->threads_idle, 1, __ATOMIC_SEQ_CST);
+
+			if(con->stage > CON_STAGE_NONE && con->stage < CON_STAGE_COMPLETE && threadConnectionEngine(con) == RESULT_AGAIN){
+				//Соединение возвращено в очередь заданий класса своего маршрута (jobRequeue)
+				__atomic_add_fetch(&pool->threads_idle, 1, __ATOMIC_SEQ_CST);
+				continue;
+			}
 
-			if(con->stage > CON_STAGE_NONE && con->stage < CON_STAGE_COMPLETE) threadConnectionEngine(con);
 
+			//Реактор, которому принадлежит соединение
+			reactor = con->reactor;
 
 			//Задание выполнено
-			//Добавление соединения в список обработки основного потока
+			//Добавление соединения в список обработки потока реактора
 			jobmainAdd(con);
 
-			//Генерируем сигнал SIGPOLL, чтобы прервать poll операцию в
-			//основном потоке
-			pthread_mutex_lock(&pool->mutex);
-
-				pool->threads_idle++;
-				write(srv->pipe[1], "", 1);
-
-			pthread_mutex_unlock(&pool->mutex);
+			//Прерываем poll операцию в потоке реактора
+			__atomic_add_fetch(&pool->threads_idle, 1, __ATOMIC_SEQ_CST);
+			reactorWakeup(reactor);
 
 
 			//DEBUG_MSG("Thread ID:%d sleeping..., threads_idle=%u", (int)thread->thread_id, (uint32_t)pool->threads_idle);
@@ -233,18 +389,19 @@ threadPoolMain(thread_s * thread){
 
 	}while(thread->destroy == false);
 
-	//Завершение работы потока и
-	//удаление потока из пула потоков
+	DEBUG_MSG("Thread ID:%d [%d] %s...", (int)thread->thread_id, (int)pthread_self(), (retire ? "retired after idle timeout" : "stopped"));
+
+	//Завершение работы потока: структура потока остается в пуле потоков и может быть использована
+	//новым потоком, память освобождается в threadPoolFree()
 	pthread_mutex_lock(&pool->mutex);
-		pool->threads_count--;
-		if(pool->threads[pool->threads_count] != pool->threads[thread->index]) pool->threads[thread->index] = pool->threads[pool->threads_count];
-		pool->threads[pool->threads_count] = NULL;
+		__atomic_store_n(&thread->exited, true, __ATOMIC_SEQ_CST);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		//Задания, добавленные в очередь потока перед его завершением, забирают другие потоки
+		if(jobQueued(thread) > 0) _threadSignalSleeper(pool);
+		__atomic_sub_fetch(&pool->threads_idle, 1, __ATOMIC_SEQ_CST);
+		pool->threads_running--;
 	pthread_mutex_unlock(&pool->mutex);
 
-
-	DEBUG_MSG("Thread ID:%d [%d] stopped...", (int)thread->thread_id, (int)pthread_self());
-
-	mFree(thread);
 	mysqlFreeAllInstances(mysql_instances);
 	mysql_thread_end();
 	pthread_exit(NULL);
@@ -253,15 +410,34 @@ threadPoolMain(thread_s * thread){
 
 
 /*
- * Посылает сигнал для "пробуждения" потока, т.к. появилось задание
+ * Посылает сигнал для "пробуждения" потока, т.к. в его очереди появилось задание
+ * Если поток занят, а в его очереди накопились задания - будит любой спящий поток, чтобы тот забрал задания
  */
-inline void
-threadWakeup(thread_pool_s * pool){
-	if(!pool) return;
+void
+threadWakeup(thread_pool_s * pool, thread_s * thread){
+	if(!pool || !thread) return;
+
+	//Барьер упорядочивает добавление задания в очередь и чтение признаков спящих потоков
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	//Поток ожидает на condition - будим его (если поток успел завершиться - будим любой спящий поток)
+	if(__atomic_load_n(&thread->sleeping, __ATOMIC_SEQ_CST)){
+		pthread_mutex_lock(&pool->mutex);
+			if(thread->exited){
+				_threadSignalSleeper(pool);
+			}else{
+				pthread_cond_signal(&thread->condition);
+			}
+		pthread_mutex_unlock(&pool->mutex);
+		return;
+	}
+
+	//Все потоки заняты или проверяют очереди без сна, либо поток сам справится со своей очередью - сигнал не нужен
+	if(__atomic_load_n(&pool->threads_sleeping, __ATOMIC_SEQ_CST) == 0) return;
+	if(jobQueued(thread) < worker_steal_backlog && !__atomic_load_n(&thread->exited, __ATOMIC_SEQ_CST)) return;
+
 	pthread_mutex_lock(&pool->mutex);
-		if (pthread_cond_signal(&pool->condition) == 0){
-			//pool->threads_idle--;
-		}
+		_threadSignalSleeper(pool);
 	pthread_mutex_unlock(&pool->mutex);
 }//END: threadWakeup
 
@@ -275,22 +451,53 @@ threadWakeup(thread_pool_s * pool){
 result_e
 threadConnectionEngine(connection_s * con){
 
-	register server_s * srv = con->server;
 	result_e result;
+	char session_id[SESSION_ID_LEN + 1];
+	const char * session_ptr;
+	uint32_t len;
 
 	while(1){
 		switch(con->stage){
 
+			//SSL рукопожатие
+			case CON_STAGE_HANDSTAKE:
+				switch(sslDoHandshake(con->ssl)){
+					case RESULT_ERROR:
+						con->connection_error = CON_ERROR_HANDSTAKE_SOCKET;
+						THR_STAGE_RETURN(CON_STAGE_SOCKET_ERROR, RESULT_OK);
+					break;
+					case RESULT_OK:
+						THR_STAGE_RETURN(CON_STAGE_CONNECTED, RESULT_OK);
+					break;
+					//Требуется дождаться готовности сокета, реактор подпишется на нужное событие
+					case RESULT_AGAIN:
+					default:
+						con->handshake_wait = true;
+						return RESULT_OK;
+					break;
+				}
+			break;
+
+
 			//Получение данных от клиента
 			case CON_STAGE_READ:
 
-				do{
+				result = RESULT_OK;
+
+				//Буфер уже содержит начало запроса, полученное вместе с предыдущим запросом (HTTP pipelining),
+				//разбираем его без чтения из сокета
+				if(con->request.parser.pipelined){
+					con->request.parser.pipelined = false;
+					result = connectionPrepareRequest(con);
+				}
+
+				while(result == RESULT_OK){
 					if(con->ssl){
 						result = connectionHandleReadSSL(con);
 					}else{
 						result = connectionHandleRead(con);
 					}
-				}while(result == RESULT_OK);
+				}
 
 				switch(result){
 					//Ошибка сокета
@@ -306,11 +513,16 @@ threadConnectionEngine(connection_s * con){
 					//Выполнено упешно
 					case RESULT_COMPLETE:
 						connectionSetStage(con, CON_STAGE_WORKING);
+						//Обработчик маршрута выполняется в порядке приоритета своего класса заданий,
+						//если в очередях потока ожидают другие задания
+						con->route = routeGet(con->request.uri.path.ptr);
+						if(jobRequeue(con)) return RESULT_AGAIN;
 					break;
-					//Повторить и прочее
+					//Повторить и прочее: данные сокета прочитаны, реактор подпишется на чтение
 					case RESULT_AGAIN:
 					default:
-						con->read_idle_ts = srv->current_ts;
+						con->read_idle_ts = con->reactor->current_ts;
+						con->read_wait = true;
 						return RESULT_OK;
 					break;
 				}
@@ -336,34 +548,20 @@ threadConnectionEngine(connection_s * con){
 				if(!con->response.headers) con->response.headers = kvNewRoot();
 				if(!con->response.cookie) con->response.cookie = kvNewRoot();
 
-				//Получение GET параметров запроса из URI query string
-				if(con->request.uri.query.ptr && con->request.uri.query.len > 0){
-					con->request.get = kvFromQueryString(con->request.uri.query.ptr);
-				}
-
-				//Если POST запрос - обработка
-				if(con->request.request_method == HTTP_POST){
-					//multipart/form-data
-					if(con->request.post_method == POST_MULTIPART){
-						requestParseMultipartForm(con);
-					}
-					//application/x-www-form-urlencoded
-					else{
-						requestParseUrlEncodedForm(con);
-					}
-				}//Обработка POST запроса
+				//GET, POST и Cookie параметры разбираются при первом обращении (requestGetGPC, requestGetFile)
 
-				//Проверка, является ли запрос AJAX запросом
-				if(!con->request.is_ajax){
-					const char * ajax = requestGetGPC(con, "ajax", "gp", NULL);
-					if(ajax && (stringCompare(ajax,"1")||stringCompareCase(ajax,"true")||stringCompareCase(ajax,"on"))) con->request.is_ajax = true;
-				}
-
-				route_cb f = routeGet(con->request.uri.path.ptr);
+				route_cb f = (con->route ? con->route->handler : NULL);
 
 				//Если найден обработчик маршрута URI
 				if(f){
 
+					//Проверка, является ли запрос AJAX запросом: заголовок X-Requested-With (см. requestHeadersToVariables)
+					//или параметр ajax в query string, GET и POST параметры при этом не разбираются
+					if(!con->request.is_ajax){
+						const char * ajax = requestGetQueryRaw(con, "ajax", &len);
+						if(ajax && ((len == 1 && ajax[0] == '1') || (len == 4 && stringCompareCaseN(ajax,"true",4)) || (len == 2 && stringCompareCaseN(ajax,"on",2)))) con->request.is_ajax = true;
+					}
+
 					//Если запрос является AJAX запросом,
 					//то контент генерируется "на лету", поэтому добавляем заголовки,
 					//запрещающие кэширование ответа сервера
@@ -375,10 +573,18 @@ threadConnectionEngine(connection_s * con){
 						con->ajax = ajaxNew(con);
 					}
 
-					//Старт сессии
-					con->session = sessionStart(requestGetGPC(con, sessionGetName(), "cpg", NULL));
+					//Старт сессии: ID сессии берется только из Cookie, остальные Cookie при этом не разбираются
+					session_ptr = requestGetCookieRaw(con, sessionGetName(), &len);
+					if(session_ptr && len == SESSION_ID_LEN){
+						memcpy(session_id, session_ptr, SESSION_ID_LEN);
+						session_id[SESSION_ID_LEN] = '\0';
+						session_ptr = session_id;
+					}else{
+						session_ptr = NULL;
+					}
+					con->session = sessionStart(session_ptr);
 					//Проверка принадлежности текущей сессии клиенту
-					uint32_t uagent_hash = hashString(con->request.user_agent.ptr, NULL);
+					uint32_t uagent_hash = hashString(requestGetKnownHeader(con, HEADER_INDEX_USER_AGENT, NULL), NULL);
 					if(!sessionIsValidClient(con->session, &con->remote_addr, uagent_hash)){
 						sessionClose(con->session);
 						con->session = sessionNew(NULL);
@@ -421,7 +627,7 @@ threadConnectionEngine(connection_s * con){
 					con->request.static_file = requestStaticFileInfo(con);
 					if(con->request.static_file){
 						if(BIT_ISSET(con->request.headers_bits,HEADER_IF_NONE_MATCH) &&
-						stringCompare(con->request.static_file->etag->ptr, con->request.if_none_match.ptr)){
+						stringCompare(con->request.static_file->etag->ptr, requestGetKnownHeader(con, HEADER_INDEX_IF_NONE_MATCH, NULL))){
 							con->http_code = 304;
 							break;
 						}
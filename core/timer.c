@@ -0,0 +1,193 @@
+/***********************************************************************
+ * XG SERVER
+ * core/timer.c
+ * Таймеры соединений реактора (двоичная куча по времени срабатывания)
+ *
+ * Copyright (с) 2014-2015 Stanislav V. Tretyakov, svtrostov@yandex.ru
+ **********************************************************************/
+
+
+#include "core.h"
+#include "server.h"
+#include "globals.h"
+
+
+/*
+ * Таймеры хранятся в двоичной куче reactor->timers, упорядоченной по con->timer_deadline:
+ * в корне кучи всегда находится соединение с ближайшим сроком срабатывания.
+ * con->timer_index - позиция соединения в куче + 1, 0 - таймер соединения не установлен
+ * (нулевое значение совпадает с состоянием после connectionClear()).
+ * Куча изменяется только потоком реактора, поэтому блокировки не требуются.
+ */
+
+
+
+/***********************************************************************
+ * Вспомогательные функции
+ **********************************************************************/
+
+
+/*
+ * Помещает соединение в позицию i кучи
+ */
+static inline void
+_timerPlace(reactor_s * reactor, uint32_t i, connection_s * con){
+	reactor->timers[i] = con;
+	con->timer_index = i + 1;
+}//END: _timerPlace
+
+
+
+/*
+ * Перемещение элемента кучи вверх, пока родитель срабатывает позже
+ */
+static void
+_timerSiftUp(reactor_s * reactor, uint32_t i){
+	connection_s * con = reactor->timers[i];
+	uint32_t parent;
+	while(i > 0){
+		parent = (i - 1) / 2;
+		if(reactor->timers[parent]->timer_deadline <= con->timer_deadline) break;
+		_timerPlace(reactor, i, reactor->timers[parent]);
+		i = parent;
+	}
+	_timerPlace(reactor, i, con);
+}//END: _timerSiftUp
+
+
+
+/*
+ * Перемещение элемента кучи вниз, пока один из потомков срабатывает раньше
+ */
+static void
+_timerSiftDown(reactor_s * reactor, uint32_t i){
+	connection_s * con = reactor->timers[i];
+	uint32_t child;
+	while((child = i * 2 + 1) < reactor->timers_count){
+		if(child + 1 < reactor->timers_count && reactor->timers[child + 1]->timer_deadline < reactor->timers[child]->timer_deadline) child++;
+		if(con->timer_deadline <= reactor->timers[child]->timer_deadline) break;
+		_timerPlace(reactor, i, reactor->timers[child]);
+		i = child;
+	}
+	_timerPlace(reactor, i, con);
+}//END: _timerSiftDown
+
+
+
+/***********************************************************************
+ * Функции
+ **********************************************************************/
+
+
+/*
+ * Создание кучи таймеров реактора
+ */
+result_e
+timersCreate(reactor_s * reactor){
+	reactor->timers_size	= max(1, min(server_connections_initial_size, reactor->server->config.max_connections));
+	reactor->timers			= (connection_s **)mNewZ(sizeof(connection_s *) * reactor->timers_size);
+	reactor->timers_count	= 0;
+	return RESULT_OK;
+}//END: timersCreate
+
+
+
+/*
+ * Уничтожение кучи таймеров реактора
+ */
+void
+timersFree(reactor_s * reactor){
+	uint32_t i;
+	for(i = 0; i < reactor->timers_count; i++) reactor->timers[i]->timer_index = 0;
+	mFree(reactor->timers);
+	reactor->timers			= NULL;
+	reactor->timers_count	= 0;
+	reactor->timers_size	= 0;
+}//END: timersFree
+
+
+
+/*
+ * Устанавливает (или переносит) таймер соединения на время deadline_ms (Unix время в миллисекундах)
+ */
+void
+timerSet(connection_s * con, uint64_t deadline_ms){
+	reactor_s * reactor = con->reactor;
+	uint32_t i;
+
+	//Таймер уже установлен - изменяем срок и восстанавливаем порядок кучи
+	if(con->timer_index > 0){
+		if(con->timer_deadline == deadline_ms) return;
+		i = con->timer_index - 1;
+		con->timer_deadline = deadline_ms;
+		_timerSiftUp(reactor, i);
+		_timerSiftDown(reactor, con->timer_index - 1);
+		return;
+	}
+
+	//Куча заполнена - увеличиваем в два раза
+	if(reactor->timers_count >= reactor->timers_size){
+		reactor->timers_size *= 2;
+		reactor->timers = (connection_s **)mResize(reactor->timers, sizeof(connection_s *) * reactor->timers_size);
+	}
+
+	con->timer_deadline = deadline_ms;
+	_timerPlace(reactor, reactor->timers_count, con);
+	reactor->timers_count++;
+	_timerSiftUp(reactor, reactor->timers_count - 1);
+}//END: timerSet
+
+
+
+/*
+ * Удаляет таймер соединения, если он был установлен
+ */
+void
+timerDelete(connection_s * con){
+	if(!con->timer_index) return;
+	reactor_s * reactor = con->reactor;
+	uint32_t i = con->timer_index - 1;
+	connection_s * last;
+
+	con->timer_index	= 0;
+	con->timer_deadline	= 0;
+	reactor->timers_count--;
+
+	//Последний элемент кучи занимает освободившуюся позицию
+	if(i < reactor->timers_count){
+		last = reactor->timers[reactor->timers_count];
+		_timerPlace(reactor, i, last);
+		_timerSiftUp(reactor, i);
+		_timerSiftDown(reactor, last->timer_index - 1);
+	}
+	reactor->timers[reactor->timers_count] = NULL;
+}//END: timerDelete
+
+
+
+/*
+ * Возвращает соединение, таймер которого сработал к моменту now_ms, одновременно удаляя таймер,
+ * или NULL, если сработавших таймеров нет
+ */
+connection_s *
+timerGetExpired(reactor_s * reactor, uint64_t now_ms){
+	if(!reactor->timers_count) return NULL;
+	connection_s * con = reactor->timers[0];
+	if(con->timer_deadline > now_ms) return NULL;
+	timerDelete(con);
+	return con;
+}//END: timerGetExpired
+
+
+
+/*
+ * Возвращает интервал (в миллисекундах) до срабатывания ближайшего таймера, но не более max_ms
+ */
+int
+timerNextTimeout(reactor_s * reactor, uint64_t now_ms, int max_ms){
+	if(!reactor->timers_count) return max_ms;
+	uint64_t deadline = reactor->timers[0]->timer_deadline;
+	if(deadline <= now_ms) return 0;
+	return (int)min((uint64_t)max_ms, deadline - now_ms);
+}//END: timerNextTimeout
+
@@ -278,6 +278,30 @@ nowNanoseconds(void){
 
 
 
+/*
+ * Функция возвращает текущее Unix время в миллисекундах
+ */
+uint64_t
+nowMilliseconds(void){
+	struct timespec tmsp;
+	clock_gettime(CLOCK_REALTIME, &tmsp);
+	return (uint64_t)tmsp.tv_sec * 1000 + (uint64_t)(tmsp.tv_nsec / 1000000);
+}//END: nowMilliseconds
+
+
+
+/*
+ * Функция возвращает текущее монотонное время в миллисекундах (не зависит от изменения системного времени)
+ */
+uint64_t
+nowMonotonicMilliseconds(void){
+	struct timespec tmsp;
+	clock_gettime(CLOCK_MONOTONIC, &tmsp);
+	return (uint64_t)tmsp.tv_sec * 1000 + (uint64_t)(tmsp.tv_nsec / 1000000);
+}//END: nowMonotonicMilliseconds
+
+
+
 
 
 
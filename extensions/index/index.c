@@ -188,7 +188,7 @@ handleIndex(connection_s * con){
 int 
 start(extension_s * extension){
 	DEBUG_MSG("Extension loaded: %s\n", extension->filename);
-	routeAdd("/index", handleIndex);
+	routeAdd("/index", handleIndex, JOB_CLASS_NORMAL);
 	return 0;
 }//END: start
 
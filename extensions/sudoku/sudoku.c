@@ -49,7 +49,7 @@ handleSudoku(connection_s * con){
 int 
 start(extension_s * extension){
 	DEBUG_MSG("Extension loaded: %s\n", extension->filename);
-	routeAdd("/sudoku", handleSudoku);
+	routeAdd("/sudoku", handleSudoku, JOB_CLASS_NORMAL);
 	sudoku_s * sudoku = sudokuCreate(SPUZZLE_9X9, 1);
 	sudokuFree(sudoku);
 	return 0;
@@ -135,7 +135,8 @@ int main(int argc, char *argv[]){
 
 	//Маршруты
 	XG_ROUTES = kvNewRoot();
-	routeAdd("/json", handleJson);	//Добавление маршрута /json и функции - обработчика handleJson
+	routeAdd("/json", handleJson, JOB_CLASS_LOW);	//Добавление маршрута /json и функции - обработчика handleJson (запрос к базе данных - низкий приоритет)
+	routeSetBudget("/json", 5000);	//Запрос /json, ожидающий в очереди дольше 5 секунд от начала запроса, не обрабатывается
 
 	//Алиасы маршрутов
 	XG_ALIASES = kvGetByPath(XG_CONFIG,"/routes/aliases");
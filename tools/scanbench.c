@@ -0,0 +1,299 @@
+/***********************************************************************
+ * XG SERVER
+ * tools/scanbench.c
+ * Проверка и сравнение реализаций просмотра строк заголовков запроса (core/scan.c)
+ *
+ * Сборка и запуск: ./tools/scanbench.sh [количество повторов]
+ *
+ * Copyright (с) 2014-2015 Stanislav V. Tretyakov, svtrostov@yandex.ru
+ **********************************************************************/
+
+
+//Модуль включается целиком, чтобы получить доступ к статическим реализациям
+#include "../core/scan.c"
+
+
+/*
+ * Сначала все доступные процессору реализации сравниваются с побайтной на граничных случаях:
+ * строки длинной 15/16/17/31/32/33 байта (границы блоков SSE4.2 и AVX2), в каждой позиции которых
+ * по очереди стоит разделитель, пробел, табуляция, одиночный [\r], управляющий символ или DEL,
+ * строки с [\r\n] и [\n], строки без [\n] и с данными следующей строки после [\n].
+ * Затем на типичных заголовках запросов измеряется время просмотра всех строк заголовка
+ * каждой реализацией и прежним способом: strchr() до [\n] и поиск [:] в строке.
+ */
+
+
+typedef struct type_scanbench_impl_s{
+	const char		* name;
+	scan_line_f		scan;
+	bool			supported;
+} scanbench_impl_s;
+
+
+//Типичные заголовки запросов
+static const char * scanbench_heads[] = {
+	"GET / HTTP/1.1\r\n"
+	"Host: example.com\r\n"
+	"User-Agent: curl/7.81.0\r\n"
+	"Accept: */*\r\n"
+	"\r\n",
+
+	"GET /catalog/item?id=1532&ref=main HTTP/1.1\r\n"
+	"Host: www.example.com\r\n"
+	"Connection: keep-alive\r\n"
+	"Cache-Control: max-age=0\r\n"
+	"Upgrade-Insecure-Requests: 1\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+	"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8\r\n"
+	"Accept-Encoding: gzip, deflate, br\r\n"
+	"Accept-Language: ru-RU,ru;q=0.9,en-US;q=0.8,en;q=0.7\r\n"
+	"Cookie: SESSID=3f2a9c0d7e6b4a1f8c5d2e9b0a7f6c3d; lang=ru; theme=dark\r\n"
+	"If-None-Match: \"5f3c-1a2b3c4d\"\r\n"
+	"\r\n",
+
+	"POST /ajax/user/save HTTP/1.1\r\n"
+	"Host: example.com\r\n"
+	"Content-Type: application/x-www-form-urlencoded; charset=UTF-8\r\n"
+	"Content-Length: 64\r\n"
+	"X-Requested-With: XMLHttpRequest\r\n"
+	"Origin: https://example.com\r\n"
+	"Referer: https://example.com/user/profile\r\n"
+	"X-Forwarded-For: 203.0.113.7, 198.51.100.23\r\n"
+	"\r\n"
+};
+
+#define SCANBENCH_HEADS (sizeof(scanbench_heads) / sizeof(scanbench_heads[0]))
+
+
+
+/***********************************************************************
+ * Вспомогательные функции
+ **********************************************************************/
+
+
+/*
+ * Текущее монотонное время в наносекундах
+ */
+static uint64_t
+_benchNow(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}//END: _benchNow
+
+
+
+/*
+ * Просмотр строки реализацией scan (повторяет инициализацию scanRequestLine)
+ */
+static const char *
+_benchScan(scan_line_f scan, const char * line, size_t len, request_line_s * result){
+	result->len		= 0;
+	result->colon	= -1;
+	result->space	= -1;
+	result->spaces	= 0;
+	result->illegal	= false;
+	return scan(line, len, result);
+}//END: _benchScan
+
+
+
+/*
+ * Сравнение результата реализации impl с результатом побайтного просмотра
+ * Возвращает false и выводит описание строки, если результаты различаются
+ */
+static bool
+_benchCompare(scanbench_impl_s * impl, const char * line, size_t len, const char * what){
+	request_line_s expect, got;
+	const char * next_expect	= _benchScan(_scanLineScalar, line, len, &expect);
+	const char * next_got		= _benchScan(impl->scan, line, len, &got);
+
+	if(next_expect != next_got || (next_expect && (
+		expect.len != got.len || expect.colon != got.colon || expect.space != got.space ||
+		expect.spaces != got.spaces || expect.illegal != got.illegal
+	))){
+		printf("FAIL %s: %s, len=%zu\n", impl->name, what, len);
+		printf("  scalar: next=%td len=%u colon=%d space=%d spaces=%u illegal=%d\n", (next_expect ? next_expect - line : -1), expect.len, expect.colon, expect.space, expect.spaces, expect.illegal);
+		printf("  %s: next=%td len=%u colon=%d space=%d spaces=%u illegal=%d\n", impl->name, (next_got ? next_got - line : -1), got.len, got.colon, got.space, got.spaces, got.illegal);
+		return false;
+	}
+	return true;
+}//END: _benchCompare
+
+
+
+/*
+ * Проверка ожидаемого результата побайтного просмотра
+ */
+static bool
+_benchExpect(const char * line, size_t len, uint32_t rlen, int32_t colon, int32_t space, bool illegal, const char * what){
+	request_line_s result;
+	if(_benchScan(_scanLineScalar, line, len, &result) == NULL || result.len != rlen || result.colon != colon || result.space != space || result.illegal != illegal){
+		printf("FAIL scalar: %s (len=%u colon=%d space=%d illegal=%d)\n", what, result.len, result.colon, result.space, result.illegal);
+		return false;
+	}
+	return true;
+}//END: _benchExpect
+
+
+
+/*
+ * Граничные случаи: все реализации должны давать тот же результат, что и побайтный просмотр
+ * Возвращает количество ошибок
+ */
+static uint32_t
+_benchEdgeCases(scanbench_impl_s * impls, size_t impls_count){
+	static const size_t lengths[] = {15, 16, 17, 31, 32, 33};
+	static const char specials[] = {':', ' ', '\t', '\r', 0x01, 0x7F};
+	char line[128], what[64];
+	uint32_t errors = 0;
+	size_t i, l, s, p, len;
+
+	//Ожидаемые значения для [\r\n], одиночного [\r] и одиночного [\r] перед [\r\n]
+	errors += !_benchExpect("Host: a.b\r\n", 11, 9, 4, 5, false, "CRLF line");
+	errors += !_benchExpect("Host: a\rb\n", 10, 9, 4, 5, true, "bare CR inside line");
+	errors += !_benchExpect("Host: ab\r\r\n", 11, 9, 4, 5, true, "bare CR before CRLF");
+	errors += !_benchExpect("\r\n", 2, 0, -1, -1, false, "empty line");
+
+	for(l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++){
+		for(s = 0; s < sizeof(specials); s++){
+			for(p = 0; p < lengths[l]; p++){
+
+				//Строка длинной lengths[l] байт вместе с [\r\n], за которой следует начало следующей строки
+				memset(line, 'a', sizeof(line));
+				len = lengths[l];
+				line[len - 2]	= '\r';
+				line[len - 1]	= '\n';
+				if(p < len - 2) line[p] = specials[s];
+				memcpy(&line[len], "Next: x\r\n", 9);
+
+				for(i = 0; i < impls_count; i++){
+					if(!impls[i].supported) continue;
+					snprintf(what, sizeof(what), "CRLF, char 0x%02X at %zu", (unsigned char)specials[s], p);
+					errors += !_benchCompare(&impls[i], line, len, what);
+					errors += !_benchCompare(&impls[i], line, len + 9, what);
+					//Конец строки не найден
+					errors += !_benchCompare(&impls[i], line, len - 1, what);
+				}
+
+				//Та же длинна, строка заканчивается только [\n], символ может стоять перед [\n]
+				line[len - 2] = 'a';
+				if(p < len - 1) line[p] = specials[s];
+				for(i = 0; i < impls_count; i++){
+					if(!impls[i].supported) continue;
+					snprintf(what, sizeof(what), "LF, char 0x%02X at %zu", (unsigned char)specials[s], p);
+					errors += !_benchCompare(&impls[i], line, len, what);
+					errors += !_benchCompare(&impls[i], line, len + 9, what);
+				}
+			}
+		}
+	}
+
+	return errors;
+}//END: _benchEdgeCases
+
+
+
+/*
+ * Прежний способ просмотра: strchr() до [\n] и поиск [:] в строке (как charSearchN)
+ */
+static const char *
+_benchScanStrchr(const char * line, size_t len, request_line_s * scan){
+	const char * ptr = strchr(line, '\n');
+	const char * tmp;
+	uint32_t n;
+	(void)len;
+	if(!ptr) return NULL;
+	scan->len = (uint32_t)(ptr - line);
+	if(scan->len > 0 && *(ptr - 1) == '\r') scan->len--;
+	for(tmp = line, n = scan->len; *tmp && n-- > 0; tmp++){
+		if(*tmp == ':'){
+			scan->colon = (int32_t)(tmp - line);
+			break;
+		}
+	}
+	return ptr + 1;
+}//END: _benchScanStrchr
+
+
+
+/*
+ * Просмотр всех строк всех заголовков loops раз
+ * Возвращает время в наносекундах на один заголовок
+ */
+static double
+_benchRun(scan_line_f scan, uint32_t loops){
+	request_line_s result;
+	const char * line, * end, * next;
+	uint64_t start, lines = 0;
+	uint32_t n;
+	size_t h;
+
+	start = _benchNow();
+	for(n = 0; n < loops; n++){
+		for(h = 0; h < SCANBENCH_HEADS; h++){
+			line	= scanbench_heads[h];
+			end		= line + strlen(line);
+			while((next = _benchScan(scan, line, (size_t)(end - line), &result)) != NULL && result.len > 0){
+				line = next;
+				lines++;
+			}
+		}
+	}
+	//Результат используется, чтобы компилятор не удалил цикл
+	if(lines == 0) printf("no lines\n");
+
+	return (double)(_benchNow() - start) / ((double)loops * SCANBENCH_HEADS);
+}//END: _benchRun
+
+
+
+/***********************************************************************
+ * Точка входа
+ **********************************************************************/
+
+
+int
+main(int argc, char ** argv){
+	scanbench_impl_s impls[] = {
+		{"scalar",	_scanLineScalar,	true},
+		#ifdef SCAN_X86
+		{"SSE4.2",	_scanLineSSE42,		false},
+		{"AVX2",	_scanLineAVX2,		false},
+		#endif
+	};
+	size_t impls_count = sizeof(impls) / sizeof(impls[0]);
+	uint32_t loops = (argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 1000000);
+	uint32_t errors;
+	size_t i, bytes = 0;
+	double ns, ns_strchr;
+
+	#ifdef SCAN_X86
+	__builtin_cpu_init();
+	impls[1].supported = __builtin_cpu_supports("sse4.2");
+	impls[2].supported = __builtin_cpu_supports("avx2") && impls[1].supported;
+	#endif
+
+	if((errors = _benchEdgeCases(impls, impls_count)) > 0){
+		printf("Edge cases: %u errors\n", errors);
+		return 1;
+	}
+	printf("Edge cases: OK\n");
+
+	for(i = 0; i < SCANBENCH_HEADS; i++) bytes += strlen(scanbench_heads[i]);
+	printf("Heads: %zu, average size: %zu bytes, loops: %u\n", (size_t)SCANBENCH_HEADS, bytes / SCANBENCH_HEADS, loops);
+
+	ns_strchr = _benchRun(_benchScanStrchr, loops);
+	printf("%-8s %8.1f ns/head\n", "strchr", ns_strchr);
+
+	for(i = 0; i < impls_count; i++){
+		if(!impls[i].supported){
+			printf("%-8s not supported by CPU\n", impls[i].name);
+			continue;
+		}
+		ns = _benchRun(impls[i].scan, loops);
+		printf("%-8s %8.1f ns/head (x%.2f vs strchr)\n", impls[i].name, ns, ns_strchr / ns);
+	}
+
+	return 0;
+}//END: main
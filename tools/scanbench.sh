@@ -0,0 +1,12 @@
+#!/bin/sh
+#Сборка и запуск сравнения реализаций просмотра строк заголовков запроса (core/scan.c)
+#Запуск из корня проекта: ./tools/scanbench.sh [количество повторов]
+gcc ./tools/scanbench.c													\
+																		\
+	-o ./tools/scanbench												\
+																		\
+	-I/usr/local/include/												\
+	-I./core/															\
+	-I./framework/														\
+	-Wall -O2 &&														\
+./tools/scanbench "$@"